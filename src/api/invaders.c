@@ -0,0 +1,74 @@
+#include "invaders.h"
+#include "machine.h"
+#include "memory.h"
+#include "input.h"
+
+#include <stdlib.h>
+
+// An Invaders handle is a Machine; the struct is never defined outside these casts
+static Machine *machine_of_handle(Invaders *invaders) {
+    return (Machine *)invaders;
+}
+
+static const Machine *const_machine_of_handle(const Invaders *invaders) {
+    return (const Machine *)invaders;
+}
+
+int invaders_api_version(void) {
+    return INVADERS_API_VERSION;
+}
+
+const char *invaders_load_rom(const char *path) {
+    return load_rom(path);
+}
+
+Invaders *invaders_create(void) {
+    return (Invaders *)machine_create();
+}
+
+void invaders_destroy(Invaders *invaders) {
+    if (invaders)
+        machine_destroy(machine_of_handle(invaders));
+}
+
+void invaders_reset(Invaders *invaders) {
+    machine_reset(machine_of_handle(invaders));
+}
+
+int invaders_set_core(Invaders *invaders, int core) {
+    if (core < INVADERS_CORE_SWITCH || core > INVADERS_CORE_STATIC)
+        return -1;
+    machine_of_handle(invaders)->cpu.core = (CpuCore)core;
+    return 0;
+}
+
+void invaders_step_frame(Invaders *invaders) {
+    machine_run_frame(machine_of_handle(invaders));
+}
+
+int invaders_set_input(Invaders *invaders, int port, uint8_t value) {
+    if (port < 0 || port > 2)
+        return -1;
+    input_write(machine_of_handle(invaders), (uint8_t)port, value);
+    return 0;
+}
+
+const uint8_t *invaders_framebuffer(Invaders *invaders) {
+    return machine_framebuffer(machine_of_handle(invaders));
+}
+
+size_t invaders_state_size(void) {
+    return MACHINE_STATE_SIZE;
+}
+
+size_t invaders_save_state(const Invaders *invaders, void *state, size_t size) {
+    return machine_save_state(const_machine_of_handle(invaders), (uint8_t *)state, size);
+}
+
+int invaders_load_state(Invaders *invaders, const void *state, size_t size) {
+    return machine_load_state(machine_of_handle(invaders), (const uint8_t *)state, size);
+}
+
+void invaders_clone(Invaders *dst, Invaders *src) {
+    machine_clone(machine_of_handle(dst), machine_of_handle(src));
+}
@@ -0,0 +1,153 @@
+#ifndef INVADERS_H
+#define INVADERS_H
+
+// libinvaders: the emulator core as a library, with no SDL.
+//
+// Everything is reached through an opaque Invaders handle and plain integer
+// types, so the ABI stays the same when the core's structs change. Each
+// handle is one independent machine; different handles may be stepped from
+// different threads at the same time, one handle from one thread at a time.
+// The ROM is shared by every handle and loaded once, before any runs.
+// Faults inside the emulated machine (a write to ROM, an unknown port)
+// still end the process with a message, as they do in the executable.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(INVADERS_SHARED)
+#ifdef INVADERS_BUILD
+#define INVADERS_API __declspec(dllexport)
+#else
+#define INVADERS_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define INVADERS_API __attribute__((visibility("default")))
+#else
+#define INVADERS_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped only when an existing function changes; new functions keep it
+#define INVADERS_API_VERSION    1
+
+// Video RAM as the game draws it: 224 columns of 256 pixels, 32 bytes each,
+// bit 0 of the first byte is the bottom pixel of the left column
+#define INVADERS_FRAMEBUFFER_SIZE   7168
+
+// Input port 1 bits
+#define INVADERS_CREDIT     0x01
+#define INVADERS_P2_START   0x02
+#define INVADERS_P1_START   0x04
+#define INVADERS_P1_FIRE    0x10
+#define INVADERS_P1_LEFT    0x20
+#define INVADERS_P1_RIGHT   0x40
+
+// Input port 2 bits
+#define INVADERS_SHIPS      0x03    // DIP switches: 3 + value ships
+#define INVADERS_TILT       0x04
+#define INVADERS_P2_FIRE    0x10
+#define INVADERS_P2_LEFT    0x20
+#define INVADERS_P2_RIGHT   0x40
+
+// Execution cores, see docs/cpu.md
+enum {
+    INVADERS_CORE_SWITCH,
+    INVADERS_CORE_THREADED,
+    INVADERS_CORE_JIT,
+    INVADERS_CORE_STATIC
+};
+
+typedef struct Invaders Invaders;
+
+INVADERS_API int invaders_api_version(void);
+
+/**
+ * Loads the ROM image every handle runs
+ *
+ * @return  NULL on success, else a description of the error
+ */
+INVADERS_API const char *invaders_load_rom(const char *path);
+
+// A new machine is in its power-on state
+INVADERS_API Invaders *invaders_create(void);
+INVADERS_API void invaders_destroy(Invaders *invaders);
+
+INVADERS_API void invaders_reset(Invaders *invaders);
+
+// 0, or -1 for an unknown core
+INVADERS_API int invaders_set_core(Invaders *invaders, int core);
+
+// Runs one 60 Hz frame, both video interrupts included
+INVADERS_API void invaders_step_frame(Invaders *invaders);
+
+// Input ports 0-2, see the bit masks above; -1 for any other port
+INVADERS_API int invaders_set_input(Invaders *invaders, int port, uint8_t value);
+
+// INVADERS_FRAMEBUFFER_SIZE bytes, valid and updated in place until invaders_destroy.
+// Not const: the copy behind it is allocated the first time it is asked for.
+INVADERS_API const uint8_t *invaders_framebuffer(Invaders *invaders);
+
+// Bytes a saved state takes
+INVADERS_API size_t invaders_state_size(void);
+
+/**
+ * Saves or restores registers, ports and RAM. Images are portable between
+ * builds and hosts of the same state version.
+ *
+ * @return  invaders_save_state: bytes written, 0 if size is too small;
+ *          invaders_load_state: 0, or -1 if the image is not a state (handle unchanged)
+ */
+INVADERS_API size_t invaders_save_state(const Invaders *invaders, void *state, size_t size);
+INVADERS_API int invaders_load_state(Invaders *invaders, const void *state, size_t size);
+
+// Turns dst into a copy of src (registers, core, ports, RAM) that then runs on
+// its own, for forking in a search. The ROM is shared, and so are RAM pages
+// until either handle writes one, so a clone copies no RAM.
+INVADERS_API void invaders_clone(Invaders *dst, Invaders *src);
+
+/*** Batches: many machines stepped together on a thread pool ***/
+
+typedef struct InvadersBatch InvadersBatch;
+
+/**
+ * Creates envs machines on the given core, split in fixed slices over
+ * threads workers (0: one per CPU), the calling thread included. Each
+ * extra worker is pinned to its own CPU and allocates its slice itself.
+ *
+ * @return  NULL if envs is not positive, the core is unknown or a thread cannot start
+ */
+INVADERS_API InvadersBatch *invaders_batch_create(int envs, int threads, int core);
+INVADERS_API void invaders_batch_destroy(InvadersBatch *batch);
+
+/**
+ * Steps every env frames frames (frame skip) with input port 1 set to
+ * actions[env], stopping an env early when its game ends. Results go
+ * straight into the caller's arrays, indexed by env:
+ *
+ * @param observations  INVADERS_FRAMEBUFFER_SIZE bytes per env after its last frame, or NULL
+ * @param rewards       Points scored over the step
+ * @param dones         1 when the game ended during the step; the env starts
+ *                      its next step from the reset state
+ */
+INVADERS_API void invaders_batch_step(InvadersBatch *batch, const uint8_t *actions, int frames,
+                                      uint8_t *observations, int32_t *rewards, uint8_t *dones);
+
+// Marks env to restart from the reset state at the start of its next step,
+// without waiting for a step in progress; 0, or -1 for an unknown env
+INVADERS_API int invaders_batch_reset(InvadersBatch *batch, int env);
+
+// A state image (invaders_save_state) envs reset to instead of power-on, or NULL for power-on;
+// call between steps. 0, or -1 if it is not a state image
+INVADERS_API int invaders_batch_set_reset_state(InvadersBatch *batch, const void *state, size_t size);
+
+// The handle of one env, to set other input ports or read it between steps
+INVADERS_API Invaders *invaders_batch_env(InvadersBatch *batch, int env);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
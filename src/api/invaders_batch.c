@@ -0,0 +1,329 @@
+#include "invaders.h"
+#include "machine.h"
+#include "memory.h"
+#include "input.h"
+#include "threads.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Game variables in RAM (invaders ROM)
+#define GAME_MODE       0x20EF      // 1 while a game is being played, 0 in attract mode
+#define P1_SCORE        0x20F8      // 4 BCD digits, low byte first
+
+// Polls before a waiting thread sleeps; a frame is a few microseconds of work
+#define SPIN_LIMIT      4000
+
+typedef struct {
+    Machine *machine;
+    uint32_t score;
+    uint8_t playing;
+    atomic_int reset_pending;
+} Env;
+
+typedef struct Worker Worker;
+
+struct InvadersBatch {
+    int envs;
+    int workers;            // Including the thread that calls invaders_batch_step
+    CpuCore core;
+    Env *env;
+    Worker *worker;
+    uint8_t *reset_state;   // NULL: power-on
+
+    // The step being run, written by the caller before generation moves
+    const uint8_t *actions;
+    int frames;
+    uint8_t *observations;
+    int32_t *rewards;
+    uint8_t *dones;
+
+    atomic_uint generation; // Bumped once per step, workers run when it moves
+    atomic_int pending;     // Workers not done with the current step or startup
+    atomic_int stopping;
+    Mutex mutex;            // Only for sleeping on the two conditions
+    Cond wake;
+    Cond done;
+};
+
+struct Worker {
+    InvadersBatch *batch;
+    int index;
+    int first, last;        // Envs [first, last)
+    Thread thread;
+};
+
+/*** Envs ***/
+
+static uint32_t bcd(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+static uint32_t env_score(const Machine *machine) {
+    return bcd(read_memory(&machine->memory, P1_SCORE + 1)) * 100 + bcd(read_memory(&machine->memory, P1_SCORE));
+}
+
+static void env_reset(InvadersBatch *batch, Env *env) {
+    if (batch->reset_state)
+        machine_load_state(env->machine, batch->reset_state, MACHINE_STATE_SIZE);
+    else
+        machine_reset(env->machine);
+
+    env->score = env_score(env->machine);
+    env->playing = read_memory(&env->machine->memory, GAME_MODE);
+}
+
+static void env_step(InvadersBatch *batch, int index) {
+    Env *env = &batch->env[index];
+    Machine *machine = env->machine;
+    int32_t reward = 0;
+    uint8_t done = 0;
+
+    if (atomic_exchange_explicit(&env->reset_pending, 0, memory_order_acquire))
+        env_reset(batch, env);
+
+    input_write(machine, 1, batch->actions[index]);
+
+    for (int frame = 0; frame < batch->frames && !done; frame++) {
+        machine_run_frame(machine);
+
+        // A new game clears the score, which is not a negative reward
+        uint32_t score = env_score(machine);
+        if (score > env->score)
+            reward += (int32_t)(score - env->score);
+        env->score = score;
+
+        uint8_t playing = read_memory(&machine->memory, GAME_MODE);
+        done = env->playing && !playing;
+        env->playing = playing;
+    }
+
+    if (batch->observations)
+        memory_get_ram(&machine->memory, VIDEO_RAM_START - RAM_START,
+                       batch->observations + (size_t)index * INVADERS_FRAMEBUFFER_SIZE, INVADERS_FRAMEBUFFER_SIZE);
+    if (batch->rewards)
+        batch->rewards[index] = reward;
+    if (batch->dones)
+        batch->dones[index] = done;
+    if (done)
+        atomic_store_explicit(&env->reset_pending, 1, memory_order_relaxed);
+}
+
+/*** Workers ***/
+
+static void worker_create_envs(Worker *worker) {
+    InvadersBatch *batch = worker->batch;
+
+    for (int i = worker->first; i < worker->last; i++) {
+        Env *env = &batch->env[i];
+        env->machine = machine_create();
+        env->machine->cpu.core = batch->core;
+        env_reset(batch, env);
+        atomic_init(&env->reset_pending, 0);
+    }
+}
+
+static void worker_finished(InvadersBatch *batch) {
+    if (atomic_fetch_sub_explicit(&batch->pending, 1, memory_order_acq_rel) == 1) {
+        mutex_lock(&batch->mutex);
+        cond_broadcast(&batch->done);
+        mutex_unlock(&batch->mutex);
+    }
+}
+
+// Spins, then sleeps, until generation is no longer seen
+static unsigned wait_generation(InvadersBatch *batch, unsigned seen) {
+    unsigned generation;
+
+    for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+        generation = atomic_load_explicit(&batch->generation, memory_order_acquire);
+        if (generation != seen)
+            return generation;
+        cpu_relax();
+    }
+
+    mutex_lock(&batch->mutex);
+    while ((generation = atomic_load_explicit(&batch->generation, memory_order_acquire)) == seen)
+        cond_wait(&batch->wake, &batch->mutex);
+    mutex_unlock(&batch->mutex);
+    return generation;
+}
+
+static void wait_workers(InvadersBatch *batch) {
+    for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+        if (!atomic_load_explicit(&batch->pending, memory_order_acquire))
+            return;
+        cpu_relax();
+    }
+
+    mutex_lock(&batch->mutex);
+    while (atomic_load_explicit(&batch->pending, memory_order_acquire))
+        cond_wait(&batch->done, &batch->mutex);
+    mutex_unlock(&batch->mutex);
+}
+
+static void worker_run(void *arg) {
+    Worker *worker = (Worker*)arg;
+    InvadersBatch *batch = worker->batch;
+    unsigned seen = 0;
+
+    // Pinned before allocating, so the slice's machines are first touched from this CPU
+    thread_pin(worker->index % cpu_count());
+    worker_create_envs(worker);
+    worker_finished(batch);
+
+    for (;;) {
+        seen = wait_generation(batch, seen);
+        if (atomic_load_explicit(&batch->stopping, memory_order_relaxed))
+            break;
+
+        for (int i = worker->first; i < worker->last; i++)
+            env_step(batch, i);
+        worker_finished(batch);
+    }
+
+    jit_free();     // The JIT's buffers are per thread
+}
+
+// Wakes the workers on the next generation
+static void start_workers(InvadersBatch *batch) {
+    atomic_store_explicit(&batch->pending, batch->workers - 1, memory_order_relaxed);
+
+    mutex_lock(&batch->mutex);
+    atomic_fetch_add_explicit(&batch->generation, 1, memory_order_release);
+    cond_broadcast(&batch->wake);
+    mutex_unlock(&batch->mutex);
+}
+
+/*** API ***/
+
+InvadersBatch *invaders_batch_create(int envs, int threads, int core) {
+    if (envs <= 0 || core < INVADERS_CORE_SWITCH || core > INVADERS_CORE_STATIC)
+        return NULL;
+    if (threads <= 0)
+        threads = cpu_count();
+    if (threads > envs)
+        threads = envs;
+
+    InvadersBatch *batch = (InvadersBatch*)calloc(1, sizeof(InvadersBatch));
+    if (!batch) return NULL;
+    batch->env = (Env*)calloc(envs, sizeof(Env));
+    batch->worker = (Worker*)calloc(threads, sizeof(Worker));
+    if (!batch->env || !batch->worker) {
+        free(batch->env);
+        free(batch->worker);
+        free(batch);
+        return NULL;
+    }
+
+    batch->envs = envs;
+    batch->workers = threads;
+    batch->core = (CpuCore)core;
+    atomic_init(&batch->generation, 0);
+    atomic_init(&batch->pending, threads - 1);
+    atomic_init(&batch->stopping, 0);
+    mutex_init(&batch->mutex);
+    cond_init(&batch->wake);
+    cond_init(&batch->done);
+
+    for (int w = 0; w < threads; w++) {
+        Worker *worker = &batch->worker[w];
+        worker->batch = batch;
+        worker->index = w;
+        worker->first = (int)((int64_t)envs * w / threads);
+        worker->last = (int)((int64_t)envs * (w + 1) / threads);
+    }
+
+    // Worker 0 is whichever thread calls invaders_batch_step
+    int started = 1;
+    for (; started < threads; started++)
+        if (thread_create(&batch->worker[started].thread, worker_run, &batch->worker[started]) != 0)
+            break;
+
+    if (started < threads) {
+        // Count the workers that never started as finished, then stop the rest
+        atomic_fetch_sub(&batch->pending, threads - started);
+        batch->workers = started;
+        wait_workers(batch);
+        invaders_batch_destroy(batch);
+        return NULL;
+    }
+
+    worker_create_envs(&batch->worker[0]);
+    wait_workers(batch);
+    return batch;
+}
+
+void invaders_batch_destroy(InvadersBatch *batch) {
+    if (!batch) return;
+
+    atomic_store(&batch->stopping, 1);
+    start_workers(batch);
+    for (int w = 1; w < batch->workers; w++)
+        thread_join(batch->worker[w].thread);
+
+    for (int i = 0; i < batch->envs; i++)
+        if (batch->env[i].machine)
+            machine_destroy(batch->env[i].machine);
+
+    mutex_destroy(&batch->mutex);
+    cond_destroy(&batch->wake);
+    cond_destroy(&batch->done);
+    free(batch->reset_state);
+    free(batch->worker);
+    free(batch->env);
+    free(batch);
+}
+
+void invaders_batch_step(InvadersBatch *batch, const uint8_t *actions, int frames,
+                         uint8_t *observations, int32_t *rewards, uint8_t *dones) {
+    batch->actions = actions;
+    batch->frames = frames;
+    batch->observations = observations;
+    batch->rewards = rewards;
+    batch->dones = dones;
+
+    start_workers(batch);
+
+    Worker *worker = &batch->worker[0];
+    for (int i = worker->first; i < worker->last; i++)
+        env_step(batch, i);
+
+    wait_workers(batch);
+}
+
+int invaders_batch_reset(InvadersBatch *batch, int env) {
+    if (env < 0 || env >= batch->envs)
+        return -1;
+    atomic_store_explicit(&batch->env[env].reset_pending, 1, memory_order_release);
+    return 0;
+}
+
+int invaders_batch_set_reset_state(InvadersBatch *batch, const void *state, size_t size) {
+    if (!state) {
+        free(batch->reset_state);
+        batch->reset_state = NULL;
+        return 0;
+    }
+
+    // Checked on a scratch machine, so envs only ever load good images
+    Machine *scratch = machine_create();
+    int result = machine_load_state(scratch, (const uint8_t*)state, size);
+    machine_destroy(scratch);
+    if (result != 0)
+        return -1;
+
+    uint8_t *copy = (uint8_t*)malloc(MACHINE_STATE_SIZE);
+    if (!copy) return -1;
+    memcpy(copy, state, MACHINE_STATE_SIZE);
+    free(batch->reset_state);
+    batch->reset_state = copy;
+    return 0;
+}
+
+Invaders *invaders_batch_env(InvadersBatch *batch, int env) {
+    if (env < 0 || env >= batch->envs)
+        return NULL;
+    return (Invaders*)batch->env[env].machine;
+}
@@ -0,0 +1,197 @@
+#include "cli.h"
+#include "memory.h"
+#include "output.h"
+#include "hle.h"
+#include "loop_idiom.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static const char usage[] =
+    "usage: space_invaders_emulator [options]\n"
+    "  --rom PATH               ROM image, the built-in path by default\n"
+    "  --core NAME              switch, threaded, jit or static (also --switch, --threaded, --jit, --static)\n"
+    "  --frames N               stop after N frames (required with --headless)\n"
+    "  --speed X                cap at X times real time (1 = 60 frames/s)\n"
+    "  --headless               no window, sound or keyboard, uncapped unless --speed is given\n"
+    "  --dump-framebuffer FILE  write the 7 KB of video RAM after the last frame\n"
+    "  --dump-ram FILE          write all 8 KB of RAM after the last frame\n"
+    "  --record FILE            append every frame's video RAM to FILE\n"
+    "  --record-ppm FILE        append every frame to FILE as a PPM image\n"
+    "  --no-hle, --hle-verify   native ROM routines off, or checked against the interpreter\n"
+    "  --no-loop-idioms         run fill and copy loops instruction by instruction\n";
+
+static void usage_error(const char *message) {
+    fputs(usage, stderr);
+    error(message);
+}
+
+// The argument after argv[*i], for options that take one
+static const char *option_value(int argc, char *argv[], int *i) {
+    if (*i + 1 >= argc)
+        usage_error("option needs a value");
+    return argv[++*i];
+}
+
+static int parse_core(const char *name, CpuCore *core) {
+    if (strcmp(name, "switch") == 0)
+        *core = CPU_CORE_SWITCH;
+    else if (strcmp(name, "threaded") == 0)
+        *core = CPU_CORE_THREADED;
+    else if (strcmp(name, "jit") == 0)
+        *core = CPU_CORE_JIT;
+    else if (strcmp(name, "static") == 0)
+        *core = CPU_CORE_STATIC;
+    else
+        return 0;
+    return 1;
+}
+
+void cli_parse(CliOptions *options, int argc, char *argv[]) {
+    memset(options, 0, sizeof(*options));
+    options->core = DEFAULT_CPU_CORE;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        char *end;
+
+        if (strcmp(arg, "--core") == 0) {
+            if (!parse_core(option_value(argc, argv, &i), &options->core))
+                usage_error("unknown core");
+        } else if (strncmp(arg, "--", 2) == 0 && parse_core(arg + 2, &options->core)) {
+            // --switch, --threaded, --jit, --static
+        } else if (strcmp(arg, "--rom") == 0) {
+            options->rom_path = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--frames") == 0) {
+            unsigned long frames = strtoul(option_value(argc, argv, &i), &end, 10);
+            if (*end || frames > UINT32_MAX)
+                usage_error("--frames needs a frame count");
+            options->frames = (uint32_t)frames;
+        } else if (strcmp(arg, "--speed") == 0) {
+            options->speed = strtod(option_value(argc, argv, &i), &end);
+            if (*end || options->speed < 0)
+                usage_error("--speed needs a multiple of real time");
+        } else if (strcmp(arg, "--headless") == 0) {
+            options->headless = 1;
+        } else if (strcmp(arg, "--dump-framebuffer") == 0) {
+            options->dump_framebuffer = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--dump-ram") == 0) {
+            options->dump_ram = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--record") == 0 || strcmp(arg, "--record-ppm") == 0) {
+            options->record = option_value(argc, argv, &i);
+            options->record_format = strcmp(arg, "--record") == 0 ? VIDEO_VRAM : VIDEO_PIXELS;
+        } else if (strcmp(arg, "--no-hle") == 0) {
+            hle_set_mode(HLE_OFF);
+        } else if (strcmp(arg, "--hle-verify") == 0) {
+            hle_set_mode(HLE_VERIFY);
+        } else if (strcmp(arg, "--no-loop-idioms") == 0) {
+            loop_idiom_set_enabled(0);
+        } else if (strcmp(arg, "--help") == 0) {
+            fputs(usage, stdout);
+            exit(0);
+        } else {
+            usage_error("unknown option");
+        }
+    }
+
+    if (options->headless && !options->frames)
+        usage_error("--headless needs --frames");
+}
+
+void cli_load_rom(const CliOptions *options) {
+    if (!options->rom_path) {
+        load_rom_into_mem();
+        return;
+    }
+
+    const char *message = load_rom(options->rom_path);
+    if (message) error(message);
+    printf("ROM loaded successfully: %s\n", options->rom_path);
+}
+
+void cli_run_frame(Machine *machine) {
+    machine_run_frame(machine);
+
+    // Handle output effects based on CPU state or ports
+    for (int port = 0; port < NUM_OUTPUT_PORTS; port++) {
+        uint8_t port_value = output_read(machine, port);  // Read from each output port
+        machine_out(machine, port, port_value);      // Process output based on port value
+    }
+}
+
+VideoSink *cli_record_create(const CliOptions *options) {
+    return options->record ? video_file_create(options->record, options->record_format) : NULL;
+}
+
+static void write_file(const char *path, const uint8_t *bytes, size_t size) {
+    FILE *file = fopen(path, "wb");
+    if (!file) error("cannot open dump file");
+
+    size_t written = fwrite(bytes, 1, size, file);
+    if (fclose(file) != 0 || written != size)
+        error("failed to write dump file");
+}
+
+void cli_dump(const CliOptions *options, const Machine *machine) {
+    uint8_t ram[RAM_SIZE];
+
+    memory_get_ram(&machine->memory, 0, ram, RAM_SIZE);
+    if (options->dump_framebuffer)
+        write_file(options->dump_framebuffer, &ram[VIDEO_RAM_START - RAM_START], VIDEO_RAM_SIZE);
+    if (options->dump_ram)
+        write_file(options->dump_ram, ram, RAM_SIZE);
+}
+
+/*** Frame pacing ***/
+
+double cli_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+static void sleep_seconds(double seconds) {
+#ifdef _WIN32
+    Sleep((DWORD)(seconds * 1000));
+#else
+    struct timespec wait;
+    wait.tv_sec = (time_t)seconds;
+    wait.tv_nsec = (long)((seconds - wait.tv_sec) * 1e9);
+    nanosleep(&wait, NULL);
+#endif
+}
+
+void pacer_start(FramePacer *pacer, double speed) {
+    pacer->frame_seconds = speed > 0 ? 1.0 / (FRAME_RATE * speed) : 0;
+    pacer->next = cli_seconds();
+}
+
+void pacer_wait(FramePacer *pacer) {
+    if (!pacer->frame_seconds)
+        return;
+
+    double now = cli_seconds();
+    pacer->next += pacer->frame_seconds;
+
+    // More than a frame behind: start over from now instead of running the backlog uncapped
+    if (now > pacer->next + pacer->frame_seconds) {
+        pacer->next = now;
+        return;
+    }
+    if (pacer->next > now)
+        sleep_seconds(pacer->next - now);
+}
@@ -0,0 +1,50 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "machine.h"
+#include "video.h"
+
+// Command line of the executable, shared by the SDL window and the headless run
+
+typedef struct {
+    const char *rom_path;           // NULL: load_rom_into_mem's default path
+    CpuCore core;
+    int headless;                   // --headless: no SDL video, audio or events
+    uint32_t frames;                // Frames to run, 0 until the window is closed
+    double speed;                   // Cap in multiples of real time, 0 for none
+    const char *dump_framebuffer;   // Video RAM after the last frame, NULL for none
+    const char *dump_ram;           // All 8 KB of RAM after the last frame, NULL for none
+    const char *record;             // Every frame to a file sink, NULL for none
+    VideoFormat record_format;
+} CliOptions;
+
+// Fills options from argv, prints the usage and exits on --help or a bad argument
+void cli_parse(CliOptions *options, int argc, char *argv[]);
+
+// Loads options->rom_path, or the default ROM, exits on failure
+void cli_load_rom(const CliOptions *options);
+
+// One frame the way the window runs it: machine_run_frame, then every output
+// port written back through machine_out. Headless runs skip the write-back.
+void cli_run_frame(Machine *machine);
+
+// File sink for options->record, NULL without one
+VideoSink *cli_record_create(const CliOptions *options);
+
+// Writes the dumps options asks for, exits on failure
+void cli_dump(const CliOptions *options, const Machine *machine);
+
+/*** Frame pacing, without SDL ***/
+
+typedef struct {
+    double frame_seconds;   // 0 when uncapped
+    double next;            // When the next frame is due
+} FramePacer;
+
+double cli_seconds(void);   // Monotonic, for timing runs
+void pacer_start(FramePacer *pacer, double speed);
+void pacer_wait(FramePacer *pacer);     // Sleeps until the next frame is due
+
+#endif
@@ -0,0 +1,39 @@
+#include "headless.h"
+#include "cpu.h"
+#include "machine.h"
+#include "video.h"
+
+#include <stdio.h>
+
+int run_headless(const CliOptions *options) {
+    Machine *machine = machine_create();   // No sound hook: port 3/5 writes are dropped
+    machine->cpu.core = options->core;
+    cli_load_rom(options);
+
+    // Frames only go anywhere with --record
+    VideoSink *video = cli_record_create(options);
+    if (!video)
+        video = video_null_create();
+
+    FramePacer pacer;
+    pacer_start(&pacer, options->speed);
+    double start = cli_seconds();
+
+    // The frame only, like invaders_step_frame: no output-port write-back
+    for (uint32_t frame = 0; frame < options->frames; frame++) {
+        machine_run_frame(machine);
+        video_present(video, machine);
+        pacer_wait(&pacer);
+    }
+
+    double seconds = cli_seconds() - start;
+    fprintf(stderr, "%u frames in %.3f s, %.0f frames/s (%.1fx real time)\n", options->frames, seconds,
+            options->frames / seconds, options->frames / (seconds * FRAME_RATE));
+
+    cli_dump(options, machine);
+
+    video_destroy(video);
+    machine_destroy(machine);
+    jit_free();
+    return 0;
+}
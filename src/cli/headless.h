@@ -0,0 +1,12 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "cli.h"
+
+// Runs options->frames frames with no SDL at all, as fast as options->speed
+// allows, into a null video sink or the --record file, then writes the dumps
+// and prints the frame rate on stderr. Frames run as invaders_step_frame runs
+// them, without the window's output-port write-back. Returns the exit code.
+int run_headless(const CliOptions *options);
+
+#endif
@@ -0,0 +1,13 @@
+#include "cli.h"
+#include "headless.h"
+#include "utils.h"
+
+// Entry point of the SDL-free build (make headless): the same command line as
+// the full executable, but only --headless runs
+int main(int argc, char* argv[]) {
+    CliOptions options;
+    cli_parse(&options, argc, argv);
+    if (!options.headless)
+        error("built without SDL, run with --headless --frames N");
+    return run_headless(&options);
+}
@@ -2,10 +2,14 @@
 
 #include "memory.h"
 #include "update_flags.h"
+#include "idle_loop.h"
+#include "hle.h"
+#include "loop_idiom.h"
 
 #include "utils.h"
 #include "input.h"
 #include "output.h"
+#include "machine.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,73 +17,44 @@
 //memory: stored in mem.c
 //i/o: stored in i/o respectively
 
-CPU* cpu_init(void) {
-    CPU* cpu = (CPU*)malloc(sizeof(CPU));
-    if (!cpu) error("cpu init failed");
-
-    cpu->flags = (Flags*)malloc(sizeof(Flags));
-    if (!cpu->flags) {
-        free(cpu);
-        error("flags init failed");
-    }
-    cpu->flags->Z = cpu->flags->S = cpu->flags->P = cpu->flags->CY = cpu->flags->AC = cpu->flags->PAD = 0;
-
+void cpu_init(CPU* cpu) {
     cpu->A = 0;
-    cpu->B = cpu->C = 0;
-    cpu->D = cpu->E = 0;
-    cpu->H = cpu->L = 0;
+    reset_flags(cpu);
+    cpu->BC = cpu->DE = cpu->HL = 0;
     cpu->SP = 0;
     cpu->PC = 0;
 
     cpu->num_steps = 0;
     cpu->interrupts_enabled = 1;
     cpu->cycles = 0;
-
-    return cpu;
-}
-
-void cpu_free(CPU* cpu) {
-    if (cpu && cpu->flags) {
-        free(cpu->flags);
-        cpu->flags = NULL;
-        free(cpu);
-        cpu = NULL;
-
-        audio_free();
-    }
-    else error("no instance of cpu/flags when freeing");
+    cpu->core = DEFAULT_CPU_CORE;
 }
 
 void cpu_reset(CPU* cpu) {
-    if (cpu && cpu->flags) {
+    if (cpu) {
         cpu->A = 0;
-        cpu->B = cpu->C = 0;
-        cpu->D = cpu->E = 0;
-        cpu->H = cpu->L = 0;
+        cpu->BC = cpu->DE = cpu->HL = 0;
         cpu->SP = 0;
         cpu->PC = 0;
 
-        cpu->flags->Z = 0;
-        cpu->flags->S = 0;
-        cpu->flags->P = 0;
-        cpu->flags->CY = 0;
-        cpu->flags->AC = 0;
-        cpu->flags->PAD = 0;
+        reset_flags(cpu);
 
         cpu->num_steps = 0;
         cpu->interrupts_enabled = 1;
         cpu->cycles = 0;
     }
-    else error("no instance of cpu/flags when resetting");
+    else error("no instance of cpu when resetting");
 }
 
 void generate_interrupt(CPU *cpu, int interrupt_num)
 {
+    Memory *mem = cpu_memory(cpu);
+
     // Push PC to stack
     uint8_t pclo = (uint8_t)(cpu->PC & 0xff);
     uint8_t pchi = (uint8_t)((cpu->PC >> 8) & 0xff);
-    write_memory(cpu->SP - 1, pchi);
-    write_memory(cpu->SP - 2, pclo);
+    write_memory(mem, cpu->SP - 1, pchi);
+    write_memory(mem, cpu->SP - 2, pclo);
     cpu->SP -= 2;
     
     // Set PC to interrupt vector
@@ -89,19 +64,57 @@ void generate_interrupt(CPU *cpu, int interrupt_num)
     cpu->interrupts_enabled = 0;
 }
 
+// Run instructions on cpu->core until cycle_budget cycles are used or the
+// deadline (cycles from now at which the caller raises an interrupt) is
+// reached, whichever comes first. The last instruction may overshoot; the
+// cycles actually used are returned so the caller can carry the overshoot.
+uint32_t cpu_run_cycles(CPU *cpu, uint32_t cycle_budget, uint32_t deadline) {
+    uint32_t limit = deadline < cycle_budget ? deadline : cycle_budget;
+    uint32_t cycles = 0;
+
+    switch (cpu->core) {
+        case CPU_CORE_THREADED: return cpu_run_threaded(cpu, limit);
+        case CPU_CORE_JIT:      return cpu_run_jit(cpu, limit);
+        case CPU_CORE_STATIC:   return cpu_run_static(cpu, limit);
+        default: break;
+    }
+
+    IdleWatch idle = IDLE_WATCH_INIT;
+    while (cycles < limit) {
+        if (cpu->PC < ROM_SIZE && idle_loop_cycles[cpu->PC])
+            cycles += idle_loop_skip(&idle, cpu->PC, cycles, limit);
+        if (cpu->PC < ROM_SIZE && hle_index[cpu->PC]) {
+            uint32_t used = hle_run(cpu, cycles, limit);
+            cycles += used;
+            if (used)
+                continue;
+        }
+        if (cpu->PC < ROM_SIZE && loop_idiom_index[cpu->PC]) {
+            uint32_t used = loop_idiom_run(cpu, cycles, limit);
+            cycles += used;
+            if (used)
+                continue;
+        }
+        cycles += cpu_execute_instruction(cpu);
+    }
+    return cycles;
+}
+
 uint64_t getNumSteps(const CPU* cpu){
     return cpu->num_steps;
 }
 
 void ret(CPU *cpu) {
-	uint8_t pclo = read_memory(cpu->SP);
-	uint8_t pchi = read_memory(cpu->SP + 1);
+	Memory *mem = cpu_memory(cpu);
+	uint8_t pclo = read_memory(mem, cpu->SP);
+	uint8_t pchi = read_memory(mem, cpu->SP + 1);
 	cpu->PC = ((uint16_t)pchi << 8) | (uint16_t)pclo;
     cpu->SP += 2;
 }
 
 uint16_t read_opcode_data_word(CPU *cpu) {
-		uint16_t value = ((uint16_t)read_memory(cpu->PC + 2) << 8) | ((uint16_t)read_memory(cpu->PC + 1));
+		Memory *mem = cpu_memory(cpu);
+		uint16_t value = ((uint16_t)read_memory(mem, cpu->PC + 2) << 8) | ((uint16_t)read_memory(mem, cpu->PC + 1));
 		return value;
 }
 
@@ -110,39 +123,44 @@ uint16_t make_half_word(uint8_t hi, uint8_t lo) {
 }
 
 void call(CPU *cpu, uint16_t address, uint16_t return_address) {
+	Memory *mem = cpu_memory(cpu);
 	uint8_t rethi = (uint8_t)((return_address >> 8) & 0xff);
 	uint8_t retlo = (uint8_t)(return_address & 0xff);
-	write_memory(cpu->SP - 1, rethi);
-	write_memory(cpu->SP - 2, retlo);
+	write_memory(mem, cpu->SP - 1, rethi);
+	write_memory(mem, cpu->SP - 2, retlo);
 	cpu->SP = cpu->SP - 2;
 	cpu->PC = address;
 }
 
 void print_status(CPU *cpu) {
+    Memory *mem = cpu_memory(cpu);
+    uint8_t flags = get_flags(cpu);
+
     printf("Regs: A:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X\n",
            cpu->A, cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L, cpu->SP, cpu->PC);
-    printf("Flags: Z:%d S:%d P:%d CY:%d AC:%d PAD:%d\n",
-           cpu->flags->Z, cpu->flags->S, cpu->flags->P, cpu->flags->CY, cpu->flags->AC, cpu->flags->PAD);
-    printf("Steps:%lu Interrupts:%d Cycles:%lu\n",
-           cpu->num_steps, cpu->interrupts_enabled, cpu->cycles);
+    printf("Flags: Z:%d S:%d P:%d CY:%d AC:%d PSW:%02X\n",
+           !!(flags & FLAG_Z), !!(flags & FLAG_S), !!(flags & FLAG_P), !!(flags & FLAG_CY), !!(flags & FLAG_AC), flags);
+    printf("Steps:%llu Interrupts:%d Cycles:%u\n",
+           (unsigned long long)cpu->num_steps, cpu->interrupts_enabled, cpu->cycles);
     
     // Print first 15 bytes of VRAM
     printf("VRAM: ");
     for (int i = 0; i < 15; i++) {
-        printf("%02X ", read_memory(0x2400 + i));
+        printf("%02X ", read_memory(mem, 0x2400 + i));
     }
     printf("\n");
 }
 
 
 uint16_t cpu_execute_instruction(CPU* cpu) {
-    
-    uint8_t opcode = read_memory(cpu->PC);  // Fixing the data type here
+    Memory *mem = cpu_memory(cpu);
+    uint8_t opcode = read_memory(mem, cpu->PC);  // Fixing the data type here
     uint16_t opcode_size = 1;  // Default bytes taken by instruction
     uint16_t cycle = 0;
 
-
+#if CPU_TRACE
     print_status(cpu);
+#endif
 
     switch (opcode) {
         case 0x00: {  // NOP
@@ -151,24 +169,21 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x01: {  // LXI B, D16
-            cpu->C = read_memory(cpu->PC + 1);
-            cpu->B = read_memory(cpu->PC + 2);
+            cpu->BC = read_opcode_data_word(cpu);
             opcode_size = 3;
             cycle += 10;
             break;
         }
 
         case 0x02: {  // STAX B
-            uint16_t address = make_half_word(cpu->B, cpu->C);
-            write_memory(address, cpu->A);
+            uint16_t address = cpu->BC;
+            write_memory(mem, address, cpu->A);
             cycle += 7;
             break;
         }
 
         case 0x03: {  // INX B
-            uint16_t value = make_half_word(cpu->B, cpu->C) + 1;
-            cpu->B = value >> 8;
-            cpu->C = value & 0xFF;
+            cpu->BC++;
             cycle += 5;
             break;
         }
@@ -188,15 +203,15 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x06: {  // MVI B, D8
-            cpu->B = read_memory(cpu->PC + 1);
+            cpu->B = read_memory(mem, cpu->PC + 1);
             opcode_size = 2;
             cycle += 7;
             break;
         }
 
         case 0x07: {  // RLC
-            cpu->flags->CY = (cpu->A >> 7) & 1;
-            cpu->A = (cpu->A << 1) | cpu->flags->CY;
+            update_CY(cpu, cpu->A & 0x80);
+            cpu->A = (cpu->A << 1) | (cpu->A >> 7);
             cycle += 4;
             break;
         }
@@ -207,25 +222,21 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x09: {  // DAD B
-            uint32_t result = (uint32_t)make_half_word(cpu->B, cpu->C) + (uint32_t)make_half_word(cpu->H, cpu->L);
+            uint32_t result = (uint32_t)cpu->BC + (uint32_t)cpu->HL;
             update_CY_16bit(cpu, result);
-            
-            cpu->H = (result >> 8) & 0xFF;
-            cpu->L = result & 0xFF;
+            cpu->HL = (uint16_t)result;
             cycle += 10;
             break;
         }
 
         case 0x0A: {  // LDAX B
-            cpu->A = read_memory(make_half_word(cpu->B, cpu->C));
+            cpu->A = read_memory(mem, cpu->BC);
             cycle += 7;
             break;
         }
 
         case 0x0B: {  // DCX B
-            uint16_t value = make_half_word(cpu->B, cpu->C) - 1;
-            cpu->B = value >> 8;
-            cpu->C = value & 0xFF;
+            cpu->BC--;
             cycle += 5;
             break;
         }
@@ -245,15 +256,15 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x0E: {  // MVI C, D8
-            cpu->C = read_memory(cpu->PC + 1);
+            cpu->C = read_memory(mem, cpu->PC + 1);
             opcode_size = 2;
             cycle += 7;
             break;
         }
 
         case 0x0F: {  // RRC
-            cpu->flags->CY = cpu->A & 1;
-            cpu->A = (cpu->A >> 1) | (cpu->flags->CY << 7);
+            update_CY(cpu, cpu->A & 1);
+            cpu->A = (cpu->A >> 1) | (cpu->A << 7);
             cycle += 4;
             break;
         }
@@ -264,23 +275,20 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x11: {  // LXI D, D16
-            cpu->E = read_memory(cpu->PC + 1);
-            cpu->D = read_memory(cpu->PC + 2);
+            cpu->DE = read_opcode_data_word(cpu);
             opcode_size = 3;
             cycle += 10;
             break;
         }
 
         case 0x12: {  // STAX D
-            write_memory(make_half_word(cpu->D, cpu->E), cpu->A);
+            write_memory(mem, cpu->DE, cpu->A);
             cycle += 7;
             break;
         }
 
         case 0x13: {  // INX D
-            uint16_t value = make_half_word(cpu->D, cpu->E) + 1;
-            cpu->D = value >> 8;
-            cpu->E = value & 0xFF;
+            cpu->DE++;
             cycle += 5;
             break;
         }
@@ -300,7 +308,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x16: {  // MVI D, D8
-            cpu->D = read_memory(cpu->PC + 1);
+            cpu->D = read_memory(mem, cpu->PC + 1);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -308,8 +316,8 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
 
         case 0x17: {  // RAL
             uint8_t bit7 = (cpu->A >> 7) & 1;
-            cpu->A = (cpu->A << 1) | cpu->flags->CY;
-            cpu->flags->CY = bit7;
+            cpu->A = (cpu->A << 1) | (get_flags(cpu) & FLAG_CY);
+            update_CY(cpu, bit7);
             cycle += 4;
             break;
         }
@@ -320,24 +328,21 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x19: {  // DAD D
-            uint32_t result = (uint32_t)make_half_word(cpu->D, cpu->E) + (uint32_t)make_half_word(cpu->H, cpu->L);
+            uint32_t result = (uint32_t)cpu->DE + (uint32_t)cpu->HL;
             update_CY_16bit(cpu, result);
-            cpu->H = (result >> 8) & 0xFF;
-            cpu->L = result & 0xFF;
+            cpu->HL = (uint16_t)result;
             cycle += 10;
             break;
         }
 
         case 0x1A: {  // LDAX D
-            cpu->A = read_memory(make_half_word(cpu->D, cpu->E));
+            cpu->A = read_memory(mem, cpu->DE);
             cycle += 7;
             break;
         }
 
         case 0x1B: {  // DCX D
-            uint16_t value = make_half_word(cpu->D, cpu->E) - 1;
-            cpu->D = value >> 8;
-            cpu->E = value & 0xFF;
+            cpu->DE--;
             cycle += 5;
             break;
         }
@@ -357,7 +362,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
 
         case 0x1E: {  // MVI E, D8
-            cpu->E = read_memory(cpu->PC + 1);
+            cpu->E = read_memory(mem, cpu->PC + 1);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -365,8 +370,8 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
 
         case 0x1F: {  // RAR
             uint8_t bit0 = cpu->A & 1;
-            cpu->A = (cpu->A >> 1) | (cpu->flags->CY << 7);
-            cpu->flags->CY = bit0;
+            cpu->A = (cpu->A >> 1) | ((get_flags(cpu) & FLAG_CY) << 7);
+            update_CY(cpu, bit0);
             cycle += 4;
             break;
         }
@@ -375,24 +380,21 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x21: {  // LXI H, D16
-            cpu->L = read_memory(cpu->PC + 1);
-            cpu->H = read_memory(cpu->PC + 2);
+            cpu->HL = read_opcode_data_word(cpu);
             opcode_size = 3;
             cycle += 10;
             break;
         }
         case 0x22: {  // SHLD
             uint16_t address = read_opcode_data_word(cpu);
-            write_memory(address, cpu->L);
-            write_memory(address + 1, cpu->H);
+            write_memory(mem, address, cpu->L);
+            write_memory(mem, address + 1, cpu->H);
             opcode_size = 3;
             cycle += 16;
             break;
         }
         case 0x23: {  // INX H
-            uint16_t value = make_half_word(cpu->H, cpu->L) + 1;
-            cpu->H = value >> 8;
-            cpu->L = value & 0xFF;
+            cpu->HL++;
             cycle += 5;
             break;
         }
@@ -409,7 +411,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x26: {  // MVI H, D8
-            cpu->H = read_memory(cpu->PC + 1);
+            cpu->H = read_memory(mem, cpu->PC + 1);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -418,20 +420,20 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             uint8_t correction = 0;
             uint16_t result = cpu->A;
 
-            if ((cpu->A & 0x0F) > 9 || cpu->flags->AC)
+            if ((cpu->A & 0x0F) > 9 || (get_flags(cpu) & FLAG_AC))
                 correction += 0x06;
 
-            if (cpu->A > 0x99 || cpu->flags->CY) {
+            if (cpu->A > 0x99 || (get_flags(cpu) & FLAG_CY)) {
                 correction += 0x60;
-                cpu->flags->CY = 1;
+                update_CY(cpu, 1);
             } else {
-                cpu->flags->CY = 0;
+                update_CY(cpu, 0);
             }
 
             result += correction;
             cpu->A = result & 0xFF;
 
-            cpu->flags->AC = ((cpu->A & 0x0F) < (result & 0x0F));
+            set_flags(cpu, (get_flags(cpu) & ~FLAG_AC) | (((cpu->A & 0x0F) < (result & 0x0F)) ? FLAG_AC : 0));
             update_SZP(cpu, cpu->A);
 
             cycle += 4;
@@ -442,29 +444,24 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x29: {  // DAD H
-            uint32_t result = make_half_word(cpu->H, cpu->L) + make_half_word(cpu->H, cpu->L);
+            uint32_t result = cpu->HL + cpu->HL;
             update_CY_16bit(cpu, result);
-
-            cpu->H = (result >> 8) & 0xFF;
-            cpu->L = result & 0xFF;
-
+            cpu->HL = (uint16_t)result;
             cycle += 10;
             break;
         }
         case 0x2A: {  // LHLD
             uint16_t address = read_opcode_data_word(cpu);
 
-            cpu->L = read_memory(address);
-            cpu->H = read_memory(address + 1);
+            cpu->L = read_memory(mem, address);
+            cpu->H = read_memory(mem, address + 1);
 
             opcode_size = 3;
             cycle += 16;
             break;
         }
         case 0x2B: {  // DCX H
-            uint16_t value = make_half_word(cpu->H, cpu->L) - 1;
-            cpu->H = value >> 8;
-            cpu->L = value & 0xFF;
+            cpu->HL--;
             cycle += 5;
             break;
         }
@@ -481,7 +478,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x2E: {  // MVI L, D8
-            cpu->L = read_memory(cpu->PC + 1);
+            cpu->L = read_memory(mem, cpu->PC + 1);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -502,7 +499,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x32: {  // STA adr
-            write_memory(read_opcode_data_word(cpu), cpu->A);
+            write_memory(mem, read_opcode_data_word(cpu), cpu->A);
             opcode_size = 3;
             cycle += 13;
             break;
@@ -513,29 +510,29 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x34: {  // INR M
-            uint16_t address = make_half_word(cpu->H, cpu->L);
-            uint8_t value = read_memory(address) + 1;
+            uint16_t address = cpu->HL;
+            uint8_t value = read_memory(mem, address) + 1;
             update_SZP(cpu, value);
-            write_memory(address, value);
+            write_memory(mem, address, value);
             cycle += 10;
             break;
         }
         case 0x35: {  // DCR M
-            uint16_t address = make_half_word(cpu->H, cpu->L);
-            uint8_t value = read_memory(address) - 1;
+            uint16_t address = cpu->HL;
+            uint8_t value = read_memory(mem, address) - 1;
             update_SZP(cpu, value);
-            write_memory(address, value);
+            write_memory(mem, address, value);
             cycle += 10;
             break;
         }
         case 0x36: {  // MVI M, D8
-            write_memory(make_half_word(cpu->H, cpu->L), read_memory(cpu->PC + 1));
+            write_memory(mem, cpu->HL, read_memory(mem, cpu->PC + 1));
             opcode_size = 2;
             cycle += 10;
             break;
         }
         case 0x37: {  // STC
-            cpu->flags->CY = 1;
+            set_flags(cpu, get_flags(cpu) | FLAG_CY);
             cycle += 4;
             break;
         }
@@ -544,15 +541,14 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x39: {  // DAD SP
-            uint32_t result = ((uint32_t)make_half_word(cpu->H, cpu->L) + (uint32_t)cpu->SP);
+            uint32_t result = ((uint32_t)cpu->HL + (uint32_t)cpu->SP);
             update_CY_16bit(cpu, result);
-            cpu->H = (result >> 8) & 0xFF;
-            cpu->L = result & 0xFF;
+            cpu->HL = (uint16_t)result;
             cycle += 10;
             break;
         }
         case 0x3A: {  // LDA adr
-            cpu->A = read_memory(read_opcode_data_word(cpu));
+            cpu->A = read_memory(mem, read_opcode_data_word(cpu));
             opcode_size = 3;
             cycle += 13;
             break;
@@ -575,13 +571,13 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x3E: {  // MVI A, D8
-            cpu->A = read_memory(cpu->PC + 1);
+            cpu->A = read_memory(mem, cpu->PC + 1);
             opcode_size = 2;
             cycle += 7;
             break;
         }
         case 0x3F: {  // CMC
-            cpu->flags->CY = !cpu->flags->CY;
+            set_flags(cpu, get_flags(cpu) ^ FLAG_CY);
             cycle += 4;
             break;
         }
@@ -615,7 +611,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x46: {  // MOV B, M
-            cpu->B = read_memory(make_half_word(cpu->H, cpu->L));
+            cpu->B = read_memory(mem, cpu->HL);
             cycle += 7;
             break;
         }
@@ -654,7 +650,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x4E: {  // MOV C, M
-            cpu->C = read_memory(make_half_word(cpu->H, cpu->L));
+            cpu->C = read_memory(mem, cpu->HL);
             cycle += 7;
             break;
         }
@@ -693,7 +689,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x56: {  // MOV D, M
-            cpu->D = read_memory(make_half_word(cpu->H, cpu->L));
+            cpu->D = read_memory(mem, cpu->HL);
             cycle += 7;
             break;
         }
@@ -732,7 +728,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x5E: {  // MOV E, M
-            cpu->E = read_memory(make_half_word(cpu->H, cpu->L));
+            cpu->E = read_memory(mem, cpu->HL);
             cycle += 7;
             break;
         }
@@ -771,7 +767,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x66: {  // MOV H, M
-            cpu->H = read_memory(make_half_word(cpu->H, cpu->L));
+            cpu->H = read_memory(mem, cpu->HL);
             cycle += 7;
             break;
         }
@@ -810,7 +806,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x6E: {  // MOV L, M
-            cpu->L = read_memory(make_half_word(cpu->H, cpu->L));
+            cpu->L = read_memory(mem, cpu->HL);
             cycle += 7;
             break;
         }
@@ -820,32 +816,32 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x70: {  // MOV M, B
-            write_memory(make_half_word(cpu->H, cpu->L), cpu->B);
+            write_memory(mem, cpu->HL, cpu->B);
             cycle += 7;
             break;
         }
         case 0x71: {  // MOV M, C
-            write_memory(make_half_word(cpu->H, cpu->L), cpu->C);
+            write_memory(mem, cpu->HL, cpu->C);
             cycle += 7;
             break;
         }
         case 0x72: {  // MOV M, D
-            write_memory(make_half_word(cpu->H, cpu->L), cpu->D);
+            write_memory(mem, cpu->HL, cpu->D);
             cycle += 7;
             break;
         }
         case 0x73: {  // MOV M, E
-            write_memory(make_half_word(cpu->H, cpu->L), cpu->E);
+            write_memory(mem, cpu->HL, cpu->E);
             cycle += 7;
             break;
         }
         case 0x74: {  // MOV M, H
-            write_memory(make_half_word(cpu->H, cpu->L), cpu->H);
+            write_memory(mem, cpu->HL, cpu->H);
             cycle += 7;
             break;
         }
         case 0x75: {  // MOV M, L
-            write_memory(make_half_word(cpu->H, cpu->L), cpu->L);
+            write_memory(mem, cpu->HL, cpu->L);
             cycle += 7;
             break;
         }
@@ -854,7 +850,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x77: {  // MOV M, A
-            write_memory(make_half_word(cpu->H, cpu->L), cpu->A);
+            write_memory(mem, cpu->HL, cpu->A);
             cycle += 7;
             break;
         }
@@ -889,7 +885,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0x7E: {  // MOV A, M
-            cpu->A = read_memory(make_half_word(cpu->H, cpu->L));
+            cpu->A = read_memory(mem, cpu->HL);
             cycle += 7;
             break;
         }
@@ -900,589 +896,461 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         case 0x80: {            // ADD B
             uint8_t value = cpu->B;
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);   // Update Auxiliary Carry for addition
-            update_CY_8bit(cpu, result);     // Update Carry flag
-            cpu->A = result & 0xFF;          // Update accumulator with result
-            update_SZP(cpu, cpu->A);         // Update Sign, Zero, and Parity flags
+            set_flags_arith(cpu, result, cpu->A, value);
+            cpu->A = result & 0xFF;
             cycle += 4;
             break;
         }
         case 0x81: {            // ADD C
             uint8_t value = cpu->C;
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x82: {            // ADD D
             uint8_t value = cpu->D;
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x83: {            // ADD E
             uint8_t value = cpu->E;
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x84: {            // ADD H
             uint8_t value = cpu->H;
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x85: {            // ADD L
             uint8_t value = cpu->L;
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x86: {            // ADD M (memory at HL)
-            uint8_t value = read_memory(make_half_word(cpu->H, cpu->L));  // Memory access
+            uint8_t value = read_memory(mem, cpu->HL);  // Memory access
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 7;  // Memory operations take 7 cycles
             break;
         }
         case 0x87: {            // ADD A
             uint8_t value = cpu->A;
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x88: {            // ADC B
             uint8_t value = cpu->B;
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;  // Add with carry
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);  // Add with carry
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x89: {            // ADC C
             uint8_t value = cpu->C;
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x8A: {            // ADC D
             uint8_t value = cpu->D;
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x8B: {            // ADC E
             uint8_t value = cpu->E;
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x8C: {            // ADC H
             uint8_t value = cpu->H;
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x8D: {            // ADC L
             uint8_t value = cpu->L;
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x8E: {            // ADC M (memory at HL)
-            uint8_t value = read_memory(make_half_word(cpu->H, cpu->L));  // Memory access
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint8_t value = read_memory(mem, cpu->HL);  // Memory access
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 7;  // Memory operations take 7 cycles
             break;
         }
         case 0x8F: {            // ADC A
             uint8_t value = cpu->A;
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
             cycle += 4;
             break;
         }
         case 0x90: {  // SUB B
             uint8_t value = cpu->B;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);       
-            update_CY_8bit(cpu, result);  
             cycle += 4;
             break;
         }
         case 0x91: {  // SUB C
             uint8_t value = cpu->C;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x92: {  // SUB D
             uint8_t value = cpu->D;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x93: {  // SUB E
             uint8_t value = cpu->E;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x94: {  // SUB H
             uint8_t value = cpu->H;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x95: {  // SUB L
             uint8_t value = cpu->L;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x96: {  // SUB M
-            uint8_t value = read_memory(make_half_word(cpu->H, cpu->L));
-            update_AC(cpu, cpu->A, value);
+            uint8_t value = read_memory(mem, cpu->HL);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 7;
             break;
         }
         case 0x97: {  // SUB A
             uint8_t value = cpu->A;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x98: {  // SBB B
             uint8_t value = cpu->B;
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x99: {  // SBB C
             uint8_t value = cpu->C;
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x9A: {  // SBB D
             uint8_t value = cpu->D;
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x9B: {  // SBB E
             uint8_t value = cpu->E;
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x9C: {  // SBB H
             uint8_t value = cpu->H;
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x9D: {  // SBB L
             uint8_t value = cpu->L;
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0x9E: {  // SBB M
-            uint8_t value = read_memory(make_half_word(cpu->H, cpu->L));
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint8_t value = read_memory(mem, cpu->HL);
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 7;
             break;
         }
         case 0x9F: {  // SBB A
             uint8_t value = cpu->A;
-            update_AC(cpu, cpu->A, value);
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             cycle += 4;
             break;
         }
         case 0xA0: {  // ANA B
             cpu->A &=  cpu->B;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 4;
             break;
         }
         case 0xA1: {  // ANA C
             cpu->A &=  cpu->C;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 4;
             break;
         }
         case 0xA2: {  // ANA D
             cpu->A &=  cpu->D;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 4;
             break;
         }
         case 0xA3: {  // ANA E
             cpu->A &=  cpu->E;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 4;
             break;
         }
         case 0xA4: {  // ANA H
             cpu->A &=  cpu->H;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 4;
             break;
         }
         case 0xA5: {  // ANA L
             cpu->A &=  cpu->L;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 4;
             break;
         }
         case 0xA6: {  // ANA M
-            cpu->A &= read_memory(make_half_word(cpu->H, cpu->L));
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            cpu->A &= read_memory(mem, cpu->HL);
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 7;
             break;
         }
         case 0xA7: {  // ANA A
             cpu->A &=  cpu->A;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = ((cpu->A & 0x08) != 0);  // Special case for ANA
+            set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);  // Special case for ANA
             cycle += 4;
             break;
         }
         case 0xA8: {  // XRA B
             cpu->A ^=  cpu->B;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xA9: {  // XRA C
             cpu->A ^=  cpu->C;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xAA: {  // XRA D
             cpu->A ^=  cpu->D;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xAB: {  // XRA E
             cpu->A ^=  cpu->E;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xAC: {  // XRA H
             cpu->A ^=  cpu->H;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xAD: {  // XRA L
             cpu->A ^=  cpu->L;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xAE: {  // XRA M
-            cpu->A ^= read_memory(make_half_word(cpu->H, cpu->L));
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            cpu->A ^= read_memory(mem, cpu->HL);
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 7;
             break;
         }
         case 0xAF: {  // XRA A
             cpu->A ^= cpu->A;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB0: {  // ORA B
             cpu->A |= cpu->B;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB1: {  // ORA C
             cpu->A |= cpu->C;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB2: {  // ORA D
             cpu->A |= cpu->D;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB3: {  // ORA E
             cpu->A |= cpu->E;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB4: {  // ORA H
             cpu->A |= cpu->H;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB5: {  // ORA L
             cpu->A |= cpu->L;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB6: {  // ORA M
-            cpu->A |= read_memory(make_half_word(cpu->H, cpu->L));
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            cpu->A |= read_memory(mem, cpu->HL);
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 7;
             break;
         }
         case 0xB7: {  // ORA A
             cpu->A |= cpu->A;
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            set_flags_logic(cpu, cpu->A, 0);
             cycle += 4;
             break;
         }
         case 0xB8: {  // CMP B
             uint8_t value = cpu->B;
-            update_AC(cpu, cpu->A, value);  // Update AC before comparison
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);  // Use result without modifying A
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 4;
             break;
         }
         case 0xB9: {  // CMP C
             uint8_t value = cpu->C;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 4;
             break;
         }
         case 0xBA: {  // CMP D
             uint8_t value = cpu->D;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 4;
             break;
         }
         case 0xBB: {  // CMP E
             uint8_t value = cpu->E;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 4;
             break;
         }
         case 0xBC: {  // CMP H
             uint8_t value = cpu->H;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 4;
             break;
         }
         case 0xBD: {  // CMP L
             uint8_t value = cpu->L;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 4;
             break;
         }
         case 0xBE: {  // CMP M
-            uint8_t value = read_memory(make_half_word(cpu->H, cpu->L));
-            update_AC(cpu, cpu->A, value);
+            uint8_t value = read_memory(mem, cpu->HL);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 7;
             break;
         }
         case 0xBF: {  // CMP A
             uint8_t value = cpu->A;
-            update_AC(cpu, cpu->A, value);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // A is left unchanged
             cycle += 4;
             break;
         }
         case 0xC0: {  // RNZ
-            if (cpu->flags->Z == 0) {
+            if (!(get_flags(cpu) & FLAG_Z)) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1490,14 +1358,14 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xC1: {  // POP B
-            cpu->C = read_memory(cpu->SP);
-            cpu->B = read_memory(cpu->SP + 1);
+            cpu->C = read_memory(mem, cpu->SP);
+            cpu->B = read_memory(mem, cpu->SP + 1);
             cpu->SP += 2;
             cycle += 10;
             break;
         }
         case 0xC2: {  // JNZ addr
-            if (cpu->flags->Z == 0) {
+            if (!(get_flags(cpu) & FLAG_Z)) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1513,7 +1381,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xC4: {  // CNZ addr
-            if (cpu->flags->Z == 0) {
+            if (!(get_flags(cpu) & FLAG_Z)) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1523,19 +1391,17 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xC5: {  // PUSH B
-            write_memory(cpu->SP - 1, cpu->B);
-            write_memory(cpu->SP - 2, cpu->C);
+            write_memory(mem, cpu->SP - 1, cpu->B);
+            write_memory(mem, cpu->SP - 2, cpu->C);
             cpu->SP -= 2;
             cycle += 11;
             break;
         }
         case 0xC6: {  // ADI D8
-            uint8_t value = read_memory(cpu->PC + 1);
+            uint8_t value = read_memory(mem, cpu->PC + 1);
             uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // AC from the new A
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1545,7 +1411,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xC8: {  // RZ
-            if (cpu->flags->Z == 1) {
+            if (get_flags(cpu) & FLAG_Z) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1559,7 +1425,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xCA: {  // JZ addr
-            if (cpu->flags->Z == 1) {
+            if (get_flags(cpu) & FLAG_Z) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1573,7 +1439,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xCC: {  // CZ addr
-            if (cpu->flags->Z == 1) {
+            if (get_flags(cpu) & FLAG_Z) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1589,12 +1455,10 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xCE: {  // ACI D8
-            uint8_t value = read_memory(cpu->PC + 1);
-            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)cpu->flags->CY;
+            uint8_t value = read_memory(mem, cpu->PC + 1);
+            uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);  // AC from the new A
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1604,7 +1468,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xD0: {  // RNC
-            if (cpu->flags->CY == 0) {
+            if (!(get_flags(cpu) & FLAG_CY)) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1612,14 +1476,14 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xD1: {  // POP D
-            cpu->E = read_memory(cpu->SP);
-            cpu->D = read_memory(cpu->SP + 1);
+            cpu->E = read_memory(mem, cpu->SP);
+            cpu->D = read_memory(mem, cpu->SP + 1);
             cpu->SP += 2;
             cycle += 10;
             break;
         }
         case 0xD2: {  // JNC addr
-            if (cpu->flags->CY == 0) {
+            if (!(get_flags(cpu) & FLAG_CY)) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1629,14 +1493,14 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xD3: {  // OUT D8
-            uint8_t port = read_memory(cpu->PC + 1);
-            machine_out(cpu, port, cpu->A);
+            uint8_t port = read_memory(mem, cpu->PC + 1);
+            machine_out(machine_of(cpu), port, cpu->A);
             opcode_size = 2;
             cycle += 10;
             break;
         }
         case 0xD4: {  // CNC addr
-            if (cpu->flags->CY == 0) {
+            if (!(get_flags(cpu) & FLAG_CY)) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1646,19 +1510,17 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xD5: {  // PUSH D
-            write_memory(cpu->SP - 1, cpu->D);
-            write_memory(cpu->SP - 2, cpu->E);
+            write_memory(mem, cpu->SP - 1, cpu->D);
+            write_memory(mem, cpu->SP - 2, cpu->E);
             cpu->SP -= 2;
             cycle += 11;
             break;
         }
         case 0xD6: {  // SUI D8
-            uint8_t value = read_memory(cpu->PC + 1);
-            update_AC(cpu, cpu->A, value);  // Call before modifying A
+            uint8_t value = read_memory(mem, cpu->PC + 1);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1669,7 +1531,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xD8: {  // RC
-            if (cpu->flags->CY == 1) {
+            if (get_flags(cpu) & FLAG_CY) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1681,7 +1543,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xDA: {  // JC addr
-            if (cpu->flags->CY == 1) {
+            if (get_flags(cpu) & FLAG_CY) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1691,14 +1553,14 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xDB: {  // IN D8 input
-            uint8_t port = read_memory(cpu->PC + 1);
-            cpu->A = machine_in(port);
+            uint8_t port = read_memory(mem, cpu->PC + 1);
+            cpu->A = machine_in(machine_of(cpu), port);
             opcode_size = 2;
             cycle += 10;
             break;
         }
         case 0xDC: {  // CC addr
-            if (cpu->flags->CY == 1) {
+            if (get_flags(cpu) & FLAG_CY) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1712,12 +1574,10 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xDE: {  // SBI D8
-            uint8_t value = read_memory(cpu->PC + 1);
-            update_AC(cpu, cpu->A, value);  // Call before modifying A
-            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)cpu->flags->CY;
+            uint8_t value = read_memory(mem, cpu->PC + 1);
+            uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY);
+            set_flags_arith(cpu, result, cpu->A, value);
             cpu->A = result & 0xFF;
-            update_SZP(cpu, cpu->A);
-            update_CY_8bit(cpu, result);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1727,7 +1587,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xE0: {  // RPO
-            if (cpu->flags->P == 0) {
+            if (!(get_flags(cpu) & FLAG_P)) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1735,14 +1595,14 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xE1: {  // POP H
-            cpu->L = read_memory(cpu->SP);
-            cpu->H = read_memory(cpu->SP + 1);
+            cpu->L = read_memory(mem, cpu->SP);
+            cpu->H = read_memory(mem, cpu->SP + 1);
             cpu->SP += 2;
             cycle += 10;
             break;
         }
         case 0xE2: {  // JPO addr
-            if (cpu->flags->P == 0) {
+            if (!(get_flags(cpu) & FLAG_P)) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1753,16 +1613,16 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
         }
         case 0xE3: {  // XTHL
             uint8_t l = cpu->L;
-            cpu->L = read_memory(cpu->SP);
-            write_memory(cpu->SP, l);
+            cpu->L = read_memory(mem, cpu->SP);
+            write_memory(mem, cpu->SP, l);
             uint8_t h = cpu->H;
-            cpu->H = read_memory(cpu->SP + 1);
-            write_memory(cpu->SP + 1, h);
+            cpu->H = read_memory(mem, cpu->SP + 1);
+            write_memory(mem, cpu->SP + 1, h);
             cycle += 18;
             break;
         }
         case 0xE4: {  // CPO addr
-            if (cpu->flags->P == 0) {
+            if (!(get_flags(cpu) & FLAG_P)) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1772,17 +1632,15 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xE5: {  // PUSH H
-            write_memory(cpu->SP - 1, cpu->H);
-            write_memory(cpu->SP - 2, cpu->L);
+            write_memory(mem, cpu->SP - 1, cpu->H);
+            write_memory(mem, cpu->SP - 2, cpu->L);
             cpu->SP -= 2;
             cycle += 11;
             break;
         }
         case 0xE6: {  // ANI D8
-            cpu->A &= read_memory(cpu->PC + 1);
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;
-            cpu->flags->AC = 0;
+            cpu->A &= read_memory(mem, cpu->PC + 1);
+            set_flags_logic(cpu, cpu->A, 0);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1792,7 +1650,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xE8: {  // RPE
-            if (cpu->flags->P == 1) {
+            if (get_flags(cpu) & FLAG_P) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1800,13 +1658,13 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xE9: {  // PCHL
-            cpu->PC = make_half_word(cpu->H, cpu->L);
+            cpu->PC = cpu->HL;
             opcode_size = 0;
             cycle += 5;
             break;
         }
         case 0xEA: {  // JPE addr
-            if (cpu->flags->P == 1) {
+            if (get_flags(cpu) & FLAG_P) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1816,17 +1674,14 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xEB: {  // XCHG
-            uint8_t temp = cpu->H;
-            cpu->H = cpu->D;
-            cpu->D = temp;
-            temp = cpu->L;
-            cpu->L = cpu->E;
-            cpu->E = temp;
+            uint16_t temp = cpu->HL;
+            cpu->HL = cpu->DE;
+            cpu->DE = temp;
             cycle += 5;
             break;
         }
         case 0xEC: {  // CPE addr
-            if (cpu->flags->P == 1) {
+            if (get_flags(cpu) & FLAG_P) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1840,10 +1695,8 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xEE: {  // XRI D8
-            cpu->A ^= read_memory(cpu->PC + 1);
-            update_SZP(cpu, cpu->A);
-            cpu->flags->CY = 0;  // XOR always clears carry
-            cpu->flags->AC = 0;  // Auxiliary carry is also cleared
+            cpu->A ^= read_memory(mem, cpu->PC + 1);
+            set_flags_logic(cpu, cpu->A, 0);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1853,7 +1706,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xF0: {  // RP
-            if (cpu->flags->S == 0) {
+            if (!(get_flags(cpu) & FLAG_S)) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1861,21 +1714,15 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xF1: {  // POP PSW
-            uint8_t flags = read_memory(cpu->SP);
-            cpu->flags->Z  = (flags & 0x40) != 0;
-            cpu->flags->S  = (flags & 0x80) != 0;
-            cpu->flags->P  = (flags & 0x04) != 0;
-            cpu->flags->CY = (flags & 0x01) != 0;
-            cpu->flags->AC = (flags & 0x10) != 0;
-            cpu->flags->PAD = 1;
+            set_flags(cpu, (read_memory(mem, cpu->SP) & ~0x28) | FLAG_ONE);  // Bits 3 and 5 read as 0, bit 1 as 1
             
-            cpu->A = read_memory(cpu->SP + 1);
+            cpu->A = read_memory(mem, cpu->SP + 1);
             cpu->SP += 2;
             cycle += 10;
             break;
         }
         case 0xF2: {  // JP addr
-            if (cpu->flags->S == 0) {
+            if (!(get_flags(cpu) & FLAG_S)) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1890,7 +1737,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xF4: {  // CP addr
-            if (cpu->flags->S == 0) {
+            if (!(get_flags(cpu) & FLAG_S)) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1900,23 +1747,15 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xF5: {  // PUSH PSW
-            uint8_t flags = (cpu->flags->Z ? 0x40 : 0) |
-                    (cpu->flags->S ? 0x80 : 0) |
-                    (cpu->flags->P ? 0x04 : 0) |
-                    (cpu->flags->CY ? 0x01 : 0) |
-                    (cpu->flags->AC ? 0x10 : 0) |
-                    0x02;
-
-            write_memory(cpu->SP - 1, cpu->A);
-            write_memory(cpu->SP - 2, flags);
+            write_memory(mem, cpu->SP - 1, cpu->A);
+            write_memory(mem, cpu->SP - 2, get_flags(cpu));
             cpu->SP -= 2;
             cycle += 11;
             break;
         }
         case 0xF6: {  // ORI D8
-            cpu->A |= read_memory(cpu->PC + 1);
-            cpu->flags->CY = 0;  // ORI always clears carry
-            update_SZP(cpu, cpu->A);
+            cpu->A |= read_memory(mem, cpu->PC + 1);
+            set_flags_logic(cpu, cpu->A, get_flags(cpu) & FLAG_AC);  // ORI always clears carry, AC is kept
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1926,7 +1765,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xF8: {  // RM
-            if (cpu->flags->S == 1) {
+            if (get_flags(cpu) & FLAG_S) {
                 ret(cpu);
                 opcode_size = 0;
             }
@@ -1934,12 +1773,12 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xF9: {  // SPHL
-            cpu->SP = make_half_word(cpu->H, cpu->L);
+            cpu->SP = cpu->HL;
             cycle += 5;
             break;
         }
         case 0xFA: {  // JM addr
-            if (cpu->flags->S == 1) {
+            if (get_flags(cpu) & FLAG_S) {
                 cpu->PC = read_opcode_data_word(cpu);
                 opcode_size = 0;
             } else {
@@ -1954,7 +1793,7 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xFC: {  // CM addr
-            if (cpu->flags->S == 1) {
+            if (get_flags(cpu) & FLAG_S) {
                 call(cpu, read_opcode_data_word(cpu), cpu->PC + 3);
                 opcode_size = 0;
             } else {
@@ -1968,11 +1807,9 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
             break;
         }
         case 0xFE: {  // CPI D8
-            uint8_t value = read_memory(cpu->PC + 1);
+            uint8_t value = read_memory(mem, cpu->PC + 1);
             uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
-            update_SZP(cpu, result & 0xFF);
-            update_AC(cpu, cpu->A, value);
-            update_CY_8bit(cpu, result);
+            set_flags_arith(cpu, result, cpu->A, value);
             opcode_size = 2;
             cycle += 7;
             break;
@@ -1991,10 +1828,12 @@ uint16_t cpu_execute_instruction(CPU* cpu) {
 }
 
 void rst_helper(CPU *cpu, uint16_t address) {
+    Memory *mem = cpu_memory(cpu);
+
     // Push current PC onto stack
     cpu->SP -= 2;
-    write_memory(cpu->SP, (cpu->PC & 0xFF00) >> 8);
-    write_memory(cpu->SP + 1, cpu->PC & 0x00FF);
+    write_memory(mem, cpu->SP, (cpu->PC & 0xFF00) >> 8);
+    write_memory(mem, cpu->SP + 1, cpu->PC & 0x00FF);
 
     // Jump to new address
     cpu->PC = address;
@@ -1,47 +1,104 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include <stddef.h>
 #include <stdint.h>  // Include this for fixed-width integer types
 
-// Define Flags struct
-typedef struct {
-    uint8_t Z : 1;  // Zero flag
-    uint8_t S : 1;  // Sign flag
-    uint8_t P : 1;  // Parity flag
-    uint8_t CY : 1;  // Carry flag
-    uint8_t AC : 1;  // Auxiliary carry flag
-    uint8_t PAD : 3;  // Unused bits
-} Flags;
+// Flag bits of CPU.F, laid out as the low byte of the 8080 PSW
+#define FLAG_CY  0x01  // Carry flag
+#define FLAG_ONE 0x02  // Always set
+#define FLAG_P   0x04  // Parity flag
+#define FLAG_AC  0x10  // Auxiliary carry flag
+#define FLAG_Z   0x40  // Zero flag
+#define FLAG_S   0x80  // Sign flag
+
+// Execution cores, picked at run time in main.c and stored in CPU.core.
+// Build with -DDEFAULT_CPU_CORE=CPU_CORE_THREADED to change the default.
+typedef enum {
+    CPU_CORE_SWITCH,    // cpu_execute_instruction, one call per instruction
+    CPU_CORE_THREADED,  // cpu_run_threaded, direct-threaded dispatch
+    CPU_CORE_JIT,       // cpu_run_jit, x86-64 block recompiler
+    CPU_CORE_STATIC     // cpu_run_static, ROM translated to C ahead of time
+} CpuCore;
+
+#ifndef DEFAULT_CPU_CORE
+#define DEFAULT_CPU_CORE CPU_CORE_SWITCH
+#endif
+
+// Record the last ALU op and compute F only when it is read (update_flags.h), off by default
+#ifndef CPU_LAZY_FLAGS
+#define CPU_LAZY_FLAGS 0
+#endif
+
+// The hot part of CPU is laid out to fit in one cache line; machine_create allocates it on one
+#define CPU_CACHE_LINE 64
+
+// A register pair that is addressable as one 16-bit word (BC) or as its two bytes (B, C)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(hi, lo) union { struct { uint8_t hi, lo; }; uint16_t hi##lo; }
+#else
+#define REGISTER_PAIR(hi, lo) union { struct { uint8_t lo, hi; }; uint16_t hi##lo; }
+#endif
 
 // Define the CPU struct
 typedef struct {
-    // Registers
-    uint8_t A;
-    uint8_t B, C;
-    uint8_t D, E;
-    uint8_t H, L;
+    // Hot: what instructions touch
+    REGISTER_PAIR(A, F);    // PSW; F holds the flags, read through get_flags
+    REGISTER_PAIR(B, C);
+    REGISTER_PAIR(D, E);
+    REGISTER_PAIR(H, L);
     uint16_t SP;
     uint16_t PC;
+    uint32_t cycles;
+    uint8_t interrupts_enabled;
 
-    Flags *flags;
+#if CPU_LAZY_FLAGS
+    // Last flag-setting op not yet folded into F, see update_flags.h
+    uint8_t flag_op;
+    uint8_t flag_a, flag_b;
+    uint16_t flag_result;
+#endif
 
+    // Cold: touched once per run call or never
+    CpuCore core;   // Core used by cpu_run_cycles
     uint64_t num_steps;
-    uint8_t interrupts_enabled;
-    uint32_t cycles;
-} CPU; 
+} CPU;
+
+_Static_assert(offsetof(CPU, core) <= CPU_CACHE_LINE, "hot CPU state must fit in one cache line");
+
+
+// print_status on every instruction of the switch core, off unless built with
+// -DCPU_TRACE=1 (make TRACE=1 for the SDL front end)
+#ifndef CPU_TRACE
+#define CPU_TRACE 0
+#endif
+
+// Count executions per ROM address in the threaded core (profile.c), off by default
+#ifndef CPU_PROFILE
+#define CPU_PROFILE 0
+#endif
+
+// No interrupt due within the budget passed to cpu_run_cycles
+#define CPU_NO_DEADLINE UINT32_MAX
 
 uint16_t cpu_execute_instruction(CPU* cpu);
-CPU* cpu_init(void);
-void cpu_free(CPU* cpu);
+uint32_t cpu_run_cycles(CPU *cpu, uint32_t cycle_budget, uint32_t deadline);
+uint32_t cpu_run_threaded(CPU *cpu, uint32_t cycle_budget);
+const void *const *cpu_threaded_handlers(void);
+const void *const *cpu_threaded_fused_handlers(void);
+uint32_t cpu_run_jit(CPU *cpu, uint32_t cycle_budget);
+void jit_free(void);     // Frees the calling thread's JIT code buffer
+uint32_t cpu_run_static(CPU *cpu, uint32_t cycle_budget);
+void cpu_init(CPU* cpu);
 void cpu_reset(CPU* cpu);
-void interrupt(CPU *cpu, int interrupt_num);
+void generate_interrupt(CPU *cpu, int interrupt_num);
 int get_num_steps(CPU *cpu);
 
 
 void ret(CPU *cpu);
 void call(CPU *cpu, uint16_t address, uint16_t return_address);
 uint16_t read_opcode_data_word(CPU *cpu);
-uint16_t make_word(uint8_t hi, uint8_t lo);
+uint16_t make_half_word(uint8_t hi, uint8_t lo);
 void rst_helper(CPU *cpu, uint16_t address);
 
 #endif
@@ -0,0 +1,93 @@
+#include "static_core.h"
+
+#include "decode_cache.h"
+#include "idle_loop.h"
+#include "hle.h"
+#include "loop_idiom.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Driver for the statically recompiled blocks in static_blocks.c.
+//
+// A block only runs when its whole cycle cost fits the remaining budget and
+// the tail of the budget is finished by the threaded core, so interrupts
+// raised by main.c between calls land on the same instruction as in the
+// interpreters. Addresses the recompiler did not reach (RAM, PCHL targets,
+// RSTs, OUT) also go through the threaded core.
+
+static StaticBlockFn block_run[ROM_SIZE];
+static uint16_t block_cost[ROM_SIZE];
+static int static_ready;    // Blocks match the loaded ROM
+
+// FNV-1a over the ROM image, tools/recompiler.c stamps the same hash into static_blocks.c
+uint32_t static_rom_hash(const uint8_t *rom) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < ROM_SIZE; i++) {
+        hash ^= rom[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void static_install(const uint8_t *rom) {
+    memset(block_run, 0, sizeof(block_run));
+    // Blocks generated from a different ROM are never run, cpu_run_static uses the threaded core
+    static_ready = static_rom_hash(rom) == static_rom_checksum;
+    if (!static_ready)
+        return;
+
+    for (unsigned i = 0; i < static_block_count; i++) {
+        const StaticBlock *block = &static_blocks[i];
+        uint32_t cost = 0;
+
+        for (uint16_t pc = block->start; ; pc += decode_cache[pc].length) {
+            cost += decode_cache[pc].cycles;
+            if (pc == block->last)
+                break;
+        }
+
+        block_run[block->start] = block->run;
+        block_cost[block->start] = cost;
+    }
+}
+
+uint32_t cpu_run_static(CPU *cpu, uint32_t cycle_budget) {
+    int64_t remaining = cycle_budget;
+    IdleWatch idle = IDLE_WATCH_INIT;
+
+    if (!static_ready)
+        return cpu_run_threaded(cpu, cycle_budget);
+
+    while (remaining > 0) {
+        uint16_t pc = cpu->PC;
+
+        if (pc < ROM_SIZE && idle_loop_cycles[pc])
+            remaining -= idle_loop_skip(&idle, pc, (uint32_t)((int64_t)cycle_budget - remaining), cycle_budget);
+        if (pc < ROM_SIZE && hle_index[pc]) {
+            uint32_t used = hle_run(cpu, (uint32_t)((int64_t)cycle_budget - remaining), cycle_budget);
+            remaining -= used;
+            if (used)
+                continue;
+        }
+        if (pc < ROM_SIZE && loop_idiom_index[pc]) {
+            uint32_t used = loop_idiom_run(cpu, (uint32_t)((int64_t)cycle_budget - remaining), cycle_budget);
+            remaining -= used;
+            if (used)
+                continue;
+        }
+
+        if (pc >= ROM_SIZE || !block_run[pc]) {
+            remaining -= cpu_run_threaded(cpu, 1);
+            continue;
+        }
+        if (block_cost[pc] > remaining) {
+            remaining -= cpu_run_threaded(cpu, (uint32_t)remaining);
+            break;
+        }
+
+        remaining -= block_cost[pc];
+        block_run[pc](cpu);
+    }
+    return (uint32_t)((int64_t)cycle_budget - remaining);
+}
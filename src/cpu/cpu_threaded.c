@@ -0,0 +1,686 @@
+#include "cpu.h"
+
+#include "memory.h"
+#include "update_flags.h"
+#include "decode_cache.h"
+#include "idle_loop.h"
+#include "hle.h"
+#include "loop_idiom.h"
+#include "profile.h"
+
+#include "utils.h"
+#include "input.h"
+#include "output.h"
+#include "machine.h"
+
+#include <stdint.h>
+
+// Direct-threaded execution core.
+//
+// Every handler ends by fetching the next opcode and jumping straight to its
+// handler through dispatch_table (GCC labels-as-values), so there is no call
+// per instruction and each handler gets its own indirect branch, which the
+// host predictor tracks far better than the single shared branch of the
+// switch in cpu_execute_instruction.
+//
+// Code in ROM runs from decode_cache, which already holds the handler and the
+// immediate operand for every ROM address. Code in RAM is decoded live.
+//
+// The handlers mirror cpu_execute_instruction opcode for opcode: same flag
+// helpers, same cycle counts, same PC updates. Both cores must leave the
+// machine in the same state so they can be benchmarked against each other.
+
+#if defined(__GNUC__)
+
+// Live decoding reads straight from the memory array
+#define FETCH8(offset)  read_memory(mem, (uint16_t)(cpu->PC + (offset)))
+#define HL              cpu->HL
+
+// Immediate operands of the instruction being executed
+#define OPERAND8        ((uint8_t)entry->operand)
+#define OPERAND16       (entry->operand)
+
+#define DISPATCH()                                                  \
+    do {                                                            \
+        if (cycles >= cycle_budget) goto done;                      \
+        if (cpu->PC < ROM_SIZE && decode_cache[cpu->PC].handler) {  \
+            entry = &decode_cache[cpu->PC];                         \
+            if (CPU_PROFILE) profile_hits[cpu->PC]++;               \
+        } else {                                                    \
+            live.operand = make_half_word(FETCH8(2), FETCH8(1));    \
+            live.handler = dispatch_table[FETCH8(0)];               \
+            entry = &live;                                          \
+        }                                                           \
+        goto *entry->handler;                                       \
+    } while (0)
+
+#define NEXT(size, cyc)                         \
+    do {                                        \
+        cpu->PC += (size);                      \
+        cycles += (cyc);                        \
+        DISPATCH();                             \
+    } while (0)
+
+// 8-bit register ops
+#define OP_INR(r)       cpu->r++; update_SZP(cpu, cpu->r); NEXT(1, 5)
+#define OP_DCR(r)       cpu->r--; update_SZP(cpu, cpu->r); NEXT(1, 5)
+#define OP_MVI(r)       cpu->r = OPERAND8; NEXT(2, 7)
+#define OP_MOV(d, s)    cpu->d = cpu->s; NEXT(1, 5)
+#define OP_MOV_RM(d)    cpu->d = read_memory(mem, HL); NEXT(1, 7)
+#define OP_MOV_MR(s)    write_memory(mem, HL, cpu->s); NEXT(1, 7)
+
+// Register pair ops
+#define OP_LXI(pair)    (pair) = OPERAND16; NEXT(3, 10)
+#define OP_INX(pair)    (pair)++; NEXT(1, 5)
+#define OP_DCX(pair)    (pair)--; NEXT(1, 5)
+
+#define OP_DAD(pair) {                                      \
+        uint32_t result = (uint32_t)(pair) + (uint32_t)HL;  \
+        update_CY_16bit(cpu, result);                       \
+        HL = (uint16_t)result;                              \
+        NEXT(1, 10);                                        \
+    }
+
+#define OP_PUSH(hi, lo)                                     \
+        write_memory(mem, cpu->SP - 1, cpu->hi);            \
+        write_memory(mem, cpu->SP - 2, cpu->lo);            \
+        cpu->SP -= 2;                                       \
+        NEXT(1, 11)
+
+#define OP_POP(hi, lo)                                      \
+        cpu->lo = read_memory(mem, cpu->SP);                \
+        cpu->hi = read_memory(mem, cpu->SP + 1);            \
+        cpu->SP += 2;                                       \
+        NEXT(1, 10)
+
+// Accumulator ops, operand evaluated once
+#define OP_ADD(operand, size, cyc) {                        \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value; \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+        NEXT(size, cyc);                                    \
+    }
+
+#define OP_ADC(operand, size, cyc) {                        \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY); \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+        NEXT(size, cyc);                                    \
+    }
+
+#define OP_SUB(operand, size, cyc) {                        \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value; \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+        NEXT(size, cyc);                                    \
+    }
+
+#define OP_SBB(operand, size, cyc) {                        \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY); \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+        NEXT(size, cyc);                                    \
+    }
+
+#define OP_ANA(operand, cyc)                                \
+        cpu->A &= (operand);                                \
+        set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0); \
+        NEXT(1, cyc)
+
+#define OP_XRA(operand, cyc)                                \
+        cpu->A ^= (operand);                                \
+        set_flags_logic(cpu, cpu->A, 0);                    \
+        NEXT(1, cyc)
+
+#define OP_ORA(operand, cyc)                                \
+        cpu->A |= (operand);                                \
+        set_flags_logic(cpu, cpu->A, 0);                    \
+        NEXT(1, cyc)
+
+#define OP_CMP(operand, cyc) {                              \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value; \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        NEXT(1, cyc);                                       \
+    }
+
+// Control flow
+#define OP_JCOND(cond)                                      \
+        if (cond) {                                         \
+            cpu->PC = OPERAND16;                            \
+            NEXT(0, 10);                                    \
+        }                                                   \
+        NEXT(3, 10)
+
+#define OP_CCOND(cond)                                      \
+        if (cond) {                                         \
+            call(cpu, OPERAND16, cpu->PC + 3);              \
+            NEXT(0, 11);                                    \
+        }                                                   \
+        NEXT(3, 11)
+
+#define OP_RCOND(cond)                                      \
+        if (cond) {                                         \
+            ret(cpu);                                       \
+            NEXT(0, 5);                                     \
+        }                                                   \
+        NEXT(1, 5)
+
+// rst_helper charges its 11 cycles to cpu->cycles itself
+#define OP_RST(address, cyc)  rst_helper(cpu, address); NEXT(1, cyc)
+
+// A superinstruction may only run whole when the one-at-a-time core would
+// also have reached its last opcode, otherwise run just the first opcode
+#define FUSED_GUARD(prefix_cycles)                                  \
+        if (cycles + (prefix_cycles) >= cycle_budget)               \
+            goto *dispatch_table[entry->opcode]
+
+// Decoded instruction n bytes after the current one, fused handlers only run from ROM
+#define FOLLOWING(n)    (entry + (n))
+
+static const void *const *handler_table;
+static const void *const *fused_handler_table;
+
+// Handler addresses for decode_cache_build, the labels only exist inside cpu_run_threaded
+const void *const *cpu_threaded_handlers(void) {
+    if (!handler_table)
+        cpu_run_threaded(NULL, 0);
+    return handler_table;
+}
+
+// Superinstruction handlers, indexed by FusedOp
+const void *const *cpu_threaded_fused_handlers(void) {
+    if (!fused_handler_table)
+        cpu_run_threaded(NULL, 0);
+    return fused_handler_table;
+}
+
+// Called with cpu == NULL only to publish the handler table
+uint32_t cpu_run_threaded(CPU *cpu, uint32_t cycle_budget) {
+    static const void *dispatch_table[256] = {
+        &&op_00, &&op_01, &&op_02, &&op_03, &&op_04, &&op_05, &&op_06, &&op_07,
+        &&op_08, &&op_09, &&op_0A, &&op_0B, &&op_0C, &&op_0D, &&op_0E, &&op_0F,
+        &&op_10, &&op_11, &&op_12, &&op_13, &&op_14, &&op_15, &&op_16, &&op_17,
+        &&op_18, &&op_19, &&op_1A, &&op_1B, &&op_1C, &&op_1D, &&op_1E, &&op_1F,
+        &&op_20, &&op_21, &&op_22, &&op_23, &&op_24, &&op_25, &&op_26, &&op_27,
+        &&op_28, &&op_29, &&op_2A, &&op_2B, &&op_2C, &&op_2D, &&op_2E, &&op_2F,
+        &&op_30, &&op_31, &&op_32, &&op_33, &&op_34, &&op_35, &&op_36, &&op_37,
+        &&op_38, &&op_39, &&op_3A, &&op_3B, &&op_3C, &&op_3D, &&op_3E, &&op_3F,
+        &&op_40, &&op_41, &&op_42, &&op_43, &&op_44, &&op_45, &&op_46, &&op_47,
+        &&op_48, &&op_49, &&op_4A, &&op_4B, &&op_4C, &&op_4D, &&op_4E, &&op_4F,
+        &&op_50, &&op_51, &&op_52, &&op_53, &&op_54, &&op_55, &&op_56, &&op_57,
+        &&op_58, &&op_59, &&op_5A, &&op_5B, &&op_5C, &&op_5D, &&op_5E, &&op_5F,
+        &&op_60, &&op_61, &&op_62, &&op_63, &&op_64, &&op_65, &&op_66, &&op_67,
+        &&op_68, &&op_69, &&op_6A, &&op_6B, &&op_6C, &&op_6D, &&op_6E, &&op_6F,
+        &&op_70, &&op_71, &&op_72, &&op_73, &&op_74, &&op_75, &&op_76, &&op_77,
+        &&op_78, &&op_79, &&op_7A, &&op_7B, &&op_7C, &&op_7D, &&op_7E, &&op_7F,
+        &&op_80, &&op_81, &&op_82, &&op_83, &&op_84, &&op_85, &&op_86, &&op_87,
+        &&op_88, &&op_89, &&op_8A, &&op_8B, &&op_8C, &&op_8D, &&op_8E, &&op_8F,
+        &&op_90, &&op_91, &&op_92, &&op_93, &&op_94, &&op_95, &&op_96, &&op_97,
+        &&op_98, &&op_99, &&op_9A, &&op_9B, &&op_9C, &&op_9D, &&op_9E, &&op_9F,
+        &&op_A0, &&op_A1, &&op_A2, &&op_A3, &&op_A4, &&op_A5, &&op_A6, &&op_A7,
+        &&op_A8, &&op_A9, &&op_AA, &&op_AB, &&op_AC, &&op_AD, &&op_AE, &&op_AF,
+        &&op_B0, &&op_B1, &&op_B2, &&op_B3, &&op_B4, &&op_B5, &&op_B6, &&op_B7,
+        &&op_B8, &&op_B9, &&op_BA, &&op_BB, &&op_BC, &&op_BD, &&op_BE, &&op_BF,
+        &&op_C0, &&op_C1, &&op_C2, &&op_C3, &&op_C4, &&op_C5, &&op_C6, &&op_C7,
+        &&op_C8, &&op_C9, &&op_CA, &&op_CB, &&op_CC, &&op_CD, &&op_CE, &&op_CF,
+        &&op_D0, &&op_D1, &&op_D2, &&op_D3, &&op_D4, &&op_D5, &&op_D6, &&op_D7,
+        &&op_D8, &&op_D9, &&op_DA, &&op_DB, &&op_DC, &&op_DD, &&op_DE, &&op_DF,
+        &&op_E0, &&op_E1, &&op_E2, &&op_E3, &&op_E4, &&op_E5, &&op_E6, &&op_E7,
+        &&op_E8, &&op_E9, &&op_EA, &&op_EB, &&op_EC, &&op_ED, &&op_EE, &&op_EF,
+        &&op_F0, &&op_F1, &&op_F2, &&op_F3, &&op_F4, &&op_F5, &&op_F6, &&op_F7,
+        &&op_F8, &&op_F9, &&op_FA, &&op_FB, &&op_FC, &&op_FD, &&op_FE, &&op_FF,
+    };
+
+    static const void *fused_table[FUSED_COUNT] = {
+        [FUSED_MOV_A_H_CPI_JNZ] = &&fz_MOV_A_H_CPI_JNZ,
+        [FUSED_LDAX_D_MOV_M_A]  = &&fz_LDAX_D_MOV_M_A,
+        [FUSED_MVI_M_INX_H]     = &&fz_MVI_M_INX_H,
+        [FUSED_INX_H_INX_D]     = &&fz_INX_H_INX_D,
+        [FUSED_DCR_B_JNZ]       = &&fz_DCR_B_JNZ,
+        [FUSED_DCR_C_JNZ]       = &&fz_DCR_C_JNZ,
+        [FUSED_LXI_B_DAD_B]     = &&fz_LXI_B_DAD_B,
+        [FUSED_DAD_D_XCHG]      = &&fz_DAD_D_XCHG,
+        [FUSED_IDLE_LOOP]       = &&idle_loop,
+        [FUSED_HLE]             = &&hle,
+        [FUSED_LOOP_IDIOM]      = &&loop_idiom,
+    };
+
+    if (!cpu) {
+        handler_table = dispatch_table;
+        fused_handler_table = fused_table;
+        return 0;
+    }
+
+    Machine *machine = machine_of(cpu);
+    Memory *mem = &machine->memory;
+    const DecodedInstruction *entry;
+    DecodedInstruction live;
+    uint32_t cycles = 0;
+    IdleWatch idle = IDLE_WATCH_INIT;
+
+    DISPATCH();
+
+    // NOP and its undocumented duplicates
+    op_00: op_08: op_10: op_18: op_20: op_28: op_30: op_38:
+        NEXT(1, 4);
+
+    op_01: OP_LXI(cpu->BC);                                 // LXI B, D16
+    op_02: write_memory(mem, cpu->BC, cpu->A); NEXT(1, 7);       // STAX B
+    op_03: OP_INX(cpu->BC);                                 // INX B
+    op_04: OP_INR(B);                                       // INR B
+    op_05: OP_DCR(B);                                       // DCR B
+    op_06: OP_MVI(B);                                       // MVI B, D8
+    op_07:                                                  // RLC
+        update_CY(cpu, cpu->A & 0x80);
+        cpu->A = (cpu->A << 1) | (cpu->A >> 7);
+        NEXT(1, 4);
+    op_09: OP_DAD(cpu->BC);                                 // DAD B
+    op_0A: cpu->A = read_memory(mem, cpu->BC); NEXT(1, 7);       // LDAX B
+    op_0B: OP_DCX(cpu->BC);                                 // DCX B
+    op_0C: OP_INR(C);                                       // INR C
+    op_0D: OP_DCR(C);                                       // DCR C
+    op_0E: OP_MVI(C);                                       // MVI C, D8
+    op_0F:                                                  // RRC
+        update_CY(cpu, cpu->A & 1);
+        cpu->A = (cpu->A >> 1) | (cpu->A << 7);
+        NEXT(1, 4);
+
+    op_11: OP_LXI(cpu->DE);                                 // LXI D, D16
+    op_12: write_memory(mem, cpu->DE, cpu->A); NEXT(1, 7);       // STAX D
+    op_13: OP_INX(cpu->DE);                                 // INX D
+    op_14: OP_INR(D);                                       // INR D
+    op_15: OP_DCR(D);                                       // DCR D
+    op_16: OP_MVI(D);                                       // MVI D, D8
+    op_17: {                                                // RAL
+        uint8_t bit7 = (cpu->A >> 7) & 1;
+        cpu->A = (cpu->A << 1) | (get_flags(cpu) & FLAG_CY);
+        update_CY(cpu, bit7);
+        NEXT(1, 4);
+    }
+    op_19: OP_DAD(cpu->DE);                                 // DAD D
+    op_1A: cpu->A = read_memory(mem, cpu->DE); NEXT(1, 7);       // LDAX D
+    op_1B: OP_DCX(cpu->DE);                                 // DCX D
+    op_1C: OP_INR(E);                                       // INR E
+    op_1D: OP_DCR(E);                                       // DCR E
+    op_1E: OP_MVI(E);                                       // MVI E, D8
+    op_1F: {                                                // RAR
+        uint8_t bit0 = cpu->A & 1;
+        cpu->A = (cpu->A >> 1) | ((get_flags(cpu) & FLAG_CY) << 7);
+        update_CY(cpu, bit0);
+        NEXT(1, 4);
+    }
+
+    op_21: OP_LXI(HL);                                      // LXI H, D16
+    op_22: {                                                // SHLD
+        uint16_t address = OPERAND16;
+        write_memory(mem, address, cpu->L);
+        write_memory(mem, address + 1, cpu->H);
+        NEXT(3, 16);
+    }
+    op_23: OP_INX(HL);                                      // INX H
+    op_24: OP_INR(H);                                       // INR H
+    op_25: OP_DCR(H);                                       // DCR H
+    op_26: OP_MVI(H);                                       // MVI H, D8
+    op_27: {                                                // DAA
+        uint8_t correction = 0;
+        uint16_t result = cpu->A;
+
+        if ((cpu->A & 0x0F) > 9 || (get_flags(cpu) & FLAG_AC))
+            correction += 0x06;
+
+        if (cpu->A > 0x99 || (get_flags(cpu) & FLAG_CY)) {
+            correction += 0x60;
+            update_CY(cpu, 1);
+        } else {
+            update_CY(cpu, 0);
+        }
+
+        result += correction;
+        cpu->A = result & 0xFF;
+
+        set_flags(cpu, (get_flags(cpu) & ~FLAG_AC) | (((cpu->A & 0x0F) < (result & 0x0F)) ? FLAG_AC : 0));
+        update_SZP(cpu, cpu->A);
+        NEXT(1, 4);
+    }
+    op_29: OP_DAD(HL);                                      // DAD H
+    op_2A: {                                                // LHLD
+        uint16_t address = OPERAND16;
+        cpu->L = read_memory(mem, address);
+        cpu->H = read_memory(mem, address + 1);
+        NEXT(3, 16);
+    }
+    op_2B: OP_DCX(HL);                                      // DCX H
+    op_2C: OP_INR(L);                                       // INR L
+    op_2D: OP_DCR(L);                                       // DCR L
+    op_2E: OP_MVI(L);                                       // MVI L, D8
+    op_2F: cpu->A = ~cpu->A; NEXT(1, 4);                    // CMA
+
+    op_31: cpu->SP = OPERAND16; NEXT(3, 10);                // LXI SP, D16
+    op_32: write_memory(mem, OPERAND16, cpu->A); NEXT(3, 13);    // STA adr
+    op_33: cpu->SP++; NEXT(1, 5);                           // INX SP
+    op_34: {                                                // INR M
+        uint16_t address = HL;
+        uint8_t value = read_memory(mem, address) + 1;
+        update_SZP(cpu, value);
+        write_memory(mem, address, value);
+        NEXT(1, 10);
+    }
+    op_35: {                                                // DCR M
+        uint16_t address = HL;
+        uint8_t value = read_memory(mem, address) - 1;
+        update_SZP(cpu, value);
+        write_memory(mem, address, value);
+        NEXT(1, 10);
+    }
+    op_36: write_memory(mem, HL, OPERAND8); NEXT(2, 10);         // MVI M, D8
+    op_37:                                                  // STC
+        set_flags(cpu, get_flags(cpu) | FLAG_CY);
+        NEXT(1, 4);
+    op_39: OP_DAD(cpu->SP);                                 // DAD SP
+    op_3A: cpu->A = read_memory(mem, OPERAND16); NEXT(3, 13);    // LDA adr
+    op_3B: cpu->SP--; NEXT(1, 5);                           // DCX SP
+    op_3C: OP_INR(A);                                       // INR A
+    op_3D: OP_DCR(A);                                       // DCR A
+    op_3E: OP_MVI(A);                                       // MVI A, D8
+    op_3F:                                                  // CMC
+        set_flags(cpu, get_flags(cpu) ^ FLAG_CY);
+        NEXT(1, 4);
+
+    // MOV r, r'
+    op_40: OP_MOV(B, B);    op_41: OP_MOV(B, C);    op_42: OP_MOV(B, D);    op_43: OP_MOV(B, E);
+    op_44: OP_MOV(B, H);    op_45: OP_MOV(B, L);    op_46: OP_MOV_RM(B);    op_47: OP_MOV(B, A);
+    op_48: OP_MOV(C, B);    op_49: OP_MOV(C, C);    op_4A: OP_MOV(C, D);    op_4B: OP_MOV(C, E);
+    op_4C: OP_MOV(C, H);    op_4D: OP_MOV(C, L);    op_4E: OP_MOV_RM(C);    op_4F: OP_MOV(C, A);
+    op_50: OP_MOV(D, B);    op_51: OP_MOV(D, C);    op_52: OP_MOV(D, D);    op_53: OP_MOV(D, E);
+    op_54: OP_MOV(D, H);    op_55: OP_MOV(D, L);    op_56: OP_MOV_RM(D);    op_57: OP_MOV(D, A);
+    op_58: OP_MOV(E, B);    op_59: OP_MOV(E, C);    op_5A: OP_MOV(E, D);    op_5B: OP_MOV(E, E);
+    op_5C: OP_MOV(E, H);    op_5D: OP_MOV(E, L);    op_5E: OP_MOV_RM(E);    op_5F: OP_MOV(E, A);
+    op_60: OP_MOV(H, B);    op_61: OP_MOV(H, C);    op_62: OP_MOV(H, D);    op_63: OP_MOV(H, E);
+    op_64: OP_MOV(H, H);    op_65: OP_MOV(H, L);    op_66: OP_MOV_RM(H);    op_67: OP_MOV(H, A);
+    op_68: OP_MOV(L, B);    op_69: OP_MOV(L, C);    op_6A: OP_MOV(L, D);    op_6B: OP_MOV(L, E);
+    op_6C: OP_MOV(L, H);    op_6D: OP_MOV(L, L);    op_6E: OP_MOV_RM(L);    op_6F: OP_MOV(L, A);
+    op_70: OP_MOV_MR(B);    op_71: OP_MOV_MR(C);    op_72: OP_MOV_MR(D);    op_73: OP_MOV_MR(E);
+    op_74: OP_MOV_MR(H);    op_75: OP_MOV_MR(L);    op_76: NEXT(1, 7);      op_77: OP_MOV_MR(A);  // 0x76 HLT
+    op_78: OP_MOV(A, B);    op_79: OP_MOV(A, C);    op_7A: OP_MOV(A, D);    op_7B: OP_MOV(A, E);
+    op_7C: OP_MOV(A, H);    op_7D: OP_MOV(A, L);    op_7E: OP_MOV_RM(A);    op_7F: OP_MOV(A, A);
+
+    // ADD / ADC
+    op_80: OP_ADD(cpu->B, 1, 4);    op_81: OP_ADD(cpu->C, 1, 4);    op_82: OP_ADD(cpu->D, 1, 4);
+    op_83: OP_ADD(cpu->E, 1, 4);    op_84: OP_ADD(cpu->H, 1, 4);    op_85: OP_ADD(cpu->L, 1, 4);
+    op_86: OP_ADD(read_memory(mem, HL), 1, 7);                   op_87: OP_ADD(cpu->A, 1, 4);
+    op_88: OP_ADC(cpu->B, 1, 4);    op_89: OP_ADC(cpu->C, 1, 4);    op_8A: OP_ADC(cpu->D, 1, 4);
+    op_8B: OP_ADC(cpu->E, 1, 4);    op_8C: OP_ADC(cpu->H, 1, 4);    op_8D: OP_ADC(cpu->L, 1, 4);
+    op_8E: OP_ADC(read_memory(mem, HL), 1, 7);                   op_8F: OP_ADC(cpu->A, 1, 4);
+
+    // SUB / SBB
+    op_90: OP_SUB(cpu->B, 1, 4);    op_91: OP_SUB(cpu->C, 1, 4);    op_92: OP_SUB(cpu->D, 1, 4);
+    op_93: OP_SUB(cpu->E, 1, 4);    op_94: OP_SUB(cpu->H, 1, 4);    op_95: OP_SUB(cpu->L, 1, 4);
+    op_96: OP_SUB(read_memory(mem, HL), 1, 7);                   op_97: OP_SUB(cpu->A, 1, 4);
+    op_98: OP_SBB(cpu->B, 1, 4);    op_99: OP_SBB(cpu->C, 1, 4);    op_9A: OP_SBB(cpu->D, 1, 4);
+    op_9B: OP_SBB(cpu->E, 1, 4);    op_9C: OP_SBB(cpu->H, 1, 4);    op_9D: OP_SBB(cpu->L, 1, 4);
+    op_9E: OP_SBB(read_memory(mem, HL), 1, 7);                   op_9F: OP_SBB(cpu->A, 1, 4);
+
+    // ANA / XRA
+    op_A0: OP_ANA(cpu->B, 4);       op_A1: OP_ANA(cpu->C, 4);       op_A2: OP_ANA(cpu->D, 4);
+    op_A3: OP_ANA(cpu->E, 4);       op_A4: OP_ANA(cpu->H, 4);       op_A5: OP_ANA(cpu->L, 4);
+    op_A6: OP_ANA(read_memory(mem, HL), 7);                      op_A7: OP_ANA(cpu->A, 4);
+    op_A8: OP_XRA(cpu->B, 4);       op_A9: OP_XRA(cpu->C, 4);       op_AA: OP_XRA(cpu->D, 4);
+    op_AB: OP_XRA(cpu->E, 4);       op_AC: OP_XRA(cpu->H, 4);       op_AD: OP_XRA(cpu->L, 4);
+    op_AE: OP_XRA(read_memory(mem, HL), 7);                      op_AF: OP_XRA(cpu->A, 4);
+
+    // ORA / CMP
+    op_B0: OP_ORA(cpu->B, 4);       op_B1: OP_ORA(cpu->C, 4);       op_B2: OP_ORA(cpu->D, 4);
+    op_B3: OP_ORA(cpu->E, 4);       op_B4: OP_ORA(cpu->H, 4);       op_B5: OP_ORA(cpu->L, 4);
+    op_B6: OP_ORA(read_memory(mem, HL), 7);                      op_B7: OP_ORA(cpu->A, 4);
+    op_B8: OP_CMP(cpu->B, 4);       op_B9: OP_CMP(cpu->C, 4);       op_BA: OP_CMP(cpu->D, 4);
+    op_BB: OP_CMP(cpu->E, 4);       op_BC: OP_CMP(cpu->H, 4);       op_BD: OP_CMP(cpu->L, 4);
+    op_BE: OP_CMP(read_memory(mem, HL), 7);                      op_BF: OP_CMP(cpu->A, 4);
+
+    op_C0: OP_RCOND(!(get_flags(cpu) & FLAG_Z));            // RNZ
+    op_C1: OP_POP(B, C);                                    // POP B
+    op_C2: OP_JCOND(!(get_flags(cpu) & FLAG_Z));            // JNZ addr
+    op_C3: cpu->PC = OPERAND16; NEXT(0, 10);                // JMP addr
+    op_C4: OP_CCOND(!(get_flags(cpu) & FLAG_Z));            // CNZ addr
+    op_C5: OP_PUSH(B, C);                                   // PUSH B
+    op_C6: {                                                // ADI D8
+        uint8_t value = OPERAND8;
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value;
+        cpu->A = result & 0xFF;
+        set_flags_arith(cpu, result, cpu->A, value);  // AC from the new A
+        NEXT(2, 7);
+    }
+    op_C7: OP_RST(0x0000, 0);                               // RST 0
+    op_C8: OP_RCOND(get_flags(cpu) & FLAG_Z);               // RZ
+    op_C9: ret(cpu); NEXT(0, 10);                           // RET
+    op_CA: OP_JCOND(get_flags(cpu) & FLAG_Z);               // JZ addr
+    op_CB: NEXT(1, 10);                                     // *JMP addr (duplicate)
+    op_CC: OP_CCOND(get_flags(cpu) & FLAG_Z);               // CZ addr
+    op_CD: call(cpu, OPERAND16, cpu->PC + 3); NEXT(0, 17);  // CALL addr
+    op_CE: {                                                // ACI D8
+        uint8_t value = OPERAND8;
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY);
+        cpu->A = result & 0xFF;
+        set_flags_arith(cpu, result, cpu->A, value);  // AC from the new A
+        NEXT(2, 7);
+    }
+    op_CF: OP_RST(0x0008, 0);                               // RST 1
+
+    op_D0: OP_RCOND(!(get_flags(cpu) & FLAG_CY));           // RNC
+    op_D1: OP_POP(D, E);                                    // POP D
+    op_D2: OP_JCOND(!(get_flags(cpu) & FLAG_CY));           // JNC addr
+    op_D3: machine_out(machine, OPERAND8, cpu->A); NEXT(2, 10); // OUT D8
+    op_D4: OP_CCOND(!(get_flags(cpu) & FLAG_CY));           // CNC addr
+    op_D5: OP_PUSH(D, E);                                   // PUSH D
+    op_D6: OP_SUB(OPERAND8, 2, 7);                          // SUI D8
+    op_D7: OP_RST(0x0010, 11);                              // RST 2
+    op_D8: OP_RCOND(get_flags(cpu) & FLAG_CY);              // RC
+    op_D9: NEXT(1, 10);                                     // *RET (duplicate)
+    op_DA: OP_JCOND(get_flags(cpu) & FLAG_CY);              // JC addr
+    op_DB: cpu->A = machine_in(machine, OPERAND8); NEXT(2, 10); // IN D8
+    op_DC: OP_CCOND(get_flags(cpu) & FLAG_CY);              // CC addr
+    op_DD: NEXT(1, 17);                                     // *CALL a16 (duplicate)
+    op_DE: OP_SBB(OPERAND8, 2, 7);                          // SBI D8
+    op_DF: OP_RST(0x0018, 0);                               // RST 3
+
+    op_E0: OP_RCOND(!(get_flags(cpu) & FLAG_P));            // RPO
+    op_E1: OP_POP(H, L);                                    // POP H
+    op_E2: OP_JCOND(!(get_flags(cpu) & FLAG_P));            // JPO addr
+    op_E3: {                                                // XTHL
+        uint8_t l = cpu->L;
+        cpu->L = read_memory(mem, cpu->SP);
+        write_memory(mem, cpu->SP, l);
+        uint8_t h = cpu->H;
+        cpu->H = read_memory(mem, cpu->SP + 1);
+        write_memory(mem, cpu->SP + 1, h);
+        NEXT(1, 18);
+    }
+    op_E4: OP_CCOND(!(get_flags(cpu) & FLAG_P));            // CPO addr
+    op_E5: OP_PUSH(H, L);                                   // PUSH H
+    op_E6:                                                  // ANI D8
+        cpu->A &= OPERAND8;
+        set_flags_logic(cpu, cpu->A, 0);
+        NEXT(2, 7);
+    op_E7: OP_RST(0x0020, 0);                               // RST 4
+    op_E8: OP_RCOND(get_flags(cpu) & FLAG_P);               // RPE
+    op_E9: cpu->PC = HL; NEXT(0, 5);                        // PCHL
+    op_EA: OP_JCOND(get_flags(cpu) & FLAG_P);               // JPE addr
+    op_EB: {                                                // XCHG
+        uint16_t temp = HL;
+        HL = cpu->DE;
+        cpu->DE = temp;
+        NEXT(1, 5);
+    }
+    op_EC: OP_CCOND(get_flags(cpu) & FLAG_P);               // CPE addr
+    op_ED: NEXT(1, 17);                                     // *CALL a16 (duplicate)
+    op_EE:                                                  // XRI D8
+        cpu->A ^= OPERAND8;
+        set_flags_logic(cpu, cpu->A, 0);
+        NEXT(2, 7);
+    op_EF: OP_RST(0x0028, 0);                               // RST 5
+
+    op_F0: OP_RCOND(!(get_flags(cpu) & FLAG_S));            // RP
+    op_F1: {                                                // POP PSW
+        set_flags(cpu, (read_memory(mem, cpu->SP) & ~0x28) | FLAG_ONE);  // Bits 3 and 5 read as 0, bit 1 as 1
+
+        cpu->A = read_memory(mem, cpu->SP + 1);
+        cpu->SP += 2;
+        NEXT(1, 10);
+    }
+    op_F2: OP_JCOND(!(get_flags(cpu) & FLAG_S));            // JP addr
+    op_F3: cpu->interrupts_enabled = 0; NEXT(1, 4);         // DI
+    op_F4: OP_CCOND(!(get_flags(cpu) & FLAG_S));            // CP addr
+    op_F5: {                                                // PUSH PSW
+        write_memory(mem, cpu->SP - 1, cpu->A);
+        write_memory(mem, cpu->SP - 2, get_flags(cpu));
+        cpu->SP -= 2;
+        NEXT(1, 11);
+    }
+    op_F6:                                                  // ORI D8
+        cpu->A |= OPERAND8;
+        set_flags_logic(cpu, cpu->A, get_flags(cpu) & FLAG_AC);  // ORI always clears carry, AC is kept
+        NEXT(2, 7);
+    op_F7: OP_RST(0x0030, 0);                               // RST 6
+    op_F8: OP_RCOND(get_flags(cpu) & FLAG_S);               // RM
+    op_F9: cpu->SP = HL; NEXT(1, 5);                        // SPHL
+    op_FA: OP_JCOND(get_flags(cpu) & FLAG_S);               // JM addr
+    op_FB: cpu->interrupts_enabled = 1; NEXT(1, 4);         // EI
+    op_FC: OP_CCOND(get_flags(cpu) & FLAG_S);               // CM addr
+    op_FD: NEXT(1, 17);                                     // *CALL a16 (duplicate)
+    op_FE: {                                                // CPI D8
+        uint8_t value = OPERAND8;
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+        set_flags_arith(cpu, result, cpu->A, value);
+        NEXT(2, 7);
+    }
+    op_FF: OP_RST(0x0038, 0);                               // RST 7
+
+    // Superinstructions, same statements as the handlers they replace
+    fz_MOV_A_H_CPI_JNZ: {                                   // MOV A,H; CPI d8; JNZ addr
+        FUSED_GUARD(5 + 7);
+        uint8_t value = (uint8_t)FOLLOWING(1)->operand;
+        cpu->A = cpu->H;
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value;
+        set_flags_arith(cpu, result, cpu->A, value);
+        if (!(get_flags(cpu) & FLAG_Z)) {
+            cpu->PC = FOLLOWING(3)->operand;
+            NEXT(0, 5 + 7 + 10);
+        }
+        NEXT(1 + 2 + 3, 5 + 7 + 10);
+    }
+    fz_LDAX_D_MOV_M_A:                                      // LDAX D; MOV M,A
+        FUSED_GUARD(7);
+        cpu->A = read_memory(mem, cpu->DE);
+        write_memory(mem, HL, cpu->A);
+        NEXT(1 + 1, 7 + 7);
+    fz_MVI_M_INX_H:                                         // MVI M,d8; INX H
+        FUSED_GUARD(10);
+        write_memory(mem, HL, OPERAND8);
+        HL++;
+        NEXT(2 + 1, 10 + 5);
+    fz_INX_H_INX_D:                                         // INX H; INX D
+        FUSED_GUARD(5);
+        HL++;
+        cpu->DE++;
+        NEXT(1 + 1, 5 + 5);
+    fz_DCR_B_JNZ:                                           // DCR B; JNZ addr
+        FUSED_GUARD(5);
+        cpu->B--;
+        update_SZP(cpu, cpu->B);
+        if (!(get_flags(cpu) & FLAG_Z)) {
+            cpu->PC = FOLLOWING(1)->operand;
+            NEXT(0, 5 + 10);
+        }
+        NEXT(1 + 3, 5 + 10);
+    fz_DCR_C_JNZ:                                           // DCR C; JNZ addr
+        FUSED_GUARD(5);
+        cpu->C--;
+        update_SZP(cpu, cpu->C);
+        if (!(get_flags(cpu) & FLAG_Z)) {
+            cpu->PC = FOLLOWING(1)->operand;
+            NEXT(0, 5 + 10);
+        }
+        NEXT(1 + 3, 5 + 10);
+    fz_LXI_B_DAD_B: {                                       // LXI B,d16; DAD B
+        FUSED_GUARD(10);
+        cpu->BC = OPERAND16;
+        uint32_t result = (uint32_t)OPERAND16 + (uint32_t)HL;
+        update_CY_16bit(cpu, result);
+        HL = (uint16_t)result;
+        NEXT(3 + 1, 10 + 10);
+    }
+    fz_DAD_D_XCHG: {                                        // DAD D; XCHG
+        FUSED_GUARD(10);
+        uint32_t result = (uint32_t)cpu->DE + (uint32_t)HL;
+        update_CY_16bit(cpu, result);
+        HL = cpu->DE;
+        cpu->DE = (uint16_t)result;
+        NEXT(1 + 1, 10 + 5);
+    }
+
+    idle_loop:                                              // Head of an idle loop
+        cycles += idle_loop_skip(&idle, cpu->PC, cycles, cycle_budget);
+        goto *dispatch_table[entry->opcode];
+
+    hle: {                                                  // Entry of a native routine
+        uint32_t used = hle_run(cpu, cycles, cycle_budget);
+        if (used)
+            NEXT(0, used);
+        if (loop_idiom_index[cpu->PC])                      // Some are fill/copy loops too
+            goto loop_idiom;
+        goto *dispatch_table[entry->opcode];
+    }
+
+    loop_idiom: {                                           // Head of a fill/copy loop
+        uint32_t used = loop_idiom_run(cpu, cycles, cycle_budget);
+        if (used)
+            NEXT(0, used);
+        goto *dispatch_table[entry->opcode];
+    }
+
+done:
+    return cycles;
+}
+
+#else
+
+// Compilers without labels-as-values get the switch core in a loop
+const void *const *cpu_threaded_handlers(void) {
+    static const void *no_handlers[256];
+    return no_handlers;
+}
+
+const void *const *cpu_threaded_fused_handlers(void) {
+    static const void *no_handlers[FUSED_COUNT];
+    return no_handlers;
+}
+
+uint32_t cpu_run_threaded(CPU *cpu, uint32_t cycle_budget) {
+    uint32_t cycles = 0;
+    IdleWatch idle = IDLE_WATCH_INIT;
+
+    while (cycles < cycle_budget) {
+        if (cpu->PC < ROM_SIZE && idle_loop_cycles[cpu->PC])
+            cycles += idle_loop_skip(&idle, cpu->PC, cycles, cycle_budget);
+        if (cpu->PC < ROM_SIZE && hle_index[cpu->PC]) {
+            uint32_t used = hle_run(cpu, cycles, cycle_budget);
+            cycles += used;
+            if (used)
+                continue;
+        }
+        if (cpu->PC < ROM_SIZE && loop_idiom_index[cpu->PC]) {
+            uint32_t used = loop_idiom_run(cpu, cycles, cycle_budget);
+            cycles += used;
+            if (used)
+                continue;
+        }
+        cycles += cpu_execute_instruction(cpu);
+    }
+    return cycles;
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include "decode_cache.h"
+#include "idle_loop.h"
+#include "hle.h"
+#include "loop_idiom.h"
+#include "static_core.h"
+#include "cpu.h"
+
+#include <stdint.h>
+#include <string.h>
+
+DecodedInstruction decode_cache[ROM_SIZE];
+uint32_t rom_generation;
+
+// Bytes per instruction when no branch is taken
+const uint8_t opcode_lengths[256] = {
+//  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  // 0x00
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  // 0x10
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,  // 0x20
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,  // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,  // 0xC0
+    1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1,  // 0xD0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,  // 0xE0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,  // 0xF0
+};
+
+// Cycles returned by cpu_execute_instruction for each opcode
+const uint8_t opcode_cycles[256] = {
+//   0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,  // 0x00
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,  // 0x10
+     4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4,  // 0x20
+     4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4,  // 0x30
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x40
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x50
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x60
+     7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x70
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0x80
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0x90
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0xA0
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0xB0
+     5, 10, 10, 10, 11, 11,  7,  0,  5, 10, 10, 10, 11, 17,  7,  0,  // 0xC0
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7,  0,  // 0xD0
+     5, 10, 10, 18, 11, 11,  7,  0,  5,  5, 10,  5, 11, 17,  7,  0,  // 0xE0
+     5, 10, 10,  4, 11, 11,  7,  0,  5,  5, 10,  4, 11, 17,  7,  0,  // 0xF0
+};
+
+typedef struct {
+    uint8_t opcodes[3];
+    uint8_t count;
+    FusedOp op;
+} FusionPattern;
+
+// Picked from profile_report on the invaders ROM, longest patterns first
+static const FusionPattern fusion_patterns[] = {
+    {{0x7C, 0xFE, 0xC2}, 3, FUSED_MOV_A_H_CPI_JNZ},
+    {{0x1A, 0x77},       2, FUSED_LDAX_D_MOV_M_A},
+    {{0x36, 0x23},       2, FUSED_MVI_M_INX_H},
+    {{0x23, 0x13},       2, FUSED_INX_H_INX_D},
+    {{0x05, 0xC2},       2, FUSED_DCR_B_JNZ},
+    {{0x0D, 0xC2},       2, FUSED_DCR_C_JNZ},
+    {{0x01, 0x09},       2, FUSED_LXI_B_DAD_B},
+    {{0x19, 0xEB},       2, FUSED_DAD_D_XCHG},
+};
+
+#define NUM_FUSION_PATTERNS (sizeof(fusion_patterns) / sizeof(fusion_patterns[0]))
+
+// Does the pattern start at pc, with every instruction fully inside the ROM
+static int fusion_matches(const FusionPattern *pattern, uint32_t pc) {
+    for (uint8_t i = 0; i < pattern->count; i++) {
+        if (pc >= ROM_SIZE || !decode_cache[pc].handler || decode_cache[pc].opcode != pattern->opcodes[i])
+            return 0;
+        pc += decode_cache[pc].length;
+    }
+    return 1;
+}
+
+// Swaps in fused handlers, after the whole ROM is decoded
+static void fuse_superinstructions(void) {
+    const void *const *fused = cpu_threaded_fused_handlers();
+
+    for (uint32_t pc = 0; pc < ROM_SIZE; pc++) {
+        for (unsigned i = 0; i < NUM_FUSION_PATTERNS; i++) {
+            const FusionPattern *pattern = &fusion_patterns[i];
+            if (fused[pattern->op] && fusion_matches(pattern, pc)) {
+                decode_cache[pc].handler = fused[pattern->op];
+                break;
+            }
+        }
+    }
+}
+
+// Idle loop heads, fill/copy loop heads and native routine entries get the
+// threaded core's handlers for them, which fall back to the address's own
+// opcode (a fused one there is given up). The native routine handler checks
+// for a loop itself.
+static void mark_rom_hooks(void) {
+    const void *idle = cpu_threaded_fused_handlers()[FUSED_IDLE_LOOP];
+    const void *loop = cpu_threaded_fused_handlers()[FUSED_LOOP_IDIOM];
+    const void *hle = cpu_threaded_fused_handlers()[FUSED_HLE];
+
+    for (uint32_t pc = 0; pc < ROM_SIZE; pc++) {
+        if (!decode_cache[pc].handler)
+            continue;
+        if (idle && idle_loop_cycles[pc])
+            decode_cache[pc].handler = idle;
+        if (loop && loop_idiom_index[pc])
+            decode_cache[pc].handler = loop;
+        if (hle && hle_index[pc])
+            decode_cache[pc].handler = hle;
+    }
+}
+
+// Called from load_rom_into_mem once the ROM image is in place
+void decode_cache_build(const uint8_t *rom) {
+    const void *const *handlers = cpu_threaded_handlers();
+
+    memset(decode_cache, 0, sizeof(decode_cache));
+
+    for (uint32_t pc = 0; pc < ROM_SIZE; pc++) {
+        DecodedInstruction *entry = &decode_cache[pc];
+        uint8_t opcode = rom[pc];
+
+        entry->opcode = opcode;
+        entry->length = opcode_lengths[opcode];
+        entry->cycles = opcode_cycles[opcode];
+
+        // Operands spilling into RAM can change, so those are left to live decoding
+        if (pc + entry->length > ROM_SIZE)
+            continue;
+
+        if (entry->length == 2)
+            entry->operand = rom[pc + 1];
+        else if (entry->length == 3)
+            entry->operand = make_half_word(rom[pc + 2], rom[pc + 1]);
+
+        entry->handler = handlers[opcode];
+    }
+
+    // The profiling pass needs every instruction dispatched on its own
+    if (!CPU_PROFILE)
+        fuse_superinstructions();
+
+    idle_loop_find(rom);
+    loop_idiom_find(rom);
+    hle_install(rom);
+    mark_rom_hooks();
+    static_install(rom);
+    rom_generation++;
+}
@@ -0,0 +1,56 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <stdint.h>
+#include "memory.h"
+
+/**
+ * One pre-decoded instruction of the ROM
+ *
+ * @param handler  Threaded-core handler for the opcode, NULL if the entry
+ *                 must be decoded live (operands reach past the ROM)
+ * @param operand  Immediate operand, d8 in the low byte or d16
+ * @param opcode   Raw opcode byte
+ * @param length   Bytes taken by the instruction, 1-3
+ * @param cycles   Base cycles charged by the cores
+ */
+typedef struct {
+    const void *handler;
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t cycles;
+} DecodedInstruction;
+
+// Superinstructions: hot opcode sequences the threaded core runs in a single
+// dispatch. decode_cache_build puts the fused handler on the first
+// instruction of each match, the instructions after it keep their own.
+typedef enum {
+    FUSED_MOV_A_H_CPI_JNZ,      // MOV A,H; CPI d8; JNZ   end-of-screen test in the clear/fill loops
+    FUSED_LDAX_D_MOV_M_A,       // LDAX D; MOV M,A        block copy
+    FUSED_MVI_M_INX_H,          // MVI M,d8; INX H        fill
+    FUSED_INX_H_INX_D,          // INX H; INX D           copy and sprite pointers
+    FUSED_DCR_B_JNZ,            // DCR B; JNZ             loop counter
+    FUSED_DCR_C_JNZ,            // DCR C; JNZ             loop counter
+    FUSED_LXI_B_DAD_B,          // LXI B,d16; DAD B       next sprite row
+    FUSED_DAD_D_XCHG,           // DAD D; XCHG            pointer arithmetic
+    FUSED_IDLE_LOOP,            // Head of an idle loop, skips to the interrupt (idle_loop.h)
+    FUSED_HLE,                  // Entry of a native routine (hle.h)
+    FUSED_LOOP_IDIOM,           // Head of a fill/copy loop, runs it as memset/memmove (loop_idiom.h)
+    FUSED_COUNT
+} FusedOp;
+
+// ROM never changes once loaded, so every address is decoded exactly once
+extern DecodedInstruction decode_cache[ROM_SIZE];
+
+// Bumped by every decode_cache_build and by turning HLE or the loop idioms on
+// or off, so code compiled from an earlier ROM image or hook set (the JIT's
+// blocks) can tell it is stale
+extern uint32_t rom_generation;
+
+extern const uint8_t opcode_lengths[256];
+extern const uint8_t opcode_cycles[256];
+
+void decode_cache_build(const uint8_t *rom);
+
+#endif
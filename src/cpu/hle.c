@@ -0,0 +1,333 @@
+#include "hle.h"
+
+#include "update_flags.h"
+#include "static_core.h"
+#include "input.h"
+#include "output.h"
+#include "machine.h"
+#include "decode_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Native versions of invaders ROM routines, see hle.h.
+//
+// Each one does the same reads, writes, port accesses and flag updates as
+// the instructions it replaces, in the same order, and charges the same
+// cycles. Loops only run passes whose whole cost fits the budget and leave
+// PC on the loop head otherwise, so the interpreter (or the next hle_run,
+// the loop heads are entries too) picks up where they stopped. The RET at
+// the end of each routine is left to the core.
+
+// static_rom_hash of the invaders ROM these routines were written against
+#define HLE_ROM_HASH 0x3A10CF06u
+
+uint8_t hle_index[ROM_SIZE];
+uint32_t hle_mismatches;
+
+static HleMode hle_mode = HLE_ON;
+
+void hle_set_mode(HleMode mode) {
+    // The JIT leaves routine heads out of its blocks only while they run
+    if ((mode == HLE_OFF) != (hle_mode == HLE_OFF))
+        rom_generation++;
+    hle_mode = mode;
+}
+
+int hle_enabled(void) {
+    return hle_mode != HLE_OFF;
+}
+
+/*** Instruction helpers, same effects as the interpreter's ***/
+
+static void push(CPU *cpu, uint16_t value) {
+    Memory *mem = cpu_memory(cpu);
+    write_memory(mem, cpu->SP - 1, value >> 8);
+    write_memory(mem, cpu->SP - 2, value & 0xFF);
+    cpu->SP -= 2;
+}
+
+static uint16_t pop(CPU *cpu) {
+    Memory *mem = cpu_memory(cpu);
+    uint16_t value = read_memory(mem, cpu->SP) | (read_memory(mem, cpu->SP + 1) << 8);
+    cpu->SP += 2;
+    return value;
+}
+
+static void rar(CPU *cpu) {
+    uint8_t bit0 = cpu->A & 1;
+    cpu->A = (cpu->A >> 1) | ((get_flags(cpu) & FLAG_CY) << 7);
+    update_CY(cpu, bit0);
+}
+
+static void dcr_b(CPU *cpu) {
+    cpu->B--;
+    update_SZP(cpu, cpu->B);
+}
+
+/*** ClearScreen, 0x1A5C ***/
+
+// MVI M,0; INX H; MOV A,H; CPI 40; JNZ 1A5F
+#define CLEAR_PASS_CYCLES   (10 + 5 + 5 + 7 + 10)
+
+// The loop at 0x1A5F, one video RAM byte a pass until H reaches 0x40
+static uint32_t clear_screen_loop(CPU *cpu, uint32_t budget) {
+    Memory *mem = cpu_memory(cpu);
+    uint32_t used = 0;
+
+    while (used + CLEAR_PASS_CYCLES <= budget) {
+        write_memory(mem, cpu->HL, 0);
+        cpu->HL++;
+        cpu->A = cpu->H;
+        set_flags_arith(cpu, (uint16_t)cpu->A - 0x40, cpu->A, 0x40);
+        used += CLEAR_PASS_CYCLES;
+
+        if (cpu->A == 0x40) {
+            cpu->PC = 0x1A68;
+            break;
+        }
+    }
+    return used;
+}
+
+// LXI H,2400 then the loop
+static uint32_t clear_screen(CPU *cpu, uint32_t budget) {
+    if (budget < 10)
+        return 0;
+
+    cpu->HL = 0x2400;
+    cpu->PC = 0x1A5F;
+    return 10 + clear_screen_loop(cpu, budget - 10);
+}
+
+/*** BlockCopy, 0x1A32: B bytes from DE to HL ***/
+
+// LDAX D; MOV M,A; INX H; INX D; DCR B; JNZ 1A32
+#define COPY_PASS_CYCLES    (7 + 7 + 5 + 5 + 5 + 10)
+
+static uint32_t block_copy(CPU *cpu, uint32_t budget) {
+    Memory *mem = cpu_memory(cpu);
+    uint32_t used = 0;
+
+    while (used + COPY_PASS_CYCLES <= budget) {
+        cpu->A = read_memory(mem, cpu->DE);
+        write_memory(mem, cpu->HL, cpu->A);
+        cpu->HL++;
+        cpu->DE++;
+        dcr_b(cpu);
+        used += COPY_PASS_CYCLES;
+
+        if (!cpu->B) {
+            cpu->PC = 0x1A3A;
+            break;
+        }
+    }
+    return used;
+}
+
+/*** DrawShiftedSprite 0x1400, EraseShiftedSprite 0x1452 ***/
+
+// CALL 1474; MOV A,L; ANI 07; OUT 02; JMP 1A47; PUSH B; MVI B,3;
+// 3 x (MOV A,H; RAR; MOV H,A; MOV A,L; RAR; MOV L,A; DCR B; JNZ 1A4A);
+// MOV A,H; ANI 3F; ORI 20; MOV H,A; POP B; RET
+#define CNVT_CYCLES         (17 + 5 + 7 + 10 + 10 + 11 + 7 + 3 * (5 + 4 + 5 + 5 + 4 + 5 + 5 + 10) + \
+                             5 + 7 + 7 + 5 + 10 + 10)
+
+// PUSH B; PUSH H; 2 x (LDAX D or XRA A; OUT 04; IN 03; ORA M; MOV M,A) with
+// INX H; INX D between; POP H; LXI B,0020; DAD B; POP B; DCR B; JNZ.
+// Erasing adds a CMA before each ORA M, which becomes ANA M
+#define DRAW_ROW_CYCLES     (11 + 11 + 7 + 10 + 10 + 7 + 7 + 5 + 5 + 4 + 10 + 10 + 7 + 7 + \
+                             10 + 10 + 10 + 10 + 5 + 10)
+#define ERASE_ROW_CYCLES    (DRAW_ROW_CYCLES + 4 + 4)
+
+// CnvtPixNumber (0x1474) and the tail it jumps to (0x1A47): the pixel number
+// in HL becomes a screen address and its low 3 bits the shift amount
+static void cnvt_pix_number(CPU *cpu, uint16_t return_address) {
+    push(cpu, return_address);
+    cpu->A = cpu->L & 0x07;
+    set_flags_logic(cpu, cpu->A, 0);
+    machine_out(machine_of(cpu), 2, cpu->A);
+
+    push(cpu, cpu->BC);
+    cpu->B = 3;
+    do {
+        cpu->A = cpu->H;
+        rar(cpu);
+        cpu->H = cpu->A;
+        cpu->A = cpu->L;
+        rar(cpu);
+        cpu->L = cpu->A;
+        dcr_b(cpu);
+    } while (cpu->B);
+
+    cpu->A = cpu->H & 0x3F;
+    set_flags_logic(cpu, cpu->A, 0);
+    cpu->A |= 0x20;
+    set_flags_logic(cpu, cpu->A, get_flags(cpu) & FLAG_AC);
+    cpu->H = cpu->A;
+    cpu->BC = pop(cpu);
+    pop(cpu);
+}
+
+// IN 03 and the combine with the screen byte at HL
+static void sprite_byte(CPU *cpu, int erase) {
+    Memory *mem = cpu_memory(cpu);
+    cpu->A = machine_in(machine_of(cpu), 3);
+    if (erase) {
+        cpu->A = ~cpu->A & read_memory(mem, cpu->HL);
+        set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0);
+    } else {
+        cpu->A |= read_memory(mem, cpu->HL);
+        set_flags_logic(cpu, cpu->A, 0);
+    }
+    write_memory(mem, cpu->HL, cpu->A);
+}
+
+// The row loop, B rows of one sprite byte from DE each
+static uint32_t shifted_sprite_rows(CPU *cpu, uint32_t budget, int erase) {
+    Memory *mem = cpu_memory(cpu);
+    uint32_t pass = erase ? ERASE_ROW_CYCLES : DRAW_ROW_CYCLES;
+    uint32_t used = 0;
+
+    while (used + pass <= budget) {
+        push(cpu, cpu->BC);
+        push(cpu, cpu->HL);
+
+        cpu->A = read_memory(mem, cpu->DE);
+        machine_out(machine_of(cpu), 4, cpu->A);
+        sprite_byte(cpu, erase);
+        cpu->HL++;
+        cpu->DE++;
+        cpu->A = 0;
+        set_flags_logic(cpu, cpu->A, 0);
+        machine_out(machine_of(cpu), 4, cpu->A);
+        sprite_byte(cpu, erase);
+
+        cpu->HL = pop(cpu);
+        cpu->BC = 0x0020;
+        uint32_t result = (uint32_t)cpu->BC + (uint32_t)cpu->HL;
+        update_CY_16bit(cpu, result);
+        cpu->HL = (uint16_t)result;
+        cpu->BC = pop(cpu);
+        dcr_b(cpu);
+        used += pass;
+
+        if (!cpu->B) {
+            cpu->PC = erase ? 0x1473 : 0x1421;
+            break;
+        }
+    }
+    return used;
+}
+
+static uint32_t draw_sprite_rows(CPU *cpu, uint32_t budget) {
+    return shifted_sprite_rows(cpu, budget, 0);
+}
+
+static uint32_t erase_sprite_rows(CPU *cpu, uint32_t budget) {
+    return shifted_sprite_rows(cpu, budget, 1);
+}
+
+// NOP; CALL 1474; NOP; rows from 0x1405
+static uint32_t draw_shifted_sprite(CPU *cpu, uint32_t budget) {
+    uint32_t used = 4 + CNVT_CYCLES + 4;
+    if (budget < used)
+        return 0;
+
+    cnvt_pix_number(cpu, 0x1404);
+    cpu->PC = 0x1405;
+    return used + shifted_sprite_rows(cpu, budget - used, 0);
+}
+
+// CALL 1474; rows from 0x1455
+static uint32_t erase_shifted_sprite(CPU *cpu, uint32_t budget) {
+    if (budget < CNVT_CYCLES)
+        return 0;
+
+    cnvt_pix_number(cpu, 0x1455);
+    cpu->PC = 0x1455;
+    return CNVT_CYCLES + shifted_sprite_rows(cpu, budget - CNVT_CYCLES, 1);
+}
+
+/*** Registry ***/
+
+static const HleRoutine hle_routines[] = {
+    {0x1400, "DrawShiftedSprite",       draw_shifted_sprite},
+    {0x1405, "DrawShiftedSprite rows",  draw_sprite_rows},
+    {0x1452, "EraseShiftedSprite",      erase_shifted_sprite},
+    {0x1455, "EraseShiftedSprite rows", erase_sprite_rows},
+    {0x1A32, "BlockCopy",               block_copy},
+    {0x1A5C, "ClearScreen",             clear_screen},
+    {0x1A5F, "ClearScreen loop",        clear_screen_loop},
+};
+
+#define NUM_HLE_ROUTINES (sizeof(hle_routines) / sizeof(hle_routines[0]))
+
+void hle_install(const uint8_t *rom) {
+    memset(hle_index, 0, sizeof(hle_index));
+
+    if (static_rom_hash(rom) != HLE_ROM_HASH)
+        return;
+
+    for (unsigned i = 0; i < NUM_HLE_ROUTINES; i++)
+        hle_index[hle_routines[i].pc] = i + 1;
+}
+
+/*** Verify mode ***/
+
+static int same_registers(CPU *a, CPU *b) {
+    return a->A == b->A && get_flags(a) == get_flags(b) && a->BC == b->BC && a->DE == b->DE &&
+           a->HL == b->HL && a->SP == b->SP && a->PC == b->PC &&
+           a->interrupts_enabled == b->interrupts_enabled;
+}
+
+// Runs the routine natively on a scratch clone of the machine, then the
+// machine itself through the switch core for as many cycles. Only the
+// interpreter's run touches the machine, so watch hooks, dirty bits and
+// the write journal see each write once, as with HLE off.
+static uint32_t hle_verify(CPU *cpu, const HleRoutine *routine, uint32_t budget) {
+    Machine *machine = machine_of(cpu);
+    Machine *scratch = machine_create();
+    uint8_t ram_native[RAM_SIZE], ram[RAM_SIZE];
+
+    machine_clone(scratch, machine);
+    scratch->sound.play = NULL;
+    memory_set_watch(&scratch->memory, NULL);
+    memory_clear_page_attrs(&scratch->memory, RAM_START, RAM_END, PAGE_WATCHED | PAGE_TRACKED);
+
+    CPU *native = &scratch->cpu;
+    uint32_t native_cycles = routine->run(native, budget);
+    if (!native_cycles) {
+        machine_destroy(scratch);
+        return 0;
+    }
+    memory_get_ram(&scratch->memory, 0, ram_native, RAM_SIZE);
+
+    uint32_t cycles = 0;
+    while (cycles < native_cycles)
+        cycles += cpu_execute_instruction(cpu);
+    memory_get_ram(&machine->memory, 0, ram, RAM_SIZE);
+
+    if (cycles != native_cycles || !same_registers(cpu, native) ||
+        memcmp(&machine->ports, &scratch->ports, sizeof(Ports)) || memcmp(ram, ram_native, RAM_SIZE)) {
+        hle_mismatches++;
+        printf("HLE %s at %04X: native %u cycles PC=%04X A=%02X F=%02X BC=%04X DE=%04X HL=%04X SP=%04X, "
+               "interpreter %u cycles PC=%04X A=%02X F=%02X BC=%04X DE=%04X HL=%04X SP=%04X%s\n",
+               routine->name, routine->pc,
+               native_cycles, native->PC, native->A, get_flags(native), native->BC, native->DE, native->HL, native->SP,
+               cycles, cpu->PC, cpu->A, get_flags(cpu), cpu->BC, cpu->DE, cpu->HL, cpu->SP,
+               memcmp(ram, ram_native, RAM_SIZE) ? ", memory differs" : "");
+    }
+    machine_destroy(scratch);
+    return cycles;
+}
+
+uint32_t hle_run(CPU *cpu, uint32_t cycles, uint32_t limit) {
+    const HleRoutine *routine = &hle_routines[hle_index[cpu->PC] - 1];
+
+    if (hle_mode == HLE_OFF || cycles >= limit)
+        return 0;
+    if (hle_mode == HLE_VERIFY)
+        return hle_verify(cpu, routine, limit - cycles);
+    return routine->run(cpu, limit - cycles);
+}
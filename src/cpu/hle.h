@@ -0,0 +1,62 @@
+#ifndef HLE_H
+#define HLE_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "memory.h"
+
+// High-level emulation of hot invaders ROM routines.
+//
+// hle.c holds native versions of the screen clear, the block copy and the
+// shift-register sprite draw/erase, keyed by the ROM address they start at.
+// When a core reaches one of them it calls hle_run instead of interpreting:
+// the native code leaves RAM, registers, flags, ports and the cycle count
+// exactly as the instructions would, and stops on an instruction boundary
+// when the cycle limit comes first, like the JIT's whole-block rule.
+
+typedef enum {
+    HLE_OFF,        // Interpret everything
+    HLE_ON,         // Run the native routines
+    HLE_VERIFY      // Run both, compare, and carry on from the interpreter's state
+} HleMode;
+
+/**
+ * One native routine
+ *
+ * @param pc    ROM address it replaces from
+ * @param name  Label used by the verify mode
+ * @param run   Native code, called with cpu->PC == pc and the cycles left
+ *              before the limit; returns the cycles it used, 0 when it
+ *              did nothing (PC unchanged), and leaves PC where the
+ *              interpreter would be after that many cycles
+ */
+typedef struct {
+    uint16_t pc;
+    const char *name;
+    uint32_t (*run)(CPU *cpu, uint32_t budget);
+} HleRoutine;
+
+// 1 + index into the routine table for each ROM address, 0 if none
+extern uint8_t hle_index[ROM_SIZE];
+
+// Routines whose verify-mode run did not match the interpreter
+extern uint32_t hle_mismatches;
+
+void hle_set_mode(HleMode mode);
+
+// Nonzero unless the mode is HLE_OFF
+int hle_enabled(void);
+
+// Called from decode_cache_build, only marks routines when the ROM is the one they were written for
+void hle_install(const uint8_t *rom);
+
+/**
+ * Runs the routine at cpu->PC, for a core that found hle_index[cpu->PC] set
+ *
+ * @param cycles  Cycles used so far in this run call
+ * @param limit   Cycles the run call stops at
+ * @return        Cycles used, 0 if the core should run the instruction itself
+ */
+uint32_t hle_run(CPU *cpu, uint32_t cycles, uint32_t limit);
+
+#endif
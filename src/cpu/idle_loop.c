@@ -0,0 +1,144 @@
+#include "idle_loop.h"
+#include "decode_cache.h"
+
+#include <stdint.h>
+#include <string.h>
+
+uint8_t idle_loop_cycles[ROM_SIZE];
+
+// Longest loop body looked at, the ROM's wait loops are a handful of bytes
+#define IDLE_LOOP_MAX_BYTES 16
+
+// Registers as bits, in the 8080's register field order (M has no bit)
+enum {
+    REG_B = 1 << 0, REG_C = 1 << 1, REG_D = 1 << 2, REG_E = 1 << 3,
+    REG_H = 1 << 4, REG_L = 1 << 5, REG_A = 1 << 7, REG_F = 1 << 8
+};
+
+#define REG_BC  (REG_B | REG_C)
+#define REG_DE  (REG_D | REG_E)
+#define REG_HL  (REG_H | REG_L)
+
+// Register read by a source field, M reads through HL
+static uint16_t source_reg(uint8_t field) {
+    return field == 6 ? REG_HL : 1 << field;
+}
+
+/**
+ * Registers an instruction allowed in an idle loop body reads and writes
+ *
+ * Flags count as one register, read by every op that keeps some of them.
+ *
+ * @return 0 for anything that writes memory, touches SP or a port, or branches
+ */
+static int body_effects(uint8_t opcode, uint16_t *reads, uint16_t *writes) {
+    uint8_t dst = (opcode >> 3) & 7;
+    uint8_t src = opcode & 7;
+    static const uint16_t pairs[3] = {REG_BC, REG_DE, REG_HL};
+
+    *reads = *writes = 0;
+
+    if (opcode >= 0x40 && opcode <= 0x7F) {                     // MOV, not HLT or MOV M,r
+        if (opcode == 0x76 || dst == 6)
+            return 0;
+        *reads = source_reg(src);
+        *writes = 1 << dst;
+        return 1;
+    }
+    if (opcode >= 0x80 && opcode <= 0xBF) {                     // ADD ... CMP
+        *reads = source_reg(src) | REG_A | (dst == 1 || dst == 3 ? REG_F : 0);
+        *writes = (dst == 7 ? 0 : REG_A) | REG_F;
+        return 1;
+    }
+    if ((opcode & 0xC7) == 0xC6) {                              // ADI ... CPI, ACI/SBI/ORI keep flags
+        *reads = REG_A | (dst == 1 || dst == 3 || dst == 6 ? REG_F : 0);
+        *writes = (dst == 7 ? 0 : REG_A) | REG_F;
+        return 1;
+    }
+    if (opcode < 0x40 && (opcode & 0x07) == 0x06 && dst != 6) { // MVI r
+        *writes = 1 << dst;
+        return 1;
+    }
+    if (opcode < 0x40 && (opcode & 0x06) == 0x04 && dst != 6) { // INR/DCR r, keep CY and AC
+        *reads = (1 << dst) | REG_F;
+        *writes = (1 << dst) | REG_F;
+        return 1;
+    }
+    if (opcode < 0x30) {
+        uint16_t pair = pairs[opcode >> 4];
+        switch (opcode & 0x0F) {
+            case 0x01:                                          // LXI
+                *writes = pair;
+                return 1;
+            case 0x03: case 0x0B:                               // INX, DCX
+                *reads = *writes = pair;
+                return 1;
+            case 0x09:                                          // DAD, keeps all but CY
+                *reads = pair | REG_HL | REG_F;
+                *writes = REG_HL | REG_F;
+                return 1;
+        }
+    }
+
+    switch (opcode) {
+        case 0x00: case 0x08: case 0x10: case 0x18:             // NOP
+        case 0x20: case 0x28: case 0x30: case 0x38:
+            return 1;
+        case 0x0A: *reads = REG_BC; *writes = REG_A; return 1;  // LDAX B
+        case 0x1A: *reads = REG_DE; *writes = REG_A; return 1;  // LDAX D
+        case 0x2A: *writes = REG_HL; return 1;                  // LHLD
+        case 0x3A: *writes = REG_A; return 1;                   // LDA
+        case 0x2F: *reads = *writes = REG_A; return 1;          // CMA
+        case 0x07: case 0x0F: case 0x17: case 0x1F:             // RLC, RRC, RAL, RAR
+            *reads = *writes = REG_A | REG_F;
+            return 1;
+        case 0x37: case 0x3F:                                   // STC, CMC
+            *reads = *writes = REG_F;
+            return 1;
+        case 0xEB:                                              // XCHG
+            *reads = *writes = REG_DE | REG_HL;
+            return 1;
+    }
+    return 0;
+}
+
+// Cycles of one pass if the loop at head is idle, 0 otherwise
+static uint32_t idle_loop_at(const uint8_t *rom, uint32_t head) {
+    uint16_t read_first = 0;    // Read before anything in the body wrote them
+    uint16_t written = 0;
+    uint32_t pass = 0;
+
+    for (uint32_t pc = head; pc < head + IDLE_LOOP_MAX_BYTES; ) {
+        uint8_t opcode = rom[pc];
+        uint16_t reads, writes;
+
+        // Operands spilling into RAM can change, see decode_cache_build
+        if (pc + opcode_lengths[opcode] > ROM_SIZE)
+            return 0;
+
+        pass += opcode_cycles[opcode];
+
+        if (opcode == 0xC3 || (opcode & 0xC7) == 0xC2) {        // JMP, Jcc
+            uint16_t target = rom[pc + 1] | (rom[pc + 2] << 8);
+            if (target != head)
+                return 0;
+            if (opcode != 0xC3)
+                read_first |= REG_F & ~written;
+            return (read_first & written) || pass > UINT8_MAX ? 0 : pass;
+        }
+
+        if (!body_effects(opcode, &reads, &writes))
+            return 0;
+        read_first |= reads & ~written;
+        written |= writes;
+        pc += opcode_lengths[opcode];
+    }
+    return 0;
+}
+
+void idle_loop_find(const uint8_t *rom) {
+    memset(idle_loop_cycles, 0, sizeof(idle_loop_cycles));
+
+    for (uint32_t pc = 0; pc < ROM_SIZE; pc++)
+        idle_loop_cycles[pc] = (uint8_t)idle_loop_at(rom, pc);
+}
@@ -0,0 +1,54 @@
+#ifndef IDLE_LOOP_H
+#define IDLE_LOOP_H
+
+#include <stdint.h>
+#include "memory.h"
+
+// Idle loops: ROM loops that spin on a RAM flag until an interrupt changes it.
+//
+// idle_loop_find marks the head of every small loop that runs straight down to
+// a jump back to its head, writes no memory, does no port I/O and leaves every
+// register it reads before writing alone. With memory unchanged, each pass
+// then ends in exactly the state the previous one did, so once a core sees one
+// full pass nothing can change until main.c raises the next interrupt between
+// run calls. The cores skip the remaining whole passes and charge their cycles.
+
+// Cycles of one pass through the idle loop starting at each ROM address, 0 if none
+extern uint8_t idle_loop_cycles[ROM_SIZE];
+
+// Called from decode_cache_build once the ROM is decoded
+void idle_loop_find(const uint8_t *rom);
+
+// Last loop head a core reached, local to one run call since interrupts only
+// happen between calls
+typedef struct {
+    uint16_t pc;        // ROM_SIZE when none yet
+    uint32_t cycles;    // Run-call cycle count it was reached at
+} IdleWatch;
+
+#define IDLE_WATCH_INIT     { ROM_SIZE, 0 }
+
+/**
+ * Called by a core about to run the instruction at the idle loop head pc
+ *
+ * @param watch   The core's IdleWatch for this run call
+ * @param cycles  Cycles used so far in this run call
+ * @param limit   Cycles the run call stops at
+ * @return        Cycles of the whole passes skipped, the core adds them and
+ *                carries on at pc; the pass left over runs normally so the
+ *                call ends on the same instruction it would have
+ */
+static inline uint32_t idle_loop_skip(IdleWatch *watch, uint16_t pc, uint32_t cycles, uint32_t limit) {
+    uint32_t pass = idle_loop_cycles[pc];
+    uint32_t skipped = 0;
+
+    // Straight-line body: back at the head one pass later means it went round
+    if (watch->pc == pc && cycles - watch->cycles == pass && cycles < limit)
+        skipped = (limit - cycles - 1) / pass * pass;
+
+    watch->pc = pc;
+    watch->cycles = cycles + skipped;
+    return skipped;
+}
+
+#endif
@@ -0,0 +1,1204 @@
+#include "cpu.h"
+
+#include "memory.h"
+#include "decode_cache.h"
+#include "idle_loop.h"
+#include "hle.h"
+#include "loop_idiom.h"
+#include "update_flags.h"
+#include "utils.h"
+#include "machine.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// x86-64 dynamic recompiler for ROM basic blocks.
+//
+// A block is a straight run of ROM instructions ending at the first jump,
+// call, return or instruction the JIT does not handle. While a block runs
+// the 8080 registers stay in host registers:
+//
+//     r12  CPU*           rbx  A
+//     r13  BC             rbp  SP
+//     r14  DE             r15  HL
+//
+// F stays in the CPU struct and is kept up to date: ALU ops, INR/DCR,
+// rotates and DAD build it from szp_table and ac_table the way
+// set_flags_arith and set_flags_logic do, and conditions test it in place.
+// With CPU_LAZY_FLAGS a pending flag record is folded into F on entry and
+// after every interpreted instruction, so generated code never sees one.
+//
+// Everything but IN, DAA, XTHL, HLT and the undocumented duplicates is
+// emitted natively. Those spill the registers and run through the threaded
+// core one instruction at a time. Memory goes through read_memory and
+// write_memory, so watch hooks, copy-on-write and the journal all see it.
+//
+// Block exits to a fixed target are linked lazily: the exit jumps to a stub
+// that returns to cpu_run_jit, which compiles the target and patches the
+// exit into a direct jmp to the target block. Loading a ROM bumps
+// rom_generation (decode_cache.h), which throws every block away.
+//
+// Interrupts are raised by main.c between calls, so blocks only need to
+// leave at their boundaries. A block is only entered when its whole cycle
+// cost fits the remaining budget; the tail of a budget is finished by the
+// threaded core, which keeps interrupt timing identical to the interpreter.
+//
+// The code buffer is never writable and executable at once: it is flipped to
+// read-write while blocks are compiled or exits patched, and back to
+// read-execute before generated code runs.
+//
+// Only built for System V x86-64 hosts, everything else falls back to the
+// threaded core.
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+#include <sys/mman.h>
+
+#ifndef JIT_CODE_SIZE
+#define JIT_CODE_SIZE       (1 << 20)   // 1 MB of generated code before a flush
+#endif
+#define JIT_MAX_BLOCK_OPS   64          // Instructions per block
+#define JIT_MAX_BLOCK_BYTES 16384       // Worst case generated bytes per block, 256 per op
+
+// Host registers
+enum {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+#define REG_CPU R12
+#define REG_A   RBX
+#define REG_BC  R13
+#define REG_DE  R14
+#define REG_HL  R15
+#define REG_SP  RBP
+
+// Stack frame of jit_enter, rsp relative
+#define FRAME_EXIT      0   // JitExit* for the caller
+#define FRAME_BUDGET    8   // Remaining cycles, int64
+#define FRAME_NEXT_PC   16  // PC to leave with, dword
+#define FRAME_SCRATCH   20  // dword
+#define FRAME_CODE      24  // Block jit_enter jumps to, qword
+#define FRAME_SIZE      40  // Keeps rsp 16-byte aligned for helper calls
+
+// Why generated code returned to cpu_run_jit
+enum {
+    JIT_EXIT_DYNAMIC,   // Indirect branch, PC is set
+    JIT_EXIT_BUDGET,    // Next block does not fit the remaining cycles
+    JIT_EXIT_INTERPRET, // Next instruction must go through the interpreter
+    JIT_EXIT_LINK       // Fixed target not linked yet, patch holds the exit jmp
+};
+
+typedef struct {
+    int kind;
+    uint8_t *patch;
+} JitExit;
+
+typedef int64_t (*JitEnterFn)(CPU *cpu, int64_t budget, const uint8_t *code, JitExit *exit);
+
+// Each thread compiles into its own code buffer, so machines running on
+// different threads never share a block or patch each other's exits
+static _Thread_local uint8_t *code_buffer;
+static _Thread_local uint8_t *code_ptr;
+static _Thread_local uint8_t *common_exit;
+static _Thread_local uint8_t *runtime_end;
+static _Thread_local JitEnterFn jit_enter;
+static _Thread_local uint8_t *block_entry[ROM_SIZE];
+static _Thread_local uint32_t flush_count;
+static _Thread_local uint32_t code_generation;     // rom_generation the blocks were compiled from
+static _Thread_local int jit_unavailable;
+static _Thread_local int code_writable;
+
+/*** Encoder ***/
+
+static void emit8(uint8_t value) {
+    *code_ptr++ = value;
+}
+
+static void emit32(uint32_t value) {
+    memcpy(code_ptr, &value, 4);
+    code_ptr += 4;
+}
+
+static void emit64(uint64_t value) {
+    memcpy(code_ptr, &value, 8);
+    code_ptr += 8;
+}
+
+// force is needed to reach spl/bpl/sil/dil as byte registers
+static void emit_rex(int w, int reg, int rm, int force) {
+    uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+    if (rex != 0x40 || force)
+        emit8(rex);
+}
+
+static void emit_modrm_reg(int reg, int rm) {
+    emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// [base + disp32]
+static void emit_modrm_mem(int reg, int base, int32_t disp) {
+    emit8(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+        emit8(0x24);
+    emit32((uint32_t)disp);
+}
+
+static void emit_mov_rr32(int dst, int src) {
+    emit_rex(0, src, dst, 0);
+    emit8(0x89);
+    emit_modrm_reg(src, dst);
+}
+
+static void emit_mov_rr64(int dst, int src) {
+    emit_rex(1, src, dst, 0);
+    emit8(0x89);
+    emit_modrm_reg(src, dst);
+}
+
+static void emit_mov_ri32(int dst, uint32_t imm) {
+    emit_rex(0, 0, dst, 0);
+    emit8(0xB8 | (dst & 7));
+    emit32(imm);
+}
+
+static void emit_mov_ri64(int dst, uint64_t imm) {
+    emit_rex(1, 0, dst, 0);
+    emit8(0xB8 | (dst & 7));
+    emit64(imm);
+}
+
+static void emit_movzx_r32_r8(int dst, int src) {
+    emit_rex(0, dst, src, src >= 4);
+    emit8(0x0F);
+    emit8(0xB6);
+    emit_modrm_reg(dst, src);
+}
+
+static void emit_shift_ri(int ext, int dst, uint8_t imm) {
+    emit_rex(0, 0, dst, 0);
+    emit8(0xC1);
+    emit_modrm_reg(ext, dst);
+    emit8(imm);
+}
+
+#define emit_shl_ri(dst, imm) emit_shift_ri(4, dst, imm)
+#define emit_shr_ri(dst, imm) emit_shift_ri(5, dst, imm)
+
+static void emit_alu_ri(int ext, int dst, uint32_t imm) {
+    emit_rex(0, 0, dst, 0);
+    emit8(0x81);
+    emit_modrm_reg(ext, dst);
+    emit32(imm);
+}
+
+#define emit_add_ri(dst, imm) emit_alu_ri(0, dst, imm)
+#define emit_or_ri(dst, imm)  emit_alu_ri(1, dst, imm)
+#define emit_and_ri(dst, imm) emit_alu_ri(4, dst, imm)
+#define emit_sub_ri(dst, imm) emit_alu_ri(5, dst, imm)
+#define emit_xor_ri(dst, imm) emit_alu_ri(6, dst, imm)
+
+// Two-operand 32-bit ALU op, dst op= src
+enum {
+    ALU_ADD = 0x01,
+    ALU_OR  = 0x09,
+    ALU_AND = 0x21,
+    ALU_SUB = 0x29,
+    ALU_XOR = 0x31
+};
+
+static void emit_alu_rr32(uint8_t opcode, int dst, int src) {
+    emit_rex(0, src, dst, 0);
+    emit8(opcode);
+    emit_modrm_reg(src, dst);
+}
+
+static void emit_or_rr32(int dst, int src) {
+    emit_rex(0, src, dst, 0);
+    emit8(0x09);
+    emit_modrm_reg(src, dst);
+}
+
+static void emit_or_rm32(int dst, int base, int32_t disp) {
+    emit_rex(0, dst, base, 0);
+    emit8(0x0B);
+    emit_modrm_mem(dst, base, disp);
+}
+
+static void emit_store8(int base, int32_t disp, int src) {
+    emit_rex(0, src, base, src >= 4);
+    emit8(0x88);
+    emit_modrm_mem(src, base, disp);
+}
+
+static void emit_store16(int base, int32_t disp, int src) {
+    emit8(0x66);
+    emit_rex(0, src, base, 0);
+    emit8(0x89);
+    emit_modrm_mem(src, base, disp);
+}
+
+static void emit_store32(int base, int32_t disp, int src) {
+    emit_rex(0, src, base, 0);
+    emit8(0x89);
+    emit_modrm_mem(src, base, disp);
+}
+
+static void emit_store64(int base, int32_t disp, int src) {
+    emit_rex(1, src, base, 0);
+    emit8(0x89);
+    emit_modrm_mem(src, base, disp);
+}
+
+static void emit_load_zx8(int dst, int base, int32_t disp) {
+    emit_rex(0, dst, base, 0);
+    emit8(0x0F);
+    emit8(0xB6);
+    emit_modrm_mem(dst, base, disp);
+}
+
+// movzx dst, byte [base + index]; base must not be rbp or r13
+static void emit_load_zx8_indexed(int dst, int base, int index) {
+    uint8_t rex = 0x40 | ((dst & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0);
+    if (rex != 0x40)
+        emit8(rex);
+    emit8(0x0F);
+    emit8(0xB6);
+    emit8(((dst & 7) << 3) | 4);
+    emit8(((index & 7) << 3) | (base & 7));
+}
+
+static void emit_load_zx16(int dst, int base, int32_t disp) {
+    emit_rex(0, dst, base, 0);
+    emit8(0x0F);
+    emit8(0xB7);
+    emit_modrm_mem(dst, base, disp);
+}
+
+static void emit_load32(int dst, int base, int32_t disp) {
+    emit_rex(0, dst, base, 0);
+    emit8(0x8B);
+    emit_modrm_mem(dst, base, disp);
+}
+
+static void emit_load64(int dst, int base, int32_t disp) {
+    emit_rex(1, dst, base, 0);
+    emit8(0x8B);
+    emit_modrm_mem(dst, base, disp);
+}
+
+static void emit_store_imm32(int base, int32_t disp, uint32_t imm) {
+    emit_rex(0, 0, base, 0);
+    emit8(0xC7);
+    emit_modrm_mem(0, base, disp);
+    emit32(imm);
+}
+
+// cmp/sub qword [base + disp], imm32
+static void emit_alu_m64_imm(int ext, int base, int32_t disp, uint32_t imm) {
+    emit_rex(1, 0, base, 0);
+    emit8(0x81);
+    emit_modrm_mem(ext, base, disp);
+    emit32(imm);
+}
+
+static void emit_test_m8_imm(int base, int32_t disp, uint8_t imm) {
+    emit_rex(0, 0, base, 0);
+    emit8(0xF6);
+    emit_modrm_mem(0, base, disp);
+    emit8(imm);
+}
+
+static void emit_push(int reg) {
+    emit_rex(0, 0, reg, 0);
+    emit8(0x50 | (reg & 7));
+}
+
+static void emit_pop(int reg) {
+    emit_rex(0, 0, reg, 0);
+    emit8(0x58 | (reg & 7));
+}
+
+static void emit_call_abs(const void *fn) {
+    emit_mov_ri64(RAX, (uint64_t)(uintptr_t)fn);
+    emit8(0xFF);
+    emit_modrm_reg(2, RAX);
+}
+
+static void emit_jmp_reg(int reg) {
+    emit_rex(0, 0, reg, 0);
+    emit8(0xFF);
+    emit_modrm_reg(4, reg);
+}
+
+// Returns the address of the rel32 to patch
+static uint8_t *emit_jmp_rel32(const uint8_t *target) {
+    emit8(0xE9);
+    uint8_t *rel = code_ptr;
+    emit32((uint32_t)(target - (code_ptr + 4)));
+    return rel;
+}
+
+static uint8_t *emit_jcc_rel32(uint8_t cc, const uint8_t *target) {
+    emit8(0x0F);
+    emit8(0x80 | cc);
+    uint8_t *rel = code_ptr;
+    emit32((uint32_t)(target - (code_ptr + 4)));
+    return rel;
+}
+
+static void patch_rel32(uint8_t *rel, const uint8_t *target) {
+    int32_t value = (int32_t)(target - (rel + 4));
+    memcpy(rel, &value, 4);
+}
+
+#define CC_Z  0x4
+#define CC_NZ 0x5
+
+/*** 8080 register access ***/
+
+// Zero-extended 8080 register into dst
+static void emit_get_reg8(int dst, char reg) {
+    switch (reg) {
+        case 'A': emit_mov_rr32(dst, REG_A); break;
+        case 'B': emit_mov_rr32(dst, REG_BC); emit_shr_ri(dst, 8); break;
+        case 'C': emit_movzx_r32_r8(dst, REG_BC); break;
+        case 'D': emit_mov_rr32(dst, REG_DE); emit_shr_ri(dst, 8); break;
+        case 'E': emit_movzx_r32_r8(dst, REG_DE); break;
+        case 'H': emit_mov_rr32(dst, REG_HL); emit_shr_ri(dst, 8); break;
+        case 'L': emit_movzx_r32_r8(dst, REG_HL); break;
+    }
+}
+
+// al into an 8080 register, clobbers eax
+static void emit_set_reg8(char reg) {
+    int pair = (reg == 'B' || reg == 'C') ? REG_BC :
+               (reg == 'D' || reg == 'E') ? REG_DE : REG_HL;
+
+    if (reg == 'A') {
+        emit_movzx_r32_r8(REG_A, RAX);
+        return;
+    }
+    emit_movzx_r32_r8(RAX, RAX);
+    if (reg == 'B' || reg == 'D' || reg == 'H') {
+        emit_shl_ri(RAX, 8);
+        emit_and_ri(pair, 0x00FF);
+    } else {
+        emit_and_ri(pair, 0xFF00);
+    }
+    emit_or_rr32(pair, RAX);
+}
+
+// Host registers back into the CPU struct
+static void emit_spill(void) {
+    emit_store8(REG_CPU, offsetof(CPU, A), REG_A);
+    emit_store16(REG_CPU, offsetof(CPU, BC), REG_BC);
+    emit_store16(REG_CPU, offsetof(CPU, DE), REG_DE);
+    emit_store16(REG_CPU, offsetof(CPU, HL), REG_HL);
+    emit_store16(REG_CPU, offsetof(CPU, SP), REG_SP);
+}
+
+static void emit_reload(void) {
+    emit_load_zx8(REG_A, REG_CPU, offsetof(CPU, A));
+    emit_load_zx16(REG_BC, REG_CPU, offsetof(CPU, BC));
+    emit_load_zx16(REG_DE, REG_CPU, offsetof(CPU, DE));
+    emit_load_zx16(REG_HL, REG_CPU, offsetof(CPU, HL));
+    emit_load_zx16(REG_SP, REG_CPU, offsetof(CPU, SP));
+}
+
+/*** Memory access through jit_read/jit_write ***/
+
+// Called from generated code with the address in edi and the CPU, which
+// sits at the start of its Machine, after the other arguments
+static uint8_t jit_read(uint16_t address, CPU *cpu) {
+    return read_memory(cpu_memory(cpu), address);
+}
+
+static void jit_write(uint16_t address, uint8_t value, CPU *cpu) {
+    write_memory(cpu_memory(cpu), address, value);
+}
+
+// edi = (reg + delta) & 0xFFFF
+static void emit_address(int reg, int delta) {
+    emit_mov_rr32(RDI, reg);
+    if (delta) {
+        emit_add_ri(RDI, (uint32_t)delta);
+        emit_and_ri(RDI, 0xFFFF);
+    }
+}
+
+// Result zero-extended in eax
+static void emit_read_memory(void) {
+    emit_mov_rr64(RSI, REG_CPU);
+    emit_call_abs((const void *)jit_read);
+    emit_movzx_r32_r8(RAX, RAX);
+}
+
+// Value already in esi
+static void emit_write_memory(void) {
+    emit_mov_rr64(RDX, REG_CPU);
+    emit_call_abs((const void *)jit_write);
+}
+
+/*** Flags, kept in CPU.F ***/
+
+static void emit_load_flags(int dst) {
+    emit_load_zx8(dst, REG_CPU, offsetof(CPU, F));
+}
+
+// Low byte of src into F
+static void emit_store_flags(int src) {
+    emit_store8(REG_CPU, offsetof(CPU, F), src);
+}
+
+// dst = table[index], index zero-extended; clobbers r8
+static void emit_table_lookup(int dst, const uint8_t *table, int index) {
+    emit_mov_ri64(R8, (uint64_t)(uintptr_t)table);
+    emit_load_zx8_indexed(dst, R8, index);
+}
+
+// set_flags_arith: edx holds the result (bit 8 the carry or borrow), ecx the
+// operand and a the accumulator AC is taken from. Clobbers eax, esi, edi.
+static void emit_flags_arith(int a) {
+    emit_mov_rr32(RDI, a);
+    emit_and_ri(RDI, 0x0F);
+    emit_shl_ri(RDI, 4);
+    emit_mov_rr32(RSI, RCX);
+    emit_and_ri(RSI, 0x0F);
+    emit_alu_rr32(ALU_OR, RDI, RSI);
+    emit_table_lookup(RDI, ac_table, RDI);
+
+    emit_movzx_r32_r8(RAX, RDX);
+    emit_table_lookup(RAX, szp_table, RAX);
+    emit_alu_rr32(ALU_OR, RAX, RDI);
+    emit_mov_rr32(RSI, RDX);
+    emit_shr_ri(RSI, 8);
+    emit_and_ri(RSI, FLAG_CY);
+    emit_alu_rr32(ALU_OR, RAX, RSI);
+    emit_store_flags(RAX);
+}
+
+// set_flags_logic on A: szp_table[A] and, by ac, nothing, A's bit 3 as AC
+// (ANA) or the AC already in F (ORI). Clobbers eax, edx.
+enum { AC_CLEAR, AC_FROM_BIT3, AC_KEPT };
+
+static void emit_flags_logic(int ac) {
+    emit_table_lookup(RAX, szp_table, REG_A);
+    if (ac == AC_FROM_BIT3) {
+        emit_mov_rr32(RDX, REG_A);
+        emit_and_ri(RDX, 0x08);
+        emit_shl_ri(RDX, 1);
+        emit_alu_rr32(ALU_OR, RAX, RDX);
+    } else if (ac == AC_KEPT) {
+        emit_load_flags(RDX);
+        emit_and_ri(RDX, FLAG_AC);
+        emit_alu_rr32(ALU_OR, RAX, RDX);
+    }
+    emit_store_flags(RAX);
+}
+
+// update_SZP for the byte in ecx: CY and AC kept. Clobbers eax, edx.
+static void emit_flags_szp(void) {
+    emit_load_flags(RDX);
+    emit_and_ri(RDX, FLAG_CY | FLAG_AC);
+    emit_table_lookup(RAX, szp_table, RCX);
+    emit_alu_rr32(ALU_OR, RAX, RDX);
+    emit_store_flags(RAX);
+}
+
+// update_CY from bit 0 of carry, the other flags kept. Clobbers edx.
+static void emit_flags_carry(int carry) {
+    emit_load_flags(RDX);
+    emit_and_ri(RDX, (uint8_t)~FLAG_CY);
+    emit_alu_rr32(ALU_OR, RDX, carry);
+    emit_store_flags(RDX);
+}
+
+/*** Exits ***/
+
+static void emit_exit(int kind) {
+    emit_mov_ri32(RCX, kind);
+    emit_jmp_rel32(common_exit);
+}
+
+static void emit_exit_at(int kind, uint16_t pc) {
+    emit_store_imm32(RSP, FRAME_NEXT_PC, pc);
+    emit_exit(kind);
+}
+
+// Exit to a fixed PC, a direct jmp once cpu_run_jit has linked it
+static void emit_exit_linked(uint16_t target) {
+    uint8_t *jmp = code_ptr;
+    emit_jmp_rel32(code_ptr + 5);
+
+    emit_store_imm32(RSP, FRAME_NEXT_PC, target);
+    emit_mov_ri64(RAX, (uint64_t)(uintptr_t)jmp);
+    emit_exit(JIT_EXIT_LINK);
+}
+
+/*** Instruction emitters ***/
+
+static const char reg_names[8] = {'B', 'C', 'D', 'E', 'H', 'L', 'M', 'A'};
+static const int pair_regs[4] = {REG_BC, REG_DE, REG_HL, REG_SP};
+
+// Folds a pending lazy flag record into F; only callee-saved registers are live
+static void emit_resolve_flags(void) {
+    if (CPU_LAZY_FLAGS) {
+        emit_mov_rr64(RDI, REG_CPU);
+        emit_call_abs((const void *)cpu_get_flags);
+    }
+}
+
+// Run one instruction through the threaded core
+static void emit_interpret(uint16_t pc) {
+    emit_spill();
+    emit_mov_ri32(RAX, pc);
+    emit_store16(REG_CPU, offsetof(CPU, PC), RAX);
+    emit_mov_rr64(RDI, REG_CPU);
+    emit_mov_ri32(RSI, 1);
+    emit_call_abs((const void *)cpu_run_threaded);
+    emit_resolve_flags();
+    emit_reload();
+}
+
+// Flag test for condition code cc (bits 3-5 of the opcode), leaves the jcc
+// that is taken when the condition holds
+static uint8_t *emit_condition(uint8_t opcode) {
+    int cc = (opcode >> 3) & 7;
+    static const uint8_t masks[4] = {FLAG_Z, FLAG_CY, FLAG_P, FLAG_S};
+
+    emit_test_m8_imm(REG_CPU, offsetof(CPU, F), masks[cc >> 1]);
+    return emit_jcc_rel32((cc & 1) ? CC_NZ : CC_Z, code_ptr);
+}
+
+static void emit_call(uint16_t target, uint16_t return_address) {
+    emit_address(REG_SP, -1);
+    emit_mov_ri32(RSI, return_address >> 8);
+    emit_write_memory();
+    emit_address(REG_SP, -2);
+    emit_mov_ri32(RSI, return_address & 0xFF);
+    emit_write_memory();
+    emit_add_ri(REG_SP, (uint32_t)-2);
+    emit_and_ri(REG_SP, 0xFFFF);
+    emit_exit_linked(target);
+}
+
+// ADD/ADC/SUB/SBB/ANA/XRA/ORA/CMP by bits 3-5 of the opcode, the operand in
+// ecx. ADI and ACI take AC from the new A, as the interpreters do.
+static void emit_alu(uint8_t op, int immediate) {
+    int kind = (op >> 3) & 7;
+
+    switch (kind) {
+        case 0: case 1: case 2: case 3: case 7: {
+            int subtract = kind >= 2;
+
+            emit_mov_rr32(RDX, REG_A);
+            emit_alu_rr32(subtract ? ALU_SUB : ALU_ADD, RDX, RCX);
+            if (kind == 1 || kind == 3) {
+                emit_load_flags(RAX);
+                emit_and_ri(RAX, FLAG_CY);
+                emit_alu_rr32(subtract ? ALU_SUB : ALU_ADD, RDX, RAX);
+            }
+            if (immediate && !subtract) {
+                emit_movzx_r32_r8(REG_A, RDX);
+                emit_flags_arith(REG_A);
+            } else {
+                emit_flags_arith(REG_A);
+                if (kind != 7)
+                    emit_movzx_r32_r8(REG_A, RDX);
+            }
+            break;
+        }
+        case 4:
+            emit_alu_rr32(ALU_AND, REG_A, RCX);
+            emit_flags_logic(immediate ? AC_CLEAR : AC_FROM_BIT3);
+            break;
+        case 5:
+            emit_alu_rr32(ALU_XOR, REG_A, RCX);
+            emit_flags_logic(AC_CLEAR);
+            break;
+        case 6:
+            emit_alu_rr32(ALU_OR, REG_A, RCX);
+            emit_flags_logic(immediate ? AC_KEPT : AC_CLEAR);
+            break;
+    }
+}
+
+// INR/DCR r or M
+static void emit_inr_dcr(uint8_t op) {
+    char reg = reg_names[(op >> 3) & 7];
+
+    if (reg == 'M') {
+        emit_address(REG_HL, 0);
+        emit_read_memory();
+        emit_mov_rr32(RCX, RAX);
+    } else {
+        emit_get_reg8(RCX, reg);
+    }
+    emit_add_ri(RCX, (op & 1) ? (uint32_t)-1 : 1);
+    emit_and_ri(RCX, 0xFF);
+    emit_flags_szp();
+
+    if (reg == 'M') {
+        emit_mov_rr32(RSI, RCX);
+        emit_address(REG_HL, 0);
+        emit_write_memory();
+    } else {
+        emit_mov_rr32(RAX, RCX);
+        emit_set_reg8(reg);
+    }
+}
+
+// RLC/RRC/RAL/RAR
+static void emit_rotate(uint8_t op) {
+    if (op == 0x17 || op == 0x1F) {
+        emit_load_flags(RCX);
+        emit_and_ri(RCX, FLAG_CY);
+    }
+    emit_mov_rr32(RAX, REG_A);
+    if (op == 0x07 || op == 0x17) {
+        emit_shr_ri(RAX, 7);
+        emit_shl_ri(REG_A, 1);
+        emit_alu_rr32(ALU_OR, REG_A, op == 0x07 ? RAX : RCX);
+    } else {
+        emit_and_ri(RAX, 1);
+        if (op == 0x0F) {
+            emit_mov_rr32(RCX, RAX);
+        }
+        emit_shl_ri(RCX, 7);
+        emit_shr_ri(REG_A, 1);
+        emit_alu_rr32(ALU_OR, REG_A, RCX);
+    }
+    emit_and_ri(REG_A, 0xFF);
+    emit_flags_carry(RAX);
+}
+
+// PUSH rp, or PUSH PSW for REG_A
+static void emit_push_pair(int pair) {
+    emit_address(REG_SP, -1);
+    emit_mov_rr32(RSI, pair);
+    if (pair != REG_A)
+        emit_shr_ri(RSI, 8);
+    emit_write_memory();
+    emit_address(REG_SP, -2);
+    if (pair == REG_A)
+        emit_load_flags(RSI);
+    else
+        emit_movzx_r32_r8(RSI, pair);
+    emit_write_memory();
+    emit_add_ri(REG_SP, (uint32_t)-2);
+    emit_and_ri(REG_SP, 0xFFFF);
+}
+
+// The byte at SP into FRAME_SCRATCH, the one above it into eax
+static void emit_pop_bytes(void) {
+    emit_address(REG_SP, 0);
+    emit_read_memory();
+    emit_store32(RSP, FRAME_SCRATCH, RAX);
+    emit_address(REG_SP, 1);
+    emit_read_memory();
+    emit_add_ri(REG_SP, 2);
+    emit_and_ri(REG_SP, 0xFFFF);
+}
+
+static void emit_ret(void) {
+    emit_address(REG_SP, 0);
+    emit_read_memory();
+    emit_store32(RSP, FRAME_SCRATCH, RAX);
+    emit_address(REG_SP, 1);
+    emit_read_memory();
+    emit_shl_ri(RAX, 8);
+    emit_or_rm32(RAX, RSP, FRAME_SCRATCH);
+    emit_store32(RSP, FRAME_NEXT_PC, RAX);
+    emit_add_ri(REG_SP, 2);
+    emit_and_ri(REG_SP, 0xFFFF);
+    emit_exit(JIT_EXIT_DYNAMIC);
+}
+
+// Emits one instruction. Returns 1 if it ended the block.
+static int emit_instruction(const DecodedInstruction *entry, uint16_t pc) {
+    uint8_t op = entry->opcode;
+    uint16_t next = pc + entry->length;
+
+    // MOV r, r' / MOV r, M / MOV M, r
+    if (op >= 0x40 && op <= 0x7F && op != 0x76) {
+        char dst = reg_names[(op >> 3) & 7];
+        char src = reg_names[op & 7];
+
+        if (src == 'M') {
+            emit_address(REG_HL, 0);
+            emit_read_memory();
+            emit_set_reg8(dst);
+        } else if (dst == 'M') {
+            emit_get_reg8(RSI, src);
+            emit_address(REG_HL, 0);
+            emit_write_memory();
+        } else if (dst != src) {
+            emit_get_reg8(RAX, src);
+            emit_set_reg8(dst);
+        }
+        return 0;
+    }
+
+    // ADD ... CMP r / M
+    if (op >= 0x80 && op <= 0xBF) {
+        char src = reg_names[op & 7];
+
+        if (src == 'M') {
+            emit_address(REG_HL, 0);
+            emit_read_memory();
+            emit_mov_rr32(RCX, RAX);
+        } else {
+            emit_get_reg8(RCX, src);
+        }
+        emit_alu(op, 0);
+        return 0;
+    }
+
+    switch (op) {
+        case 0x00: case 0x08: case 0x10: case 0x18:     // NOP
+        case 0x20: case 0x28: case 0x30: case 0x38:
+            return 0;
+
+        case 0x01: case 0x11: case 0x21: case 0x31:     // LXI rp, D16
+            emit_mov_ri32(pair_regs[op >> 4], entry->operand);
+            return 0;
+
+        case 0x03: case 0x13: case 0x23: case 0x33:     // INX rp
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B: {   // DCX rp
+            int pair = pair_regs[op >> 4];
+            emit_add_ri(pair, (op & 0x08) ? (uint32_t)-1 : 1);
+            emit_and_ri(pair, 0xFFFF);
+            return 0;
+        }
+
+        case 0x06: case 0x0E: case 0x16: case 0x1E:     // MVI r, D8
+        case 0x26: case 0x2E: case 0x3E:
+            emit_mov_ri32(RAX, entry->operand & 0xFF);
+            emit_set_reg8(reg_names[(op >> 3) & 7]);
+            return 0;
+
+        case 0x36:                                      // MVI M, D8
+            emit_mov_ri32(RSI, entry->operand & 0xFF);
+            emit_address(REG_HL, 0);
+            emit_write_memory();
+            return 0;
+
+        case 0x02: case 0x12:                           // STAX B / STAX D
+            emit_mov_rr32(RSI, REG_A);
+            emit_address(op == 0x02 ? REG_BC : REG_DE, 0);
+            emit_write_memory();
+            return 0;
+
+        case 0x0A: case 0x1A:                           // LDAX B / LDAX D
+            emit_address(op == 0x0A ? REG_BC : REG_DE, 0);
+            emit_read_memory();
+            emit_mov_rr32(REG_A, RAX);
+            return 0;
+
+        case 0x32:                                      // STA adr
+            emit_mov_rr32(RSI, REG_A);
+            emit_mov_ri32(RDI, entry->operand);
+            emit_write_memory();
+            return 0;
+
+        case 0x3A:                                      // LDA adr
+            emit_mov_ri32(RDI, entry->operand);
+            emit_read_memory();
+            emit_mov_rr32(REG_A, RAX);
+            return 0;
+
+        case 0x22:                                      // SHLD adr
+            emit_movzx_r32_r8(RSI, REG_HL);
+            emit_mov_ri32(RDI, entry->operand);
+            emit_write_memory();
+            emit_mov_rr32(RSI, REG_HL);
+            emit_shr_ri(RSI, 8);
+            emit_mov_ri32(RDI, (uint16_t)(entry->operand + 1));
+            emit_write_memory();
+            return 0;
+
+        case 0x2A:                                      // LHLD adr
+            emit_mov_ri32(RDI, entry->operand);
+            emit_read_memory();
+            emit_store32(RSP, FRAME_SCRATCH, RAX);
+            emit_mov_ri32(RDI, (uint16_t)(entry->operand + 1));
+            emit_read_memory();
+            emit_shl_ri(RAX, 8);
+            emit_or_rm32(RAX, RSP, FRAME_SCRATCH);
+            emit_mov_rr32(REG_HL, RAX);
+            return 0;
+
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE:     // ADI ... CPI D8
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            emit_mov_ri32(RCX, entry->operand & 0xFF);
+            emit_alu(op, 1);
+            return 0;
+
+        case 0x04: case 0x0C: case 0x14: case 0x1C:     // INR r / INR M
+        case 0x24: case 0x2C: case 0x34: case 0x3C:
+        case 0x05: case 0x0D: case 0x15: case 0x1D:     // DCR r / DCR M
+        case 0x25: case 0x2D: case 0x35: case 0x3D:
+            emit_inr_dcr(op);
+            return 0;
+
+        case 0x07: case 0x0F: case 0x17: case 0x1F:     // RLC / RRC / RAL / RAR
+            emit_rotate(op);
+            return 0;
+
+        case 0x09: case 0x19: case 0x29: case 0x39:     // DAD rp
+            emit_mov_rr32(RAX, REG_HL);
+            emit_alu_rr32(ALU_ADD, RAX, pair_regs[op >> 4]);
+            emit_mov_rr32(RCX, RAX);
+            emit_shr_ri(RCX, 16);
+            emit_and_ri(RAX, 0xFFFF);
+            emit_mov_rr32(REG_HL, RAX);
+            emit_flags_carry(RCX);
+            return 0;
+
+        case 0x2F:                                      // CMA
+            emit_xor_ri(REG_A, 0xFF);
+            return 0;
+
+        case 0x37: case 0x3F:                           // STC / CMC
+            emit_load_flags(RAX);
+            if (op == 0x37)
+                emit_or_ri(RAX, FLAG_CY);
+            else
+                emit_xor_ri(RAX, FLAG_CY);
+            emit_store_flags(RAX);
+            return 0;
+
+        case 0xC5: case 0xD5: case 0xE5:                // PUSH rp
+            emit_push_pair(pair_regs[(op >> 4) & 3]);
+            return 0;
+
+        case 0xF5:                                      // PUSH PSW
+            emit_push_pair(REG_A);
+            return 0;
+
+        case 0xC1: case 0xD1: case 0xE1:                // POP rp
+            emit_pop_bytes();
+            emit_shl_ri(RAX, 8);
+            emit_or_rm32(RAX, RSP, FRAME_SCRATCH);
+            emit_mov_rr32(pair_regs[(op >> 4) & 3], RAX);
+            return 0;
+
+        case 0xF1:                                      // POP PSW, bits 3 and 5 read as 0, bit 1 as 1
+            emit_pop_bytes();
+            emit_mov_rr32(REG_A, RAX);
+            emit_load32(RAX, RSP, FRAME_SCRATCH);
+            emit_and_ri(RAX, (uint8_t)~0x28);
+            emit_or_ri(RAX, FLAG_ONE);
+            emit_store_flags(RAX);
+            return 0;
+
+        case 0xF3: case 0xFB:                           // DI / EI
+            emit_mov_ri32(RAX, op == 0xFB);
+            emit_store8(REG_CPU, offsetof(CPU, interrupts_enabled), RAX);
+            return 0;
+
+        case 0xEB:                                      // XCHG
+            emit_mov_rr32(RAX, REG_HL);
+            emit_mov_rr32(REG_HL, REG_DE);
+            emit_mov_rr32(REG_DE, RAX);
+            return 0;
+
+        case 0xF9:                                      // SPHL
+            emit_mov_rr32(REG_SP, REG_HL);
+            return 0;
+
+        case 0xC3:                                      // JMP addr
+            emit_exit_linked(entry->operand);
+            return 1;
+
+        case 0xCD:                                      // CALL addr
+            emit_call(entry->operand, next);
+            return 1;
+
+        case 0xC9:                                      // RET
+            emit_ret();
+            return 1;
+
+        case 0xE9:                                      // PCHL
+            emit_store32(RSP, FRAME_NEXT_PC, REG_HL);
+            emit_exit(JIT_EXIT_DYNAMIC);
+            return 1;
+
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:     // Jcc addr
+        case 0xE2: case 0xEA: case 0xF2: case 0xFA: {
+            uint8_t *taken = emit_condition(op);
+            emit_exit_linked(next);
+            patch_rel32(taken, code_ptr);
+            emit_exit_linked(entry->operand);
+            return 1;
+        }
+
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC:     // Ccc addr
+        case 0xE4: case 0xEC: case 0xF4: case 0xFC: {
+            uint8_t *taken = emit_condition(op);
+            emit_exit_linked(next);
+            patch_rel32(taken, code_ptr);
+            emit_call(entry->operand, next);
+            return 1;
+        }
+
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8:     // Rcc
+        case 0xE0: case 0xE8: case 0xF0: case 0xF8: {
+            uint8_t *taken = emit_condition(op);
+            emit_exit_linked(next);
+            patch_rel32(taken, code_ptr);
+            emit_ret();
+            return 1;
+        }
+
+        default:
+            emit_interpret(pc);
+            return 0;
+    }
+}
+
+// Instructions that end a block before being executed: OUT calls out to the
+// machine's ports and sound hook and the RSTs take no cycles of their own,
+// cpu_run_jit runs those through the interpreter.
+static int leaves_to_interpreter(uint8_t opcode) {
+    return opcode == 0xD3 || (opcode & 0xC7) == 0xC7;
+}
+
+// Addresses cpu_run_jit has to see every arrival at. Heads of routines or
+// loops that are switched off are plain code; switching them back on bumps
+// rom_generation, which drops the blocks compiled meanwhile.
+static int hook_at(uint16_t pc) {
+    return idle_loop_cycles[pc] || (hle_index[pc] && hle_enabled()) ||
+           (loop_idiom_index[pc] && loop_idiom_enabled());
+}
+
+static uint8_t *compile_block(uint16_t start_pc) {
+    uint8_t *entry_point = code_ptr;
+    uint16_t pc = start_pc;
+    uint32_t cost = 0;
+
+    // Budget check, the block cost is patched in once it is known
+    emit_alu_m64_imm(7, RSP, FRAME_BUDGET, 0);
+    uint8_t *cmp_imm = code_ptr - 4;
+    uint8_t *bail = emit_jcc_rel32(0xC, code_ptr);     // jl
+    emit_alu_m64_imm(5, RSP, FRAME_BUDGET, 0);
+    uint8_t *sub_imm = code_ptr - 4;
+
+    for (int count = 0; ; count++) {
+        if (pc >= ROM_SIZE || !decode_cache[pc].handler || count == JIT_MAX_BLOCK_OPS) {
+            emit_exit_linked(pc);
+            break;
+        }
+
+        // Idle loop heads, native routines and fill/copy loops are run by cpu_run_jit
+        if (count && hook_at(pc)) {
+            emit_exit_linked(pc);
+            break;
+        }
+
+        const DecodedInstruction *entry = &decode_cache[pc];
+        if (leaves_to_interpreter(entry->opcode)) {
+            emit_exit_at(JIT_EXIT_INTERPRET, pc);
+            break;
+        }
+
+        cost += entry->cycles;
+        if (emit_instruction(entry, pc))
+            break;
+        pc += entry->length;
+    }
+
+    memcpy(cmp_imm, &cost, 4);
+    memcpy(sub_imm, &cost, 4);
+
+    patch_rel32(bail, code_ptr);
+    emit_exit_at(JIT_EXIT_BUDGET, start_pc);
+
+    return entry_point;
+}
+
+/*** Runtime ***/
+
+// Entry trampoline and the shared exit path, generated once
+static void emit_runtime(void) {
+    // int64_t jit_enter(CPU *cpu, int64_t budget, const uint8_t *code, JitExit *exit)
+    jit_enter = (JitEnterFn)(void *)code_ptr;
+    emit_push(RBX);
+    emit_push(RBP);
+    emit_push(R12);
+    emit_push(R13);
+    emit_push(R14);
+    emit_push(R15);
+    emit_rex(1, 0, RSP, 0);
+    emit8(0x81);
+    emit_modrm_reg(5, RSP);
+    emit32(FRAME_SIZE);
+    emit_mov_rr64(REG_CPU, RDI);
+    emit_store64(RSP, FRAME_EXIT, RCX);
+    emit_store64(RSP, FRAME_BUDGET, RSI);
+    if (CPU_LAZY_FLAGS) {
+        emit_store64(RSP, FRAME_CODE, RDX);
+        emit_resolve_flags();
+        emit_load64(RDX, RSP, FRAME_CODE);
+    }
+    emit_reload();
+    emit_jmp_reg(RDX);
+
+    // ecx = exit kind, rax = exit jmp to patch for JIT_EXIT_LINK
+    common_exit = code_ptr;
+    emit_mov_rr64(RSI, RAX);
+    emit_spill();
+    emit_load32(RAX, RSP, FRAME_NEXT_PC);
+    emit_store16(REG_CPU, offsetof(CPU, PC), RAX);
+    emit_load64(RDX, RSP, FRAME_EXIT);
+    emit_store32(RDX, offsetof(JitExit, kind), RCX);
+    emit_store64(RDX, offsetof(JitExit, patch), RSI);
+    emit_load64(RAX, RSP, FRAME_BUDGET);
+    emit_rex(1, 0, RSP, 0);
+    emit8(0x81);
+    emit_modrm_reg(0, RSP);
+    emit32(FRAME_SIZE);
+    emit_pop(R15);
+    emit_pop(R14);
+    emit_pop(R13);
+    emit_pop(R12);
+    emit_pop(RBP);
+    emit_pop(RBX);
+    emit8(0xC3);
+
+    runtime_end = code_ptr;
+}
+
+// Only changes the mapping when it is not already in the state asked for, so a
+// run of compiles and patches costs one mprotect each way
+static void code_protect(int writable) {
+    if (code_writable == writable)
+        return;
+    if (mprotect(code_buffer, JIT_CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0)
+        error("JIT: cannot change the code buffer's protection");
+    code_writable = writable;
+}
+
+static void jit_flush(void) {
+    memset(block_entry, 0, sizeof(block_entry));
+    code_ptr = runtime_end;
+    flush_count++;
+}
+
+static int jit_init(void) {
+    if (code_buffer)
+        return 1;
+    if (jit_unavailable)
+        return 0;
+
+    code_buffer = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code_buffer == MAP_FAILED) {
+        code_buffer = NULL;
+        jit_unavailable = 1;
+        return 0;
+    }
+
+    code_ptr = code_buffer;
+    code_writable = 1;
+    emit_runtime();
+    return 1;
+}
+
+static uint8_t *lookup_block(uint16_t pc) {
+    if (pc >= ROM_SIZE || !decode_cache[pc].handler)
+        return NULL;
+    if (!block_entry[pc]) {
+        code_protect(1);
+        if (code_ptr + JIT_MAX_BLOCK_BYTES > code_buffer + JIT_CODE_SIZE)
+            jit_flush();
+        block_entry[pc] = compile_block(pc);
+    }
+    return block_entry[pc];
+}
+
+uint32_t cpu_run_jit(CPU *cpu, uint32_t cycle_budget) {
+    int64_t remaining = cycle_budget;
+    IdleWatch idle = IDLE_WATCH_INIT;
+    JitExit exit;
+
+    if (!jit_init())
+        return cpu_run_threaded(cpu, cycle_budget);
+
+    // A ROM loaded since, or loaded with other hooks, leaves every block and link stale
+    if (code_generation != rom_generation) {
+        jit_flush();
+        code_generation = rom_generation;
+    }
+
+    while (remaining > 0) {
+        if (cpu->PC < ROM_SIZE && idle_loop_cycles[cpu->PC])
+            remaining -= idle_loop_skip(&idle, cpu->PC, (uint32_t)((int64_t)cycle_budget - remaining), cycle_budget);
+        if (cpu->PC < ROM_SIZE && hle_index[cpu->PC]) {
+            uint32_t used = hle_run(cpu, (uint32_t)((int64_t)cycle_budget - remaining), cycle_budget);
+            remaining -= used;
+            if (used)
+                continue;
+        }
+        if (cpu->PC < ROM_SIZE && loop_idiom_index[cpu->PC]) {
+            uint32_t used = loop_idiom_run(cpu, (uint32_t)((int64_t)cycle_budget - remaining), cycle_budget);
+            remaining -= used;
+            if (used)
+                continue;
+        }
+
+        uint8_t *code = lookup_block(cpu->PC);
+        if (!code) {
+            remaining -= cpu_run_threaded(cpu, 1);
+            continue;
+        }
+
+        code_protect(0);
+        remaining = jit_enter(cpu, remaining, code, &exit);
+
+        switch (exit.kind) {
+            case JIT_EXIT_LINK: {
+                uint32_t flushes = flush_count;
+                uint8_t *target = lookup_block(cpu->PC);
+                // Idle loop heads, native routines and fill/copy loops stay unlinked so every
+                // arrival comes back here
+                if (target && flushes == flush_count && !hook_at(cpu->PC)) {
+                    code_protect(1);
+                    patch_rel32(exit.patch + 1, target);
+                }
+                break;
+            }
+            case JIT_EXIT_BUDGET:
+                remaining -= cpu_run_threaded(cpu, (uint32_t)remaining);
+                break;
+            case JIT_EXIT_INTERPRET:
+                if (remaining > 0)
+                    remaining -= cpu_run_threaded(cpu, 1);
+                break;
+            default:
+                break;
+        }
+    }
+    return (uint32_t)((int64_t)cycle_budget - remaining);
+}
+
+void jit_free(void) {
+    if (code_buffer)
+        munmap(code_buffer, JIT_CODE_SIZE);
+    code_buffer = code_ptr = common_exit = runtime_end = NULL;
+    code_writable = 0;
+    memset(block_entry, 0, sizeof(block_entry));
+}
+
+#else
+
+uint32_t cpu_run_jit(CPU *cpu, uint32_t cycle_budget) {
+    return cpu_run_threaded(cpu, cycle_budget);
+}
+
+void jit_free(void) {
+}
+
+#endif
@@ -0,0 +1,653 @@
+#include "lockstep.h"
+#include "cpu.h"
+#include "decode_cache.h"
+#include "idle_loop.h"
+#include "hle.h"
+#include "loop_idiom.h"
+#include "update_flags.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// One byte or word per lane; lanes past Lockstep.lanes are carried along unused
+typedef uint8_t LaneBytes __attribute__((vector_size(LOCKSTEP_MAX_LANES)));
+typedef uint16_t LaneWords __attribute__((vector_size(2 * LOCKSTEP_MAX_LANES)));
+
+// Register file slot of each 8080 register field, with F where M would be
+enum { LANE_B, LANE_C, LANE_D, LANE_E, LANE_H, LANE_L, LANE_F, LANE_A };
+
+#define LANE_M          LANE_F      // Register field 6 in MOV, MVI, INR, DCR and the ALU ops
+
+struct Lockstep {
+    // Registers of every lane while converged, F resolved
+    LaneBytes reg[8];
+    LaneWords sp;
+    uint16_t pc;            // Shared while converged
+
+    LaneBytes active;       // 0xFF for the lanes in use
+    int lanes;
+    Machine *machine[LOCKSTEP_MAX_LANES];
+    Memory *memory[LOCKSTEP_MAX_LANES];
+    IdleWatch idle[LOCKSTEP_MAX_LANES];
+    LockstepStats stats;
+};
+
+/*** Lane helpers ***/
+
+static inline LaneBytes splat(uint8_t value) {
+    LaneBytes lanes = { 0 };
+    return lanes + value;
+}
+
+static inline LaneWords splat_word(uint16_t value) {
+    LaneWords lanes = { 0 };
+    return lanes + value;
+}
+
+static inline LaneBytes low_bytes(LaneWords words) {
+    return __builtin_convertvector(words, LaneBytes);
+}
+
+static inline LaneWords widen(LaneBytes bytes) {
+    return __builtin_convertvector(bytes, LaneWords);
+}
+
+// Register pair from its high register's slot: LANE_B, LANE_D or LANE_H
+static inline LaneWords get_pair(const Lockstep *ls, int hi) {
+    return widen(ls->reg[hi]) << 8 | widen(ls->reg[hi + 1]);
+}
+
+static inline void set_pair(Lockstep *ls, int hi, LaneWords value) {
+    ls->reg[hi] = low_bytes(value >> 8);
+    ls->reg[hi + 1] = low_bytes(value);
+}
+
+// Pair field of LXI, INX, DCX and DAD: BC, DE, HL, SP
+static inline LaneWords get_rp(const Lockstep *ls, int rp) {
+    return rp == 3 ? ls->sp : get_pair(ls, rp * 2);
+}
+
+static inline void set_rp(Lockstep *ls, int rp, LaneWords value) {
+    if (rp == 3)
+        ls->sp = value;
+    else
+        set_pair(ls, rp * 2, value);
+}
+
+// Nonzero if every lane in use has the same value
+static inline int lanes_uniform(const Lockstep *ls, LaneBytes value) {
+    LaneBytes differ = (value ^ splat(value[0])) & ls->active;
+    uint64_t words[LOCKSTEP_MAX_LANES / 8];
+
+    memcpy(words, &differ, sizeof(words));
+    for (int i = 1; i < LOCKSTEP_MAX_LANES / 8; i++)
+        words[0] |= words[i];
+    return words[0] == 0;
+}
+
+// Memory goes lane by lane: every machine has its own RAM
+static inline LaneBytes lane_read(const Lockstep *ls, LaneWords address) {
+    LaneBytes value = { 0 };
+    for (int i = 0; i < ls->lanes; i++)
+        value[i] = read_memory(ls->memory[i], address[i]);
+    return value;
+}
+
+static inline void lane_write(Lockstep *ls, LaneWords address, LaneBytes value) {
+    for (int i = 0; i < ls->lanes; i++)
+        write_memory(ls->memory[i], address[i], value[i]);
+}
+
+/*** Flags, the same bits szp_table, ac_table and cpu.c produce ***/
+
+static inline LaneBytes lane_szp(LaneBytes value) {
+    LaneBytes parity = value ^ (value >> 4);
+    parity ^= parity >> 2;
+    parity ^= parity >> 1;
+
+    return (value & FLAG_S) | ((LaneBytes)(value == 0) & FLAG_Z) | ((~parity & 1) << 2) | FLAG_ONE;
+}
+
+static inline LaneBytes lane_ac(LaneBytes a, LaneBytes b) {
+    return ((a & 0x0F) + (b & 0x0F)) & FLAG_AC;
+}
+
+// Replaces CY with the low bit of carry
+static inline void lane_set_cy(Lockstep *ls, LaneBytes carry) {
+    ls->reg[LANE_F] = (ls->reg[LANE_F] & ~FLAG_CY) | (carry & FLAG_CY);
+}
+
+// INR/DCR: S, Z and P from value, CY and AC kept
+static inline void lane_update_szp(Lockstep *ls, LaneBytes value) {
+    ls->reg[LANE_F] = (ls->reg[LANE_F] & (FLAG_CY | FLAG_AC)) | lane_szp(value);
+}
+
+/**
+ * ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP and their immediates, in ALU field order
+ *
+ * @param immediate  ADI/ACI take AC from the new A, ANI clears it and ORI keeps
+ *                   it, like cpu.c; the register forms use the nibble add of a
+ *                   and b, and ANA bit 3 of the result
+ */
+static void lane_alu(Lockstep *ls, int op, LaneBytes b, int immediate) {
+    LaneBytes a = ls->reg[LANE_A];
+    LaneBytes f = ls->reg[LANE_F];
+    LaneBytes carry_in = (LaneBytes)((f & FLAG_CY) != 0);
+    LaneBytes r;
+
+    switch (op) {
+        case 0:     // ADD
+            r = a + b;
+            f = lane_szp(r) | lane_ac(immediate ? r : a, b) | ((LaneBytes)(r < a) & FLAG_CY);
+            break;
+        case 1:     // ADC
+            r = a + b + (f & FLAG_CY);
+            f = lane_szp(r) | lane_ac(immediate ? r : a, b) | ((LaneBytes)((r < a) | ((r == a) & carry_in)) & FLAG_CY);
+            break;
+        case 2:     // SUB
+        case 7:     // CMP
+            r = a - b;
+            f = lane_szp(r) | lane_ac(a, b) | ((LaneBytes)(a < b) & FLAG_CY);
+            break;
+        case 3:     // SBB
+            r = a - b - (f & FLAG_CY);
+            f = lane_szp(r) | lane_ac(a, b) | ((LaneBytes)((a < b) | ((a == b) & carry_in)) & FLAG_CY);
+            break;
+        case 4:     // ANA
+            r = a & b;
+            f = lane_szp(r) | (immediate ? splat(0) : (r & 0x08) << 1);
+            break;
+        case 5:     // XRA
+            r = a ^ b;
+            f = lane_szp(r);
+            break;
+        default:    // ORA
+            r = a | b;
+            f = lane_szp(r) | (immediate ? f & FLAG_AC : splat(0));
+            break;
+    }
+
+    if (op != 7)
+        ls->reg[LANE_A] = r;
+    ls->reg[LANE_F] = f;
+}
+
+// Condition field of Jcc, Ccc and Rcc: 1 or 0 if it holds on every lane or on none, -1 if lanes disagree
+static int lane_condition(const Lockstep *ls, int ccc) {
+    static const uint8_t flag[4] = { FLAG_Z, FLAG_CY, FLAG_P, FLAG_S };
+    LaneBytes set = ls->reg[LANE_F] & flag[ccc >> 1];
+
+    if (!lanes_uniform(ls, set))
+        return -1;
+    return (set[0] != 0) == (ccc & 1);
+}
+
+static inline void lane_push(Lockstep *ls, LaneBytes hi, LaneBytes lo) {
+    lane_write(ls, ls->sp - 1, hi);
+    lane_write(ls, ls->sp - 2, lo);
+    ls->sp -= 2;
+}
+
+// RET on every lane, 0 with nothing changed unless they all return to the same address
+static int lane_ret(Lockstep *ls) {
+    LaneBytes lo = lane_read(ls, ls->sp);
+    LaneBytes hi = lane_read(ls, ls->sp + 1);
+
+    if (!lanes_uniform(ls, lo) || !lanes_uniform(ls, hi))
+        return 0;
+    ls->pc = (uint16_t)(hi[0] << 8 | lo[0]);
+    ls->sp += 2;
+    return 1;
+}
+
+/*** Vector step ***/
+
+/**
+ * Runs the instruction at the shared PC on every lane at once
+ *
+ * @return  Its cycles, or 0 with nothing changed if it has to go lane by lane:
+ *          a hook address, code outside the ROM, I/O, interrupt enables, RST,
+ *          HLT, DAA, the rare stack and jump forms, or lanes that disagree
+ *          on a condition or a return address
+ */
+static uint32_t vector_step(Lockstep *ls) {
+    uint16_t pc = ls->pc;
+
+    if (pc >= ROM_SIZE || idle_loop_cycles[pc] || hle_index[pc] || loop_idiom_index[pc])
+        return 0;
+
+    uint8_t opcode = shared_rom[pc];
+    uint16_t next = pc + opcode_lengths[opcode];
+    if (next > ROM_SIZE)
+        return 0;
+
+    uint8_t d8 = next > pc + 1 ? shared_rom[pc + 1] : 0;
+    uint16_t d16 = next > pc + 2 ? (uint16_t)(shared_rom[pc + 2] << 8 | d8) : 0;
+    int dst = (opcode >> 3) & 7;
+    int src = opcode & 7;
+    int rp = (opcode >> 4) & 3;
+
+    ls->pc = next;
+
+    if (opcode >= 0x40 && opcode < 0x80) {
+        if (opcode == 0x76) {                   // HLT
+            ls->pc = pc;
+            return 0;
+        }
+        if (dst == LANE_M)
+            lane_write(ls, get_pair(ls, LANE_H), ls->reg[src]);
+        else if (src == LANE_M)
+            ls->reg[dst] = lane_read(ls, get_pair(ls, LANE_H));
+        else
+            ls->reg[dst] = ls->reg[src];
+        return opcode_cycles[opcode];
+    }
+
+    if (opcode >= 0x80 && opcode < 0xC0) {
+        lane_alu(ls, dst, src == LANE_M ? lane_read(ls, get_pair(ls, LANE_H)) : ls->reg[src], 0);
+        return opcode_cycles[opcode];
+    }
+
+    if (opcode < 0x40) {
+        switch (opcode & 0x0F) {
+            case 0x01:                                      // LXI
+                set_rp(ls, rp, splat_word(d16));
+                return opcode_cycles[opcode];
+            case 0x03:                                      // INX
+                set_rp(ls, rp, get_rp(ls, rp) + 1);
+                return opcode_cycles[opcode];
+            case 0x0B:                                      // DCX
+                set_rp(ls, rp, get_rp(ls, rp) - 1);
+                return opcode_cycles[opcode];
+            case 0x09: {                                    // DAD
+                LaneWords hl = get_pair(ls, LANE_H);
+                LaneWords sum = hl + get_rp(ls, rp);
+                lane_set_cy(ls, low_bytes((LaneWords)(sum < hl)));
+                set_pair(ls, LANE_H, sum);
+                return opcode_cycles[opcode];
+            }
+        }
+
+        switch (opcode & 0x07) {
+            case 0x00:                                      // NOP and its duplicates
+                return opcode_cycles[opcode];
+            case 0x04:                                      // INR
+            case 0x05: {                                    // DCR
+                LaneBytes value = dst == LANE_M ? lane_read(ls, get_pair(ls, LANE_H)) : ls->reg[dst];
+                value = src == 0x04 ? value + 1 : value - 1;
+                lane_update_szp(ls, value);
+                if (dst == LANE_M)
+                    lane_write(ls, get_pair(ls, LANE_H), value);
+                else
+                    ls->reg[dst] = value;
+                return opcode_cycles[opcode];
+            }
+            case 0x06:                                      // MVI
+                if (dst == LANE_M)
+                    lane_write(ls, get_pair(ls, LANE_H), splat(d8));
+                else
+                    ls->reg[dst] = splat(d8);
+                return opcode_cycles[opcode];
+        }
+
+        LaneBytes a = ls->reg[LANE_A];
+        switch (opcode) {
+            case 0x02: lane_write(ls, get_pair(ls, LANE_B), a); break;          // STAX B
+            case 0x12: lane_write(ls, get_pair(ls, LANE_D), a); break;          // STAX D
+            case 0x0A: ls->reg[LANE_A] = lane_read(ls, get_pair(ls, LANE_B)); break;  // LDAX B
+            case 0x1A: ls->reg[LANE_A] = lane_read(ls, get_pair(ls, LANE_D)); break;  // LDAX D
+            case 0x22:                                                          // SHLD
+                lane_write(ls, splat_word(d16), ls->reg[LANE_L]);
+                lane_write(ls, splat_word(d16 + 1), ls->reg[LANE_H]);
+                break;
+            case 0x2A: {                                                        // LHLD
+                LaneBytes l = lane_read(ls, splat_word(d16));
+                ls->reg[LANE_H] = lane_read(ls, splat_word(d16 + 1));
+                ls->reg[LANE_L] = l;
+                break;
+            }
+            case 0x32: lane_write(ls, splat_word(d16), a); break;               // STA
+            case 0x3A: ls->reg[LANE_A] = lane_read(ls, splat_word(d16)); break; // LDA
+            case 0x07:                                                          // RLC
+                lane_set_cy(ls, a >> 7);
+                ls->reg[LANE_A] = a << 1 | a >> 7;
+                break;
+            case 0x0F:                                                          // RRC
+                lane_set_cy(ls, a);
+                ls->reg[LANE_A] = a >> 1 | a << 7;
+                break;
+            case 0x17:                                                          // RAL
+                ls->reg[LANE_A] = a << 1 | (ls->reg[LANE_F] & FLAG_CY);
+                lane_set_cy(ls, a >> 7);
+                break;
+            case 0x1F:                                                          // RAR
+                ls->reg[LANE_A] = a >> 1 | (ls->reg[LANE_F] & FLAG_CY) << 7;
+                lane_set_cy(ls, a);
+                break;
+            case 0x2F: ls->reg[LANE_A] = ~a; break;                             // CMA
+            case 0x37: ls->reg[LANE_F] |= FLAG_CY; break;                       // STC
+            case 0x3F: ls->reg[LANE_F] ^= FLAG_CY; break;                       // CMC
+            default:                                                            // DAA
+                ls->pc = pc;
+                return 0;
+        }
+        return opcode_cycles[opcode];
+    }
+
+    // 0xC0-0xFF
+    int taken;
+    switch (opcode & 0x0F) {
+        case 0x01:                                          // POP
+        case 0x05: {                                        // PUSH
+            int hi = rp == 3 ? LANE_A : rp * 2;
+            int lo = rp == 3 ? LANE_F : rp * 2 + 1;
+            if (opcode & 0x04) {
+                lane_push(ls, ls->reg[hi], ls->reg[lo]);
+            } else {
+                LaneBytes low = lane_read(ls, ls->sp);
+                ls->reg[hi] = lane_read(ls, ls->sp + 1);
+                ls->reg[lo] = rp == 3 ? (low & ~0x28) | FLAG_ONE : low;    // As POP PSW does
+                ls->sp += 2;
+            }
+            return opcode_cycles[opcode];
+        }
+    }
+
+    switch (opcode & 0x07) {
+        case 0x00:                                          // Rcc
+            taken = lane_condition(ls, dst);
+            if (taken < 0 || (taken && !lane_ret(ls)))
+                break;
+            return opcode_cycles[opcode];
+        case 0x02:                                          // Jcc
+            taken = lane_condition(ls, dst);
+            if (taken < 0)
+                break;
+            if (taken)
+                ls->pc = d16;
+            return opcode_cycles[opcode];
+        case 0x04:                                          // Ccc
+            taken = lane_condition(ls, dst);
+            if (taken < 0)
+                break;
+            if (taken) {
+                lane_push(ls, splat(next >> 8), splat((uint8_t)next));
+                ls->pc = d16;
+            }
+            return opcode_cycles[opcode];
+        case 0x06:                                          // ALU immediate
+            lane_alu(ls, dst, splat(d8), 1);
+            return opcode_cycles[opcode];
+        default:
+            switch (opcode) {
+                case 0xC3:                                  // JMP
+                    ls->pc = d16;
+                    return opcode_cycles[opcode];
+                case 0xC9:                                  // RET
+                    if (!lane_ret(ls))
+                        break;
+                    return opcode_cycles[opcode];
+                case 0xCD:                                  // CALL
+                    lane_push(ls, splat(next >> 8), splat((uint8_t)next));
+                    ls->pc = d16;
+                    return opcode_cycles[opcode];
+                case 0xEB: {                                // XCHG
+                    LaneWords de = get_pair(ls, LANE_D);
+                    set_pair(ls, LANE_D, get_pair(ls, LANE_H));
+                    set_pair(ls, LANE_H, de);
+                    return opcode_cycles[opcode];
+                }
+            }
+    }
+
+    ls->pc = pc;
+    return 0;
+}
+
+/*** Lanes to machines and back ***/
+
+// Registers go through plain arrays and are copied into or out of the vectors
+// whole; element by element through the struct, GCC 12 -O2 lost the stores
+static void lanes_load(Lockstep *ls) {
+    uint8_t reg[8][LOCKSTEP_MAX_LANES] = { { 0 } };
+    uint16_t sp[LOCKSTEP_MAX_LANES] = { 0 };
+
+    for (int i = 0; i < ls->lanes; i++) {
+        CPU *cpu = &ls->machine[i]->cpu;
+        reg[LANE_B][i] = cpu->B;
+        reg[LANE_C][i] = cpu->C;
+        reg[LANE_D][i] = cpu->D;
+        reg[LANE_E][i] = cpu->E;
+        reg[LANE_H][i] = cpu->H;
+        reg[LANE_L][i] = cpu->L;
+        reg[LANE_F][i] = get_flags(cpu);
+        reg[LANE_A][i] = cpu->A;
+        sp[i] = cpu->SP;
+    }
+
+    memcpy(ls->reg, reg, sizeof(reg));
+    memcpy(&ls->sp, sp, sizeof(sp));
+    ls->pc = ls->machine[0]->cpu.PC;
+}
+
+static void lanes_store(Lockstep *ls) {
+    uint8_t reg[8][LOCKSTEP_MAX_LANES];
+    uint16_t sp[LOCKSTEP_MAX_LANES];
+
+    memcpy(reg, ls->reg, sizeof(reg));
+    memcpy(sp, &ls->sp, sizeof(sp));
+
+    for (int i = 0; i < ls->lanes; i++) {
+        CPU *cpu = &ls->machine[i]->cpu;
+        cpu->B = reg[LANE_B][i];
+        cpu->C = reg[LANE_C][i];
+        cpu->D = reg[LANE_D][i];
+        cpu->E = reg[LANE_E][i];
+        cpu->H = reg[LANE_H][i];
+        cpu->L = reg[LANE_L][i];
+        set_flags(cpu, reg[LANE_F][i]);
+        cpu->A = reg[LANE_A][i];
+        cpu->SP = sp[i];
+        cpu->PC = ls->pc;
+    }
+}
+
+// One pass of cpu_run_cycles's switch-core loop on a single lane
+static uint32_t lane_step(CPU *cpu, IdleWatch *idle, uint32_t cycles, uint32_t limit) {
+    uint32_t used = 0;
+
+    if (cpu->PC < ROM_SIZE && idle_loop_cycles[cpu->PC])
+        used += idle_loop_skip(idle, cpu->PC, cycles, limit);
+    if (cpu->PC < ROM_SIZE && hle_index[cpu->PC]) {
+        uint32_t hle = hle_run(cpu, cycles + used, limit);
+        if (hle)
+            return used + hle;
+    }
+    if (cpu->PC < ROM_SIZE && loop_idiom_index[cpu->PC]) {
+        uint32_t idiom = loop_idiom_run(cpu, cycles + used, limit);
+        if (idiom)
+            return used + idiom;
+    }
+    return used + cpu_execute_instruction(cpu);
+}
+
+/*** Frames ***/
+
+// Cycles before the first lane reaches its limit, 0 once any has
+static uint32_t headroom(const Lockstep *ls, const uint32_t *limit, const uint32_t *used) {
+    uint32_t room = UINT32_MAX;
+
+    for (int i = 0; i < ls->lanes; i++) {
+        uint32_t left = used[i] < limit[i] ? limit[i] - used[i] : 0;
+        if (left < room)
+            room = left;
+    }
+    return room;
+}
+
+/**
+ * Runs every lane, all at the same PC, as one cpu_run_cycles call each would.
+ * Lanes may start at different cycle counts: they run as one while all are
+ * short of their limit, and the ones left finish alone.
+ *
+ * @param limit  Cycles each lane's run call stops at
+ * @param used   Cycles each lane ran; once lanes go different ways the rest
+ *               of the call runs on each lane's own core
+ * @return       1 if the lanes stayed together to the end
+ */
+static int run_converged(Lockstep *ls, const uint32_t *limit, uint32_t *used) {
+    uint32_t run = 0;       // Vector cycles not yet added to used
+
+    for (int i = 0; i < ls->lanes; i++) {
+        used[i] = 0;
+        ls->idle[i] = (IdleWatch)IDLE_WATCH_INIT;
+    }
+    uint32_t room = headroom(ls, limit, used);
+    int together = 1;
+    lanes_load(ls);
+
+    while (run < room) {
+        uint32_t step = vector_step(ls);
+        if (step) {
+            run += step;
+            ls->stats.vector_instructions++;
+            continue;
+        }
+
+        lanes_store(ls);
+        ls->stats.scalar_steps++;
+
+        for (int i = 0; i < ls->lanes; i++) {
+            CPU *cpu = &ls->machine[i]->cpu;
+            used[i] += run;
+            used[i] += lane_step(cpu, &ls->idle[i], used[i], limit[i]);
+            together &= cpu->PC == ls->machine[0]->cpu.PC;
+        }
+        run = 0;
+
+        if (!together)
+            break;
+        room = headroom(ls, limit, used);
+        lanes_load(ls);
+    }
+
+    if (together) {
+        lanes_store(ls);
+        for (int i = 0; i < ls->lanes; i++)
+            used[i] += run;
+    }
+
+    // Starting a new run call is safe: no hook state carries across instructions
+    int split = 0;
+    for (int i = 0; i < ls->lanes; i++) {
+        if (used[i] < limit[i]) {
+            used[i] += cpu_run_cycles(&ls->machine[i]->cpu, limit[i] - used[i], CPU_NO_DEADLINE);
+            split = 1;
+        }
+    }
+    return !split;
+}
+
+// Every lane from cycles[i] to end, like the cpu_run_cycles calls in machine_run_frame
+static void run_half(Lockstep *ls, uint32_t *cycles, uint32_t end) {
+    uint32_t limit[LOCKSTEP_MAX_LANES], used[LOCKSTEP_MAX_LANES];
+    int together = 1;
+
+    for (int i = 0; i < ls->lanes; i++) {
+        limit[i] = end - cycles[i];
+        together &= ls->machine[i]->cpu.PC == ls->machine[0]->cpu.PC;
+    }
+
+    if (together && run_converged(ls, limit, used)) {
+        ls->stats.converged_halves++;
+    } else {
+        if (!together)
+            for (int i = 0; i < ls->lanes; i++)
+                used[i] = cpu_run_cycles(&ls->machine[i]->cpu, limit[i], CPU_NO_DEADLINE);
+        ls->stats.split_halves++;
+    }
+
+    for (int i = 0; i < ls->lanes; i++)
+        cycles[i] += used[i];
+}
+
+void lockstep_run_frame(Lockstep *ls) {
+    uint32_t cycles[LOCKSTEP_MAX_LANES];
+    int first_half = 0;
+
+    for (int i = 0; i < ls->lanes; i++) {
+        cycles[i] = ls->machine[i]->frame_cycles;
+        first_half += cycles[i] < CYCLES_PER_FRAME / 2;
+    }
+
+    // Up to mid-frame and RST 1, skipped by lanes the last frame overran past it
+    if (first_half == ls->lanes) {
+        run_half(ls, cycles, CYCLES_PER_FRAME / 2);
+    } else if (first_half) {
+        for (int i = 0; i < ls->lanes; i++)
+            if (cycles[i] < CYCLES_PER_FRAME / 2)
+                cycles[i] += cpu_run_cycles(&ls->machine[i]->cpu, CYCLES_PER_FRAME / 2 - cycles[i], CPU_NO_DEADLINE);
+        ls->stats.split_halves++;
+    }
+    for (int i = 0; first_half && i < ls->lanes; i++) {
+        CPU *cpu = &ls->machine[i]->cpu;
+        if (ls->machine[i]->frame_cycles < CYCLES_PER_FRAME / 2 && cpu->interrupts_enabled)
+            generate_interrupt(cpu, 1);
+    }
+
+    // To the end of the frame and RST 2
+    run_half(ls, cycles, CYCLES_PER_FRAME);
+
+    for (int i = 0; i < ls->lanes; i++) {
+        CPU *cpu = &ls->machine[i]->cpu;
+        if (cpu->interrupts_enabled)
+            generate_interrupt(cpu, 2);
+        ls->machine[i]->frame_cycles = cycles[i] - CYCLES_PER_FRAME;
+        machine_frame_done(ls->machine[i]);
+    }
+}
+
+/*** Setup ***/
+
+// Aligned for the widest vector loads the lane registers may get
+static Lockstep *lockstep_alloc(void) {
+#ifdef _WIN32
+    return (Lockstep*)_aligned_malloc(sizeof(Lockstep), CPU_CACHE_LINE);
+#else
+    void *lockstep = NULL;
+    return posix_memalign(&lockstep, CPU_CACHE_LINE, sizeof(Lockstep)) ? NULL : (Lockstep*)lockstep;
+#endif
+}
+
+Lockstep *lockstep_create(Machine **machines, int lanes) {
+    if (lanes < 1 || lanes > LOCKSTEP_MAX_LANES)
+        return NULL;
+
+    Lockstep *ls = lockstep_alloc();
+    if (!ls) return NULL;
+    memset(ls, 0, sizeof(*ls));
+
+    ls->lanes = lanes;
+    for (int i = 0; i < lanes; i++) {
+        ls->machine[i] = machines[i];
+        ls->memory[i] = &machines[i]->memory;
+        ls->active[i] = 0xFF;
+    }
+    return ls;
+}
+
+void lockstep_destroy(Lockstep *ls) {
+    if (!ls) return;
+#ifdef _WIN32
+    _aligned_free(ls);
+#else
+    free(ls);
+#endif
+}
+
+const LockstepStats *lockstep_stats(const Lockstep *ls) {
+    return &ls->stats;
+}
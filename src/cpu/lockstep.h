@@ -0,0 +1,48 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+#include "machine.h"
+
+// Lockstep interpreter (experimental): up to LOCKSTEP_MAX_LANES machines run
+// as lanes of one interpreter whose register file is kept as structure of
+// arrays, one vector per 8080 register with a byte per lane.
+//
+// While every lane is at the same PC, each instruction is decoded once and
+// run for all lanes with GCC vector extensions (SSE2 or AVX2, whatever -m
+// flags the build uses); only memory accesses go lane by lane, since every machine has its own RAM. I/O,
+// interrupts, RST and the idle loop, HLE and loop idiom hooks run lane by
+// lane through the switch core's own code. Lanes need not be at the same
+// cycle count. Once they disagree on a branch or a return address, or the
+// first one reaches the end of the half frame, each one finishes the half
+// frame on its own cpu->core; they try again at the next half frame.
+//
+// Every lane ends each frame exactly as machine_run_frame would leave it.
+
+#define LOCKSTEP_MAX_LANES  32
+
+typedef struct Lockstep Lockstep;
+
+typedef struct {
+    uint64_t vector_instructions;   // Decoded once, run for every lane
+    uint64_t scalar_steps;          // Instructions or hooks run lane by lane while converged
+    uint64_t converged_halves;      // Half frames that ran in lockstep to the end
+    uint64_t split_halves;          // Half frames the lanes finished on their own
+} LockstepStats;
+
+/**
+ * Groups machines into lanes, in order; the machines stay owned by the caller
+ * and can be used on their own between lockstep_run_frame calls
+ *
+ * @param lanes  1 to LOCKSTEP_MAX_LANES
+ * @return       NULL if lanes is out of range or out of memory
+ */
+Lockstep *lockstep_create(Machine **machines, int lanes);
+void lockstep_destroy(Lockstep *lockstep);
+
+// machine_run_frame on every lane
+void lockstep_run_frame(Lockstep *lockstep);
+
+const LockstepStats *lockstep_stats(const Lockstep *lockstep);
+
+#endif
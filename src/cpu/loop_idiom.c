@@ -0,0 +1,312 @@
+#include "loop_idiom.h"
+#include "decode_cache.h"
+#include "update_flags.h"
+#include "machine.h"
+
+#include <stdint.h>
+#include <string.h>
+
+uint8_t loop_idiom_index[ROM_SIZE];
+
+// Longest loop body looked at, the ROM's fill and copy loops are under 10 bytes
+#define LOOP_IDIOM_MAX_BYTES    16
+
+// loop_idiom_index holds 1 + index in a byte
+#define LOOP_IDIOM_MAX          255
+
+// Register pairs in the 8080's pair field order
+enum { PAIR_BC, PAIR_DE, PAIR_HL, NO_PAIR = 0xFF };
+
+// Register fields, as in MOV and DCR
+#define REG_H           4
+#define REG_L           5
+#define REG_A           7
+#define NO_REG          0xFF
+#define UNTIL_H         0xFE    // Exit test is MOV A,H; CPI end instead of a DCR
+
+typedef struct {
+    uint8_t dst;        // Pair stored through
+    uint8_t src;        // Pair loaded through into A, NO_PAIR for a fill
+    uint8_t value;      // Fill: register field stored, NO_REG for the immediate
+    uint8_t imm;
+    uint8_t counter;    // Register field of the DCR, or UNTIL_H
+    uint8_t end;        // CPI operand
+    uint8_t pass;       // Cycles of one pass
+    uint16_t exit;      // Address after the JNZ
+} LoopIdiom;
+
+static LoopIdiom loop_idioms[LOOP_IDIOM_MAX];
+static int loop_idioms_enabled = 1;
+
+void loop_idiom_set_enabled(int enabled) {
+    // The JIT leaves loop heads out of its blocks only while they run
+    if (!enabled != !loop_idioms_enabled)
+        rom_generation++;
+    loop_idioms_enabled = enabled;
+}
+
+int loop_idiom_enabled(void) {
+    return loop_idioms_enabled;
+}
+
+// Pair a register field belongs to, NO_PAIR for A
+static uint8_t field_pair(uint8_t field) {
+    return field < 6 ? field >> 1 : NO_PAIR;
+}
+
+// Fills in loop if the loop at head is a fill or copy idiom, see loop_idiom.h
+static int loop_at(const uint8_t *rom, uint32_t head, LoopIdiom *loop) {
+    uint8_t stepped = 0;        // Pairs already INXed, as 1 << pair
+    int mov_a_h = 0;            // Last instruction was the MOV A,H of an UNTIL_H test
+    int tested = 0;             // Exit test done, only the JNZ may follow
+    uint32_t pass = 0;
+
+    loop->dst = loop->src = NO_PAIR;
+    loop->value = loop->counter = NO_REG;
+
+    for (uint32_t pc = head; pc < head + LOOP_IDIOM_MAX_BYTES; pc += opcode_lengths[rom[pc]]) {
+        uint8_t opcode = rom[pc];
+        uint8_t pair = NO_PAIR;
+
+        // Operands spilling into RAM can change, see decode_cache_build
+        if (pc + opcode_lengths[opcode] > ROM_SIZE)
+            return 0;
+
+        pass += opcode_cycles[opcode];
+
+        if (opcode == 0xC2) {                                   // JNZ
+            uint16_t target = rom[pc + 1] | (rom[pc + 2] << 8);
+            if (target != head || !tested || loop->dst == NO_PAIR || pass > UINT8_MAX)
+                return 0;
+            if (!(stepped & (1 << loop->dst)) || (loop->src != NO_PAIR && !(stepped & (1 << loop->src))))
+                return 0;
+            loop->pass = (uint8_t)pass;
+            loop->exit = (uint16_t)(pc + 3);
+            return 1;
+        }
+        if (tested)
+            return 0;
+
+        if (mov_a_h) {                                          // CPI after MOV A,H
+            if (opcode != 0xFE)
+                return 0;
+            loop->end = rom[pc + 1];
+            tested = 1;
+            continue;
+        }
+
+        switch (opcode) {
+            case 0x0A: case 0x1A: case 0x7E:                    // LDAX B, LDAX D, MOV A,M
+                pair = opcode == 0x7E ? PAIR_HL : opcode >> 4;
+                if (loop->src != NO_PAIR || loop->dst != NO_PAIR || (stepped & (1 << pair)))
+                    return 0;
+                loop->src = pair;
+                break;
+
+            case 0x02: case 0x12:                               // STAX B, STAX D
+            case 0x36:                                          // MVI M,d8
+            case 0x70: case 0x71: case 0x72: case 0x73:         // MOV M,r
+            case 0x74: case 0x75: case 0x77:
+                pair = opcode < 0x30 ? opcode >> 4 : PAIR_HL;
+                if (loop->dst != NO_PAIR || pair == loop->src || (stepped & (1 << pair)))
+                    return 0;
+                loop->dst = pair;
+                if (opcode == 0x36)
+                    loop->imm = rom[pc + 1];
+                else
+                    loop->value = opcode < 0x30 ? REG_A : opcode & 7;
+                // A copy stores the byte it loaded
+                if (loop->src != NO_PAIR && loop->value != REG_A)
+                    return 0;
+                break;
+
+            case 0x03: case 0x13: case 0x23:                    // INX
+                pair = opcode >> 4;
+                if ((pair != loop->dst && pair != loop->src) || (stepped & (1 << pair)))
+                    return 0;
+                stepped |= 1 << pair;
+                break;
+
+            case 0x05: case 0x0D: case 0x15: case 0x1D:         // DCR r
+            case 0x25: case 0x2D: case 0x3D:
+                loop->counter = (opcode >> 3) & 7;
+                tested = 1;
+                break;
+
+            case 0x7C:                                          // MOV A,H
+                if (!(stepped & (1 << PAIR_HL)))
+                    return 0;
+                loop->counter = UNTIL_H;
+                mov_a_h = 1;
+                break;
+
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+// Registers the loop reads each pass must only change the way loop_idiom_run changes them
+static int loop_registers_fit(const LoopIdiom *loop) {
+    uint8_t copy = loop->src != NO_PAIR;
+    uint8_t value = copy ? NO_REG : loop->value;
+
+    if (loop->counter == UNTIL_H)
+        return value != REG_A && value != REG_H && value != REG_L;
+
+    if (loop->counter == value || (loop->counter == REG_A && copy))
+        return 0;
+    if (value != NO_REG && value != REG_A && field_pair(value) == loop->dst)
+        return 0;
+    return loop->counter == REG_A || (field_pair(loop->counter) != loop->dst && field_pair(loop->counter) != loop->src);
+}
+
+void loop_idiom_find(const uint8_t *rom) {
+    unsigned count = 0;
+
+    memset(loop_idiom_index, 0, sizeof(loop_idiom_index));
+
+    for (uint32_t pc = 0; pc < ROM_SIZE && count < LOOP_IDIOM_MAX; pc++) {
+        LoopIdiom *loop = &loop_idioms[count];
+        if (loop_at(rom, pc, loop) && loop_registers_fit(loop))
+            loop_idiom_index[pc] = ++count;
+    }
+}
+
+/*** Running passes ***/
+
+static uint16_t *pair_ref(CPU *cpu, uint8_t pair) {
+    return pair == PAIR_BC ? &cpu->BC : pair == PAIR_DE ? &cpu->DE : &cpu->HL;
+}
+
+static uint8_t *register_ref(CPU *cpu, uint8_t field) {
+    switch (field) {
+        case 0: return &cpu->B;
+        case 1: return &cpu->C;
+        case 2: return &cpu->D;
+        case 3: return &cpu->E;
+        case 4: return &cpu->H;
+        case 5: return &cpu->L;
+        default: return &cpu->A;
+    }
+}
+
+// Passes until the JNZ falls through, counting from the head
+static uint32_t passes_left(CPU *cpu, const LoopIdiom *loop) {
+    if (loop->counter == UNTIL_H) {
+        uint16_t hl = cpu->HL;
+        if ((uint16_t)(hl + 1) >> 8 == loop->end)
+            return 1;
+        return (uint16_t)((loop->end << 8) - hl);
+    }
+
+    uint8_t counter = *register_ref(cpu, loop->counter);
+    return counter ? counter : 256;
+}
+
+// Bytes left in address's 256-byte page; ROM and RAM pages both start on page
+// boundaries, so a run this long is one piece of host memory
+static uint32_t page_run(uint16_t address, uint32_t count) {
+    uint32_t run = PAGE_SIZE - (address & PAGE_MASK);
+    return run < count ? run : count;
+}
+
+// Host bytes behind address, for reading up to the end of its page (mirrors
+// fold onto RAM, see memory.h)
+static uint8_t *host_read(Memory *memory, uint16_t address) {
+    if (address < RAM_START)
+        return &shared_rom[address];
+    return memory->pages[RAM_PAGE(address)].host + (address & PAGE_MASK);
+}
+
+// Host bytes plain stores up to the end of address's page can go to, unshared
+// first; NULL if write_memory has to see them: ROM, watched, tracked or hashed pages
+static uint8_t *host_store(Memory *memory, uint16_t address) {
+    if (address < RAM_START || (memory->pages[RAM_PAGE(address)].attrs & (PAGE_SLOW_WRITE & ~PAGE_SHARED)))
+        return NULL;
+
+    memory_unshare(memory, RAM_PAGE(address));
+    return host_read(memory, address);
+}
+
+// count bytes from address on, write_memory still sees anything that is not plain RAM
+static void fill(Memory *memory, uint16_t address, uint8_t value, uint32_t count) {
+    while (count) {
+        uint32_t run = page_run(address, count);
+        uint8_t *host = host_store(memory, address);
+
+        if (host)
+            memset(host, value, run);
+        else
+            for (uint32_t i = 0; i < run; i++)
+                write_memory(memory, (uint16_t)(address + i), value);
+        address += run, count -= run;
+    }
+}
+
+// Forward byte copy, returns the last byte, which the last pass leaves in A.
+// Runs go a page at a time in order, so a run only has to match the byte loop
+// on its own: memmove gives the same bytes unless the destination starts inside
+// the source, where the byte loop copies its own output again.
+static uint8_t copy(Memory *memory, uint16_t to, uint16_t from, uint32_t count) {
+    uint8_t value = 0;
+
+    while (count) {
+        uint32_t run = page_run(from, page_run(to, count));
+        uint8_t *dst = host_store(memory, to);
+        uint8_t *src = host_read(memory, from);     // After host_store, which may move to's page to a new block
+
+        if (dst && (dst <= src || dst >= src + run)) {
+            value = src[run - 1];
+            memmove(dst, src, run);
+        } else {
+            for (uint32_t i = 0; i < run; i++) {
+                value = read_memory(memory, (uint16_t)(from + i));
+                write_memory(memory, (uint16_t)(to + i), value);
+            }
+        }
+        to += run, from += run, count -= run;
+    }
+    return value;
+}
+
+uint32_t loop_idiom_run(CPU *cpu, uint32_t cycles, uint32_t limit) {
+    const LoopIdiom *loop = &loop_idioms[loop_idiom_index[cpu->PC] - 1];
+
+    if (!loop_idioms_enabled || cycles >= limit)
+        return 0;
+
+    uint32_t left = passes_left(cpu, loop);
+    uint32_t passes = (limit - cycles) / loop->pass;
+    if (passes > left)
+        passes = left;
+    if (!passes)
+        return 0;
+
+    uint16_t *dst = pair_ref(cpu, loop->dst);
+
+    if (loop->src == NO_PAIR) {
+        uint8_t value = loop->value == NO_REG ? loop->imm : *register_ref(cpu, loop->value);
+        fill(cpu_memory(cpu), *dst, value, passes);
+    } else {
+        uint16_t *src = pair_ref(cpu, loop->src);
+        cpu->A = copy(cpu_memory(cpu), *dst, *src, passes);
+        *src += passes;
+    }
+    *dst += passes;
+
+    // Only the exit test changes flags, so the last pass's test sets all of them
+    if (loop->counter == UNTIL_H) {
+        cpu->A = cpu->H;
+        set_flags_arith(cpu, (uint16_t)cpu->A - loop->end, cpu->A, loop->end);
+    } else {
+        uint8_t *counter = register_ref(cpu, loop->counter);
+        *counter -= passes;
+        update_SZP(cpu, *counter);
+    }
+
+    if (passes == left)
+        cpu->PC = loop->exit;
+    return passes * loop->pass;
+}
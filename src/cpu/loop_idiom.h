@@ -0,0 +1,38 @@
+#ifndef LOOP_IDIOM_H
+#define LOOP_IDIOM_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "memory.h"
+
+// Loop idioms: ROM loops that fill or copy a run of memory one byte a pass.
+//
+// loop_idiom_find looks at the target of every backward JNZ and keeps the
+// loops whose body is nothing but one store through a register pair (of an
+// immediate, a register the body leaves alone, or a byte just loaded through
+// another pair), an INX of each pair used, and an exit test: DCR r, or
+// MOV A,H; CPI d8 on the stored-to or loaded-from HL. Any such loop has a
+// pass count known on entry, so loop_idiom_run does all the passes that fit
+// the cycle limit as one memset or memmove over the memory array and then
+// sets the pointers, the counter, A and the flags to what the last pass left.
+
+// 1 + index of the loop starting at each ROM address, 0 if none
+extern uint8_t loop_idiom_index[ROM_SIZE];
+
+void loop_idiom_set_enabled(int enabled);
+int loop_idiom_enabled(void);
+
+// Called from decode_cache_build once the ROM is decoded
+void loop_idiom_find(const uint8_t *rom);
+
+/**
+ * Runs passes of the loop at cpu->PC, for a core that found loop_idiom_index[cpu->PC] set
+ *
+ * @param cycles  Cycles used so far in this run call
+ * @param limit   Cycles the run call stops at
+ * @return        Cycles used, 0 if the core should run the instruction itself;
+ *                PC is left on the loop head, or after the JNZ once the loop ends
+ */
+uint32_t loop_idiom_run(CPU *cpu, uint32_t cycles, uint32_t limit);
+
+#endif
@@ -0,0 +1,103 @@
+#include "profile.h"
+#include "decode_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Profiling pass for superinstruction fusion.
+//
+// The threaded core counts how often each ROM address runs. Because the ROM
+// never changes, an opcode pair at pc executes in sequence exactly as often as
+// pc itself whenever the first opcode cannot branch, so the per-address counts
+// are enough to rank the straight-line pairs and triples worth fusing.
+
+uint32_t profile_hits[ROM_SIZE];
+
+typedef struct {
+    uint32_t key;       // Opcodes, first in the high byte
+    uint64_t count;     // Executions summed over every address
+    uint16_t hottest;   // Address contributing the most
+    uint32_t hottest_count;
+} Sequence;
+
+void profile_reset(void) {
+    memset(profile_hits, 0, sizeof(profile_hits));
+}
+
+// Opcodes after which execution may not continue at the next address
+static int can_branch(uint8_t opcode) {
+    switch (opcode & 0xC7) {
+        case 0xC0: case 0xC2: case 0xC4: case 0xC7:     // Rcc, Jcc, Ccc, RST
+            return 1;
+    }
+    return opcode == 0xC3 || opcode == 0xC9 || opcode == 0xCD || opcode == 0xE9;
+}
+
+static void add_sequence(Sequence *table, unsigned *size, uint32_t key, uint16_t pc) {
+    uint32_t hits = profile_hits[pc];
+    unsigned i;
+
+    for (i = 0; i < *size; i++) {
+        if (table[i].key == key)
+            break;
+    }
+    if (i == *size) {
+        table[i].key = key;
+        table[i].count = 0;
+        table[i].hottest_count = 0;
+        (*size)++;
+    }
+
+    table[i].count += hits;
+    if (hits > table[i].hottest_count) {
+        table[i].hottest = pc;
+        table[i].hottest_count = hits;
+    }
+}
+
+static int by_count(const void *a, const void *b) {
+    const Sequence *x = a, *y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static void print_table(const char *title, Sequence *table, unsigned size, unsigned length, unsigned top) {
+    qsort(table, size, sizeof(Sequence), by_count);
+
+    printf("%s\n", title);
+    for (unsigned i = 0; i < size && i < top; i++) {
+        printf("  ");
+        for (int k = length - 1; k >= 0; k--)
+            printf("%02X ", (table[i].key >> (8 * k)) & 0xFF);
+        printf("%10llu  hottest at %04X (%u)\n",
+               (unsigned long long)table[i].count, table[i].hottest, table[i].hottest_count);
+    }
+}
+
+// Prints the top opcode pairs and triples executed in straight-line ROM code
+void profile_report(unsigned top) {
+    static Sequence pairs[ROM_SIZE];
+    static Sequence triples[ROM_SIZE];
+    unsigned num_pairs = 0, num_triples = 0;
+
+    for (uint32_t pc = 0; pc < ROM_SIZE; pc++) {
+        const DecodedInstruction *first = &decode_cache[pc];
+        if (!profile_hits[pc] || !first->handler || can_branch(first->opcode))
+            continue;
+
+        uint32_t second_pc = pc + first->length;
+        if (second_pc >= ROM_SIZE || !decode_cache[second_pc].handler)
+            continue;
+        const DecodedInstruction *second = &decode_cache[second_pc];
+        add_sequence(pairs, &num_pairs, (first->opcode << 8) | second->opcode, pc);
+
+        uint32_t third_pc = second_pc + second->length;
+        if (can_branch(second->opcode) || third_pc >= ROM_SIZE || !decode_cache[third_pc].handler)
+            continue;
+        add_sequence(triples, &num_triples,
+                     (first->opcode << 16) | (second->opcode << 8) | decode_cache[third_pc].opcode, pc);
+    }
+
+    print_table("Hot opcode pairs:", pairs, num_pairs, 2, top);
+    print_table("Hot opcode triples:", triples, num_triples, 3, top);
+}
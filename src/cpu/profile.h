@@ -0,0 +1,13 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include "memory.h"
+
+// Executions of each ROM address, counted by the threaded core when built with -DCPU_PROFILE=1
+extern uint32_t profile_hits[ROM_SIZE];
+
+void profile_reset(void);
+void profile_report(unsigned top);
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef STATIC_CORE_H
+#define STATIC_CORE_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "update_flags.h"
+#include "input.h"
+#include "output.h"
+#include "machine.h"
+
+#include <stdint.h>
+
+// Statically recompiled core.
+//
+// tools/recompiler.c translates the ROM ahead of time into one C function
+// per basic block (static_blocks.c, generated at build time). Each function
+// is a list of the SR_ statements below, which mirror the threaded core's
+// handlers, and leaves cpu->PC at the next instruction to run.
+//
+// cpu_run_static (cpu_static.c) charges each block's cycles from the decode
+// cache and falls back to the threaded core for addresses without a block.
+
+typedef void (*StaticBlockFn)(CPU *cpu);
+
+typedef struct {
+    uint16_t start;     // Address of the first instruction
+    uint16_t last;      // Address of the last instruction the block charges for
+    StaticBlockFn run;
+} StaticBlock;
+
+// Provided by the generated static_blocks.c
+extern const uint32_t static_rom_checksum;
+extern const StaticBlock static_blocks[];
+extern const unsigned static_block_count;
+
+uint32_t static_rom_hash(const uint8_t *rom);
+
+// Called from decode_cache_build, fills the block tables when the ROM is the one the blocks came from
+void static_install(const uint8_t *rom);
+
+#define SR_HL               cpu->HL
+#define SR_MEM              cpu_memory(cpu)
+
+// 8-bit register ops
+#define SR_MOV(d, s)        cpu->d = cpu->s
+#define SR_MOV_RM(d)        cpu->d = read_memory(SR_MEM, SR_HL)
+#define SR_MOV_MR(s)        write_memory(SR_MEM, SR_HL, cpu->s)
+#define SR_MVI(r, value)    cpu->r = (value)
+#define SR_MVI_M(value)     write_memory(SR_MEM, SR_HL, (value))
+#define SR_INR(r)           cpu->r++; update_SZP(cpu, cpu->r)
+#define SR_DCR(r)           cpu->r--; update_SZP(cpu, cpu->r)
+
+#define SR_INR_M() {                                        \
+        uint16_t address = SR_HL;                           \
+        uint8_t value = read_memory(SR_MEM, address) + 1;   \
+        update_SZP(cpu, value);                             \
+        write_memory(SR_MEM, address, value);               \
+    }
+
+#define SR_DCR_M() {                                        \
+        uint16_t address = SR_HL;                           \
+        uint8_t value = read_memory(SR_MEM, address) - 1;   \
+        update_SZP(cpu, value);                             \
+        write_memory(SR_MEM, address, value);               \
+    }
+
+// Register pair ops
+#define SR_LXI(pair, value)     cpu->pair = (value)
+#define SR_LXI_SP(value)        cpu->SP = (value)
+#define SR_INX(pair)            cpu->pair++
+#define SR_DCX(pair)            cpu->pair--
+#define SR_INX_SP()             cpu->SP++
+#define SR_DCX_SP()             cpu->SP--
+#define SR_SPHL()               cpu->SP = SR_HL
+
+#define SR_DAD(pair) {                                      \
+        uint32_t result = (uint32_t)(pair) + (uint32_t)SR_HL; \
+        update_CY_16bit(cpu, result);                       \
+        SR_HL = (uint16_t)result;                           \
+    }
+
+#define SR_XCHG() {                                         \
+        uint16_t temp = SR_HL;                              \
+        SR_HL = cpu->DE;                                    \
+        cpu->DE = temp;                                     \
+    }
+
+// Loads and stores
+#define SR_LDAX(pair)       cpu->A = read_memory(SR_MEM, cpu->pair)
+#define SR_STAX(pair)       write_memory(SR_MEM, cpu->pair, cpu->A)
+#define SR_LDA(address)     cpu->A = read_memory(SR_MEM, address)
+#define SR_STA(address)     write_memory(SR_MEM, address, cpu->A)
+#define SR_LHLD(address)    cpu->L = read_memory(SR_MEM, address); cpu->H = read_memory(SR_MEM, (uint16_t)((address) + 1))
+#define SR_SHLD(address)    write_memory(SR_MEM, address, cpu->L); write_memory(SR_MEM, (uint16_t)((address) + 1), cpu->H)
+
+// Stack
+#define SR_PUSH(hi, lo)                                     \
+        write_memory(SR_MEM, cpu->SP - 1, cpu->hi);         \
+        write_memory(SR_MEM, cpu->SP - 2, cpu->lo);         \
+        cpu->SP -= 2
+
+#define SR_POP(hi, lo)                                      \
+        cpu->lo = read_memory(SR_MEM, cpu->SP);             \
+        cpu->hi = read_memory(SR_MEM, cpu->SP + 1);         \
+        cpu->SP += 2
+
+#define SR_PUSH_PSW()                                       \
+        write_memory(SR_MEM, cpu->SP - 1, cpu->A);          \
+        write_memory(SR_MEM, cpu->SP - 2, get_flags(cpu));          \
+        cpu->SP -= 2
+
+#define SR_POP_PSW()                                        \
+        set_flags(cpu, (read_memory(SR_MEM, cpu->SP) & ~0x28) | FLAG_ONE); \
+        cpu->A = read_memory(SR_MEM, cpu->SP + 1);          \
+        cpu->SP += 2
+
+#define SR_XTHL() {                                         \
+        uint8_t l = cpu->L;                                 \
+        cpu->L = read_memory(SR_MEM, cpu->SP);              \
+        write_memory(SR_MEM, cpu->SP, l);                   \
+        uint8_t h = cpu->H;                                 \
+        cpu->H = read_memory(SR_MEM, cpu->SP + 1);          \
+        write_memory(SR_MEM, cpu->SP + 1, h);               \
+    }
+
+// Accumulator ops, operand evaluated once
+#define SR_ADD(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value; \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+    }
+
+#define SR_ADC(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY); \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+    }
+
+#define SR_SUB(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value; \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+    }
+
+#define SR_SBB(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value - (uint16_t)(get_flags(cpu) & FLAG_CY); \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+        cpu->A = result & 0xFF;                             \
+    }
+
+#define SR_ANA(operand)                                     \
+        cpu->A &= (operand);                                \
+        set_flags_logic(cpu, cpu->A, (cpu->A & 0x08) ? FLAG_AC : 0)
+
+#define SR_XRA(operand)                                     \
+        cpu->A ^= (operand);                                \
+        set_flags_logic(cpu, cpu->A, 0)
+
+#define SR_ORA(operand)                                     \
+        cpu->A |= (operand);                                \
+        set_flags_logic(cpu, cpu->A, 0)
+
+#define SR_CMP(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value; \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+    }
+
+// The immediate forms differ from the register forms in flags, like the interpreter:
+// ADI/ACI take AC from the new A and ORI keeps AC
+#define SR_ADI(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value; \
+        cpu->A = result & 0xFF;                             \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+    }
+
+#define SR_ACI(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A + (uint16_t)value + (uint16_t)(get_flags(cpu) & FLAG_CY); \
+        cpu->A = result & 0xFF;                             \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+    }
+
+#define SR_LOGIC_IMM(op)                                    \
+        op;                                                 \
+        set_flags_logic(cpu, cpu->A, 0)
+
+#define SR_ANI(operand)     SR_LOGIC_IMM(cpu->A &= (operand))
+#define SR_XRI(operand)     SR_LOGIC_IMM(cpu->A ^= (operand))
+
+#define SR_ORI(operand)                                     \
+        cpu->A |= (operand);                                \
+        set_flags_logic(cpu, cpu->A, get_flags(cpu) & FLAG_AC)
+
+#define SR_CPI(operand) {                                   \
+        uint8_t value = (operand);                          \
+        uint16_t result = (uint16_t)cpu->A - (uint16_t)value; \
+        set_flags_arith(cpu, result, cpu->A, value);        \
+    }
+
+// Rotates and flag ops
+#define SR_RLC()                                            \
+        update_CY(cpu, cpu->A & 0x80);                      \
+        cpu->A = (cpu->A << 1) | (cpu->A >> 7)
+
+#define SR_RRC()                                            \
+        update_CY(cpu, cpu->A & 1);                         \
+        cpu->A = (cpu->A >> 1) | (cpu->A << 7)
+
+#define SR_RAL() {                                          \
+        uint8_t bit7 = (cpu->A >> 7) & 1;                   \
+        cpu->A = (cpu->A << 1) | (get_flags(cpu) & FLAG_CY);        \
+        update_CY(cpu, bit7);                               \
+    }
+
+#define SR_RAR() {                                          \
+        uint8_t bit0 = cpu->A & 1;                          \
+        cpu->A = (cpu->A >> 1) | ((get_flags(cpu) & FLAG_CY) << 7); \
+        update_CY(cpu, bit0);                               \
+    }
+
+#define SR_NOP()
+#define SR_CMA()            cpu->A = ~cpu->A
+#define SR_STC()            set_flags(cpu, get_flags(cpu) | FLAG_CY)
+#define SR_CMC()            set_flags(cpu, get_flags(cpu) ^ FLAG_CY)
+#define SR_EI()             cpu->interrupts_enabled = 1
+#define SR_DI()             cpu->interrupts_enabled = 0
+#define SR_IN(port)         cpu->A = machine_in(machine_of(cpu), port)
+
+// Runs one instruction the recompiler does not translate through the threaded core
+#define SR_INTERPRET(pc)    cpu->PC = (pc); cpu_run_threaded(cpu, 1)
+
+// Block exits, each sets the PC to continue from
+#define SR_EXIT(pc)                     { cpu->PC = (pc); return; }
+#define SR_JMP(target)                  SR_EXIT(target)
+#define SR_JCOND(cond, target, next)    { cpu->PC = (cond) ? (target) : (next); return; }
+#define SR_CALL(target, next)           { call(cpu, target, next); return; }
+#define SR_CCOND(cond, target, next)    { if (cond) call(cpu, target, next); else cpu->PC = (next); return; }
+#define SR_RET()                        { ret(cpu); return; }
+#define SR_RCOND(cond, next)            { if (cond) ret(cpu); else cpu->PC = (next); return; }
+#define SR_PCHL()                       { cpu->PC = SR_HL; return; }
+
+#endif
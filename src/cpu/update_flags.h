@@ -4,10 +4,125 @@
 #include "cpu.h"
 #include <stdint.h>
 
-void reset_flags(CPU *cpu);
-void update_SZP(CPU *cpu, uint8_t value);
-void update_AC(CPU *cpu, uint8_t before, uint8_t after);
-void update_CY_8bit(CPU *cpu, uint16_t result);
-void update_CY_16bit(CPU *cpu, uint32_t result);
+// Lookup tables in update_flags.c, entries are already in FLAG_* bit positions
+extern const uint8_t szp_table[256];  // S, Z, P and FLAG_ONE for a result byte
+extern const uint8_t ac_table[256];   // FLAG_AC when (a & 0xF) + (b & 0xF) > 0xF
 
-#endif // UPDATE_FLAGS_H
\ No newline at end of file
+#define AC_INDEX(a, b) ((((a) & 0x0F) << 4) | ((b) & 0x0F))
+
+// Every core reads flags through get_flags and replaces them through set_flags.
+//
+// With CPU_LAZY_FLAGS=1 the ALU helpers below only record the op kind, its
+// operands and its result in cpu->flag_*; get_flags folds that into F the
+// first time anything reads it (conditional jump/call/ret, PUSH PSW, DAA,
+// ADC/SBB carry in, print_status). With 0 they write F straight away.
+enum {
+    FLAGS_RESOLVED,     // F is up to date
+    FLAGS_ARITH,        // szp(result) | ac(a, b) | carry out of result
+    FLAGS_LOGIC,        // szp(result) | b (0 or FLAG_AC)
+    FLAGS_SZP           // szp(result) | the CY/AC bits still in F
+};
+
+#if CPU_LAZY_FLAGS
+
+static inline uint8_t resolve_flags(CPU *cpu) {
+    switch (cpu->flag_op) {
+        case FLAGS_ARITH:
+            cpu->F = szp_table[cpu->flag_result & 0xFF] | ac_table[AC_INDEX(cpu->flag_a, cpu->flag_b)] |
+                     ((cpu->flag_result >> 8) & FLAG_CY);
+            break;
+        case FLAGS_LOGIC:
+            cpu->F = szp_table[cpu->flag_result & 0xFF] | cpu->flag_b;
+            break;
+        case FLAGS_SZP:
+            cpu->F |= szp_table[cpu->flag_result & 0xFF];
+            break;
+    }
+    cpu->flag_op = FLAGS_RESOLVED;
+    return cpu->F;
+}
+
+static inline uint8_t get_flags(CPU *cpu) {
+    return cpu->flag_op == FLAGS_RESOLVED ? cpu->F : resolve_flags(cpu);
+}
+
+static inline void set_flags(CPU *cpu, uint8_t flags) {
+    cpu->F = flags;
+    cpu->flag_op = FLAGS_RESOLVED;
+}
+
+static inline void set_flags_arith(CPU *cpu, uint16_t result, uint8_t a, uint8_t b) {
+    cpu->flag_op = FLAGS_ARITH;
+    cpu->flag_result = result;
+    cpu->flag_a = a;
+    cpu->flag_b = b;
+}
+
+static inline void set_flags_logic(CPU *cpu, uint8_t result, uint8_t ac) {
+    cpu->flag_op = FLAGS_LOGIC;
+    cpu->flag_result = result;
+    cpu->flag_b = ac;
+}
+
+// F keeps only CY and AC while an SZP record is pending
+static inline void update_SZP(CPU *cpu, uint8_t value) {
+    if (cpu->flag_op != FLAGS_SZP)
+        cpu->F = get_flags(cpu) & (FLAG_CY | FLAG_AC);
+    cpu->flag_op = FLAGS_SZP;
+    cpu->flag_result = value;
+}
+
+#else
+
+static inline uint8_t get_flags(CPU *cpu) {
+    return cpu->F;
+}
+
+static inline void set_flags(CPU *cpu, uint8_t flags) {
+    cpu->F = flags;
+}
+
+// ADD/ADC/SUB/SBB/CMP: every flag in one store. Bit 8 of result is the carry
+// out of an add or the borrow of a subtract; AC is the nibble add of a and b
+// for both, as update_AC has always done.
+static inline void set_flags_arith(CPU *cpu, uint16_t result, uint8_t a, uint8_t b) {
+    cpu->F = szp_table[result & 0xFF] | ac_table[AC_INDEX(a, b)] | ((result >> 8) & FLAG_CY);
+}
+
+// ANA/XRA/ORA and the immediates: SZP of the result, CY clear, ac is 0 or FLAG_AC
+static inline void set_flags_logic(CPU *cpu, uint8_t result, uint8_t ac) {
+    cpu->F = szp_table[result] | ac;
+}
+
+// INR/DCR: S, Z and P from value, CY and AC are kept
+static inline void update_SZP(CPU *cpu, uint8_t value) {
+    cpu->F = (cpu->F & (FLAG_CY | FLAG_AC)) | szp_table[value];
+}
+
+#endif
+
+// Out of line get_flags for generated code (jit_x64.c)
+uint8_t cpu_get_flags(CPU *cpu);
+
+static inline void reset_flags(CPU *cpu) {
+    set_flags(cpu, FLAG_ONE);
+}
+
+// Single-flag updates for the instructions that keep the other flags
+static inline void update_AC(CPU *cpu, uint8_t before, uint8_t after) {
+    set_flags(cpu, (get_flags(cpu) & ~FLAG_AC) | ac_table[AC_INDEX(before, after)]);
+}
+
+static inline void update_CY(CPU *cpu, int carry) {
+    set_flags(cpu, (get_flags(cpu) & ~FLAG_CY) | (carry ? FLAG_CY : 0));
+}
+
+static inline void update_CY_8bit(CPU *cpu, uint16_t result) {
+    update_CY(cpu, result > 0xFF);
+}
+
+static inline void update_CY_16bit(CPU *cpu, uint32_t result) {
+    update_CY(cpu, result > 0xFFFF);
+}
+
+#endif // UPDATE_FLAGS_H
@@ -0,0 +1,10 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <stdint.h>
+#include "machine.h"
+
+// SDL front end only: sets input ports 0-2 from SDL_GetKeyboardState
+void input_update(Machine *machine, const uint8_t *state);
+
+#endif
@@ -2,11 +2,12 @@
 #define OUTPUT_H
 
 #include <stdint.h>
-#include "cpu.h"
+#include "machine.h"
 
-#define NUM_OUTPUT_PORTS 8
+uint8_t output_read(Machine *machine, uint8_t port);
+void machine_out(Machine *machine, uint8_t port, uint8_t value);
 
-uint8_t output_read(uint8_t port);
-void machine_out(CPU *cpu, uint8_t port, uint8_t value);
+// Port 3 input: the shift register's top byte after shifting by the port 2 offset
+uint8_t read_shift_register(Machine *machine);
 
 #endif
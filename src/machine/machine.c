@@ -0,0 +1,365 @@
+#include "machine.h"
+#include "input.h"
+#include "update_flags.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// The CPU at the start of a Machine begins on a cache line so its hot fields
+// share one (see cpu.h), and the size is rounded up to whole lines so no
+// other allocation lands on them
+static Machine *machine_alloc(void) {
+    size_t size = (sizeof(Machine) + CPU_CACHE_LINE - 1) & ~(size_t)(CPU_CACHE_LINE - 1);
+#ifdef _WIN32
+    return (Machine*)_aligned_malloc(size, CPU_CACHE_LINE);
+#else
+    void *machine = NULL;
+    return posix_memalign(&machine, CPU_CACHE_LINE, size) ? NULL : (Machine*)machine;
+#endif
+}
+
+Machine *machine_create(void) {
+    Machine *machine = machine_alloc();
+    if (!machine) error("machine init failed");
+
+    cpu_init(&machine->cpu);
+    memory_init(&machine->memory);
+    reset_ports(machine);
+    machine->sound.play = NULL;
+    machine->frame_cycles = 0;
+    machine->framebuffer = NULL;
+    machine->journal = NULL;
+
+    return machine;
+}
+
+void machine_destroy(Machine *machine) {
+    if (!machine) error("no instance of machine when freeing");
+    machine_set_journal(machine, 0, 0);
+    memory_release(&machine->memory);
+    free(machine->framebuffer);
+#ifdef _WIN32
+    _aligned_free(machine);
+#else
+    free(machine);
+#endif
+}
+
+static void framebuffer_update(Machine *machine) {
+    if (machine->framebuffer)
+        memory_get_ram(&machine->memory, VIDEO_RAM_START - RAM_START, machine->framebuffer, VIDEO_RAM_SIZE);
+}
+
+const uint8_t *machine_framebuffer(Machine *machine) {
+    if (!machine->framebuffer) {
+        machine->framebuffer = (uint8_t*)malloc(VIDEO_RAM_SIZE);
+        if (!machine->framebuffer) error("framebuffer allocation failed");
+        framebuffer_update(machine);
+    }
+    return machine->framebuffer;
+}
+
+/*** Journal ***/
+
+// Everything but RAM, as it was when Memory.journal->written was position
+typedef struct {
+    CPU cpu;
+    Ports ports;
+    uint32_t frame_cycles;
+    uint64_t position;
+} Checkpoint;
+
+struct MachineJournal {
+    MemoryJournal memory;
+    Checkpoint *checkpoint;     // Ring of capacity, the newest at taken - 1
+    int capacity;               // Frames to keep + 1
+    uint64_t taken;             // Since the history last started over
+    uint64_t oldest;            // First still in the ring; a rollback doesn't bring back what it overwrote
+};
+
+static void journal_checkpoint(Machine *machine) {
+    MachineJournal *journal = machine->journal;
+    Checkpoint *checkpoint = &journal->checkpoint[journal->taken++ % journal->capacity];
+
+    if (journal->taken - journal->oldest > (uint64_t)journal->capacity)
+        journal->oldest = journal->taken - journal->capacity;
+
+    checkpoint->cpu = machine->cpu;
+    checkpoint->ports = machine->ports;
+    checkpoint->frame_cycles = machine->frame_cycles;
+    checkpoint->position = journal->memory.written;
+}
+
+// Rollback stops at the state the machine is in now
+static void journal_restart(Machine *machine) {
+    if (!machine->journal)
+        return;
+    machine->journal->memory.written = 0;
+    machine->journal->taken = 0;
+    machine->journal->oldest = 0;
+    journal_checkpoint(machine);
+}
+
+int machine_set_journal(Machine *machine, int frames, uint32_t entries) {
+    MachineJournal *journal = machine->journal;
+
+    if (journal) {
+        memory_set_journal(&machine->memory, NULL);
+        free(journal->memory.entries);
+        free(journal->checkpoint);
+        free(journal);
+        machine->journal = NULL;
+    }
+    if (frames <= 0)
+        return 0;
+
+    uint32_t size = 1;
+    while (size < entries && size < 0x80000000u)
+        size <<= 1;
+
+    journal = (MachineJournal*)calloc(1, sizeof(MachineJournal));
+    if (!journal) return -1;
+    journal->memory.entries = (JournalEntry*)malloc((size_t)size * sizeof(JournalEntry));
+    journal->checkpoint = (Checkpoint*)malloc((size_t)(frames + 1) * sizeof(Checkpoint));
+    if (!journal->memory.entries || !journal->checkpoint) {
+        free(journal->memory.entries);
+        free(journal->checkpoint);
+        free(journal);
+        return -1;
+    }
+    journal->memory.mask = size - 1;
+    journal->capacity = frames + 1;
+
+    machine->journal = journal;
+    memory_set_journal(&machine->memory, &journal->memory);
+    journal_restart(machine);
+    return 0;
+}
+
+int machine_rollback(Machine *machine, int frames) {
+    MachineJournal *journal = machine->journal;
+
+    if (!journal || frames < 0 || (uint64_t)frames >= journal->taken - journal->oldest)
+        return -1;
+
+    uint64_t target = journal->taken - 1 - (uint64_t)frames;
+    const Checkpoint *checkpoint = &journal->checkpoint[target % journal->capacity];
+    if (memory_journal_undo(&machine->memory, checkpoint->position) != 0)
+        return -1;
+
+    // The core is a setting, not state
+    CpuCore core = machine->cpu.core;
+    machine->cpu = checkpoint->cpu;
+    machine->cpu.core = core;
+    machine->ports = checkpoint->ports;
+    machine->frame_cycles = checkpoint->frame_cycles;
+    journal->taken = target + 1;
+    framebuffer_update(machine);
+    return 0;
+}
+
+void machine_reset(Machine *machine) {
+    cpu_reset(&machine->cpu);
+    memory_clear(&machine->memory);
+    reset_ports(machine);
+    machine->frame_cycles = 0;
+    framebuffer_update(machine);
+    journal_restart(machine);
+}
+
+void machine_clone(Machine *dst, Machine *src) {
+    if (dst == src)
+        return;
+
+    dst->cpu = src->cpu;
+    dst->ports = src->ports;
+    dst->sound = src->sound;
+    dst->frame_cycles = src->frame_cycles;
+    memory_copy(&dst->memory, &src->memory);
+    framebuffer_update(dst);
+    journal_restart(dst);
+}
+
+void machine_run_frame(Machine *machine) {
+    CPU *cpu = &machine->cpu;
+    uint32_t cycles = machine->frame_cycles;
+
+    if (cycles < CYCLES_PER_FRAME / 2) {
+        cycles += cpu_run_cycles(cpu, CYCLES_PER_FRAME - cycles, CYCLES_PER_FRAME / 2 - cycles);
+        if (cpu->interrupts_enabled)
+            generate_interrupt(cpu, 1);  // Mid-frame interrupt
+    }
+    cycles += cpu_run_cycles(cpu, CYCLES_PER_FRAME - cycles, CPU_NO_DEADLINE);
+
+    // VBlank interrupt
+    if (cpu->interrupts_enabled)
+        generate_interrupt(cpu, 2);
+
+    machine->frame_cycles = cycles - CYCLES_PER_FRAME;
+    machine_frame_done(machine);
+}
+
+void machine_frame_done(Machine *machine) {
+    framebuffer_update(machine);
+    if (machine->journal)
+        journal_checkpoint(machine);
+}
+
+/*** Clone pool ***/
+
+struct MachinePool {
+    Machine **spare;
+    int count;
+    int capacity;
+};
+
+MachinePool *machine_pool_create(int reserve) {
+    MachinePool *pool = (MachinePool*)calloc(1, sizeof(MachinePool));
+    if (!pool) error("machine pool init failed");
+
+    for (int i = 0; i < reserve; i++)
+        machine_pool_release(pool, machine_create());
+    return pool;
+}
+
+void machine_pool_destroy(MachinePool *pool) {
+    if (!pool) return;
+
+    for (int i = 0; i < pool->count; i++)
+        machine_destroy(pool->spare[i]);
+    free(pool->spare);
+    free(pool);
+}
+
+Machine *machine_pool_clone(MachinePool *pool, Machine *src) {
+    Machine *machine = pool->count ? pool->spare[--pool->count] : machine_create();
+    machine_clone(machine, src);
+    return machine;
+}
+
+void machine_pool_release(MachinePool *pool, Machine *machine) {
+    if (pool->count == pool->capacity) {
+        int capacity = pool->capacity ? pool->capacity * 2 : 64;
+        Machine **spare = (Machine**)realloc(pool->spare, capacity * sizeof(Machine*));
+        if (!spare) error("machine pool grow failed");
+        pool->spare = spare;
+        pool->capacity = capacity;
+    }
+    memory_release(&machine->memory);
+    pool->spare[pool->count++] = machine;
+}
+
+/*** State images ***/
+
+static uint8_t *put16(uint8_t *out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    return out + 2;
+}
+
+static uint8_t *put32(uint8_t *out, uint32_t value) {
+    return put16(put16(out, (uint16_t)value), (uint16_t)(value >> 16));
+}
+
+static uint16_t get16(const uint8_t *in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *in) {
+    return get16(in) | ((uint32_t)get16(in + 2) << 16);
+}
+
+size_t machine_save_state(const Machine *machine, uint8_t *state, size_t size) {
+    const CPU *cpu = &machine->cpu;
+    const Ports *ports = &machine->ports;
+    uint8_t *out = state;
+
+    if (size < MACHINE_STATE_SIZE)
+        return 0;
+
+    out = put32(out, MACHINE_STATE_MAGIC);
+    out = put32(out, MACHINE_STATE_VERSION);
+
+    // Registers, F as PUSH PSW would store it
+    *out++ = cpu->A;
+    *out++ = get_flags((CPU *)cpu);
+    *out++ = cpu->B; *out++ = cpu->C;
+    *out++ = cpu->D; *out++ = cpu->E;
+    *out++ = cpu->H; *out++ = cpu->L;
+    out = put16(out, cpu->SP);
+    out = put16(out, cpu->PC);
+    out = put32(out, cpu->cycles);
+    *out++ = cpu->interrupts_enabled;
+
+    memcpy(out, ports->input, NUM_INPUT_PORTS);
+    out += NUM_INPUT_PORTS;
+    memcpy(out, ports->output, NUM_OUTPUT_PORTS);
+    out += NUM_OUTPUT_PORTS;
+    out = put16(out, ports->shift_register);
+    *out++ = ports->shift_offset;
+    *out++ = ports->button_state;
+
+    out = put32(out, machine->frame_cycles);
+    memory_get_ram(&machine->memory, 0, out, RAM_SIZE);
+    return MACHINE_STATE_SIZE;
+}
+
+int machine_load_state(Machine *machine, const uint8_t *state, size_t size) {
+    CPU *cpu = &machine->cpu;
+    Ports *ports = &machine->ports;
+    const uint8_t *in = state + 8;
+
+    if (size < MACHINE_STATE_SIZE || get32(state) != MACHINE_STATE_MAGIC ||
+        get32(state + 4) != MACHINE_STATE_VERSION)
+        return -1;
+
+    cpu->A = in[0];
+    set_flags(cpu, in[1]);
+    cpu->B = in[2]; cpu->C = in[3];
+    cpu->D = in[4]; cpu->E = in[5];
+    cpu->H = in[6]; cpu->L = in[7];
+    cpu->SP = get16(in + 8);
+    cpu->PC = get16(in + 10);
+    cpu->cycles = get32(in + 12);
+    cpu->interrupts_enabled = in[16];
+    in += 17;
+
+    memcpy(ports->input, in, NUM_INPUT_PORTS);
+    in += NUM_INPUT_PORTS;
+    memcpy(ports->output, in, NUM_OUTPUT_PORTS);
+    in += NUM_OUTPUT_PORTS;
+    ports->shift_register = get16(in);
+    ports->shift_offset = in[2] & 7;
+    ports->button_state = in[3];
+    in += 4;
+
+    machine->frame_cycles = get32(in);
+    memory_set_ram(&machine->memory, 0, in + 4, RAM_SIZE);
+    framebuffer_update(machine);
+    journal_restart(machine);
+    return 0;
+}
+
+uint64_t machine_state_hash(const Machine *machine) {
+    const CPU *cpu = &machine->cpu;
+    const Ports *ports = &machine->ports;
+    uint64_t words[5], hash = memory_hash(&machine->memory);
+
+    words[0] = cpu->A | (uint64_t)get_flags((CPU *)cpu) << 8 | (uint64_t)cpu->BC << 16 |
+               (uint64_t)cpu->DE << 32 | (uint64_t)cpu->HL << 48;
+    words[1] = cpu->SP | (uint64_t)cpu->PC << 16 | (uint64_t)cpu->interrupts_enabled << 32;
+    words[2] = machine->frame_cycles | (uint64_t)ports->shift_register << 32 |
+               (uint64_t)ports->shift_offset << 48 | (uint64_t)ports->button_state << 56;
+    words[3] = 0;
+    words[4] = 0;
+    memcpy(&words[3], ports->input, NUM_INPUT_PORTS);
+    memcpy(&words[4], ports->output, NUM_OUTPUT_PORTS);
+
+    for (int i = 0; i < 5; i++)
+        hash = hash_mix(hash ^ words[i]);
+    return hash;
+}
@@ -0,0 +1,139 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "memory.h"
+
+#define NUM_INPUT_PORTS     4   // 4 Input ports used in Space Invaders
+#define NUM_OUTPUT_PORTS    8
+
+#define CPU_CLOCK           2000000     // CPU clock speed in Hz (2 MHz)
+#define FRAME_RATE          60          // Interrupt pairs per second
+#define CYCLES_PER_FRAME    (CPU_CLOCK / FRAME_RATE)
+
+// machine_save_state output: a versioned little-endian byte image, the same on every build
+#define MACHINE_STATE_MAGIC     0x31564E49u     // "INV1"
+#define MACHINE_STATE_VERSION   1
+#define MACHINE_STATE_SIZE      (8 + 17 + NUM_INPUT_PORTS + NUM_OUTPUT_PORTS + 4 + 4 + RAM_SIZE)
+
+// I/O ports, with the shift register behind ports 2, 3 and 4
+typedef struct {
+    uint8_t input[NUM_INPUT_PORTS];
+    uint8_t output[NUM_OUTPUT_PORTS];
+    uint16_t shift_register;    // 16-bit shift register
+    uint8_t shift_offset;       // 3-bit shift amount
+    uint8_t button_state;       // Ships DIP switch, stepped by input_update
+} Ports;
+
+typedef struct {
+    void (*play)(int sound);    // Called with port 3/5 writes, play_sound in the SDL front end; NULL is silent
+} SoundState;
+
+// One emulated cabinet. Everything an instance changes lives here, so any
+// number of machines can run side by side, each on its own thread; what they
+// share (the ROM image and the tables built from it) is read-only once
+// load_rom_into_mem is done.
+typedef struct Machine {
+    CPU cpu;            // First, so machine_of gets back from the CPU the cores work on
+    Ports ports;
+    SoundState sound;
+    uint32_t frame_cycles;  // Cycles the last frame ran past its end, taken off the next one
+    Memory memory;
+    uint8_t *framebuffer;   // VRAM copy behind machine_framebuffer, NULL until it is asked for
+    struct MachineJournal *journal;     // machine_set_journal's rings, NULL while it is off
+} Machine;
+
+typedef struct MachineJournal MachineJournal;
+
+Machine *machine_create(void);
+void machine_destroy(Machine *machine);
+
+// Back to power-on: registers, ports and RAM cleared, core and page attributes kept
+void machine_reset(Machine *machine);
+
+/**
+ * Makes dst a copy of src that runs on independently from there: registers,
+ * core, ports, sound hook, frame position, RAM and page attributes. The ROM
+ * and the tables decoded from it are shared by every machine already, and
+ * RAM pages are shared copy-on-write (see memory_copy), so no RAM is copied
+ * until one of the two writes it.
+ */
+void machine_clone(Machine *dst, Machine *src);
+
+// Spare machines for callers that fork thousands of times a second (tree
+// search), so a fork is a copy and not an allocation. A pool is not locked:
+// one per thread, though a machine may be released into any pool.
+typedef struct MachinePool MachinePool;
+
+MachinePool *machine_pool_create(int reserve);     // Starts with reserve spare machines
+void machine_pool_destroy(MachinePool *pool);      // Destroys the spares, not machines still out
+
+// A spare machine (a new one if none is left) made a clone of src
+Machine *machine_pool_clone(MachinePool *pool, Machine *src);
+
+// Hands a machine from any pool, or from machine_create, back as a spare; its RAM
+// pages are let go, so the machines still running stop sharing them
+void machine_pool_release(MachinePool *pool, Machine *machine);
+
+// Runs one frame on cpu->core: up to mid-frame and RST 1, then to the end of the frame and RST 2
+void machine_run_frame(Machine *machine);
+
+// What machine_run_frame does once a frame is over (framebuffer copy, journal
+// checkpoint), for code that runs the frame itself, like lockstep.c
+void machine_frame_done(Machine *machine);
+
+/**
+ * Keeps what machine_rollback needs to go back up to frames frames: the
+ * registers, ports and frame position after every frame, and the byte each
+ * RAM write replaced (memory_set_journal), each in a ring. Resetting, loading
+ * a state or cloning into the machine starts the history over.
+ *
+ * @param frames   Frames kept, 0 turns journaling off
+ * @param entries  RAM writes kept, rounded up to a power of two; the game makes
+ *                 about 180 a frame
+ * @return         0, or -1 if out of memory (journaling is then off)
+ */
+int machine_set_journal(Machine *machine, int frames, uint32_t entries);
+
+/**
+ * Undoes the last frames frames (0: only what changed since the last one
+ * ended), replaying the journal backwards. The core and sound hook stay.
+ *
+ * @return  0, or -1 if journaling is off or the rings no longer reach back
+ *          that far (machine unchanged)
+ */
+int machine_rollback(Machine *machine, int frames);
+
+// VIDEO_RAM_SIZE bytes of VRAM in one piece, brought up to date after every
+// frame, reset, clone and state load until machine_destroy
+const uint8_t *machine_framebuffer(Machine *machine);
+
+/**
+ * Copies everything the game can change (registers, ports, RAM) to or from a byte image
+ *
+ * @param size  Bytes at state, at least MACHINE_STATE_SIZE
+ * @return      machine_save_state: bytes written, 0 if size is too small;
+ *              machine_load_state: 0, or -1 if state is not a matching image (machine unchanged)
+ */
+size_t machine_save_state(const Machine *machine, uint8_t *state, size_t size);
+int machine_load_state(Machine *machine, const uint8_t *state, size_t size);
+
+/**
+ * 64-bit hash of everything a state image holds but the cycle counter, so
+ * machines that will run on the same from here hash the same. Constant time
+ * once memory_set_hashing is on for the machine's Memory (clones keep it on);
+ * otherwise it hashes all of RAM.
+ */
+uint64_t machine_state_hash(const Machine *machine);
+
+static inline Machine *machine_of(CPU *cpu) {
+    return (Machine *)cpu;
+}
+
+static inline Memory *cpu_memory(CPU *cpu) {
+    return &machine_of(cpu)->memory;
+}
+
+#endif
@@ -1,27 +1,34 @@
 #include "utils.h"
 #include "cpu.h"
 #include "input.h"
+#include "keyboard.h"
 #include "output.h"
 #include "memory.h"
+#include "machine.h"
+#include "profile.h"
+#include "cli.h"
+#include "headless.h"
 
 #include "sound.h"
-#include "video.h"
+#include "video_sdl.h"
 
 #include <SDL.h>
 #include <stdio.h>
-
-#define CPU_CLOCK 2000000  // CPU clock speed in Hz (2 MHz)
-#define FRAMES_PER_SECOND 60  // The frame rate (60 FPS)
-
-#define CYCLES_PER_FRAME (CPU_CLOCK / FRAMES_PER_SECOND)
+#include <string.h>
 
 int main(int argc, char* argv[]) {
 
-    CPU *cpu = cpu_init();
-    memory_init();
-    load_rom_into_mem();
+    // Options and defaults in cli.c, --help lists them
+    CliOptions options;
+    cli_parse(&options, argc, argv);
+    if (options.headless)
+        return run_headless(&options);     // Before anything touches SDL
+
+    Machine *machine = machine_create();   // CPU, RAM and zeroed ports
+    machine->cpu.core = options.core;
+    cli_load_rom(&options);
     audio_init();      // Initialize audio for sound effects
-    reset_ports();     // Reset input/output ports
+    machine->sound.play = play_sound;
 
     printf("Finished initializations\n");
 
@@ -30,32 +37,17 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    SDL_Window* window = SDL_CreateWindow("Space Invaders", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-    if (!window) {
-        printf("Failed to create window: %s\n", SDL_GetError());
-        SDL_Quit();
-        return 1;
-    }
-
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer) {
-        printf("Failed to create renderer: %s\n", SDL_GetError());
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return 1;
-    }
-
-    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
-    if (!texture) {
-        printf("Failed to create texture: %s\n", SDL_GetError());
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
+    VideoSink *video = video_sdl_create();
+    if (!video) {
         SDL_Quit();
         return 1;
     }
+    VideoSink *record = cli_record_create(&options);    // --record / --record-ppm, NULL otherwise
 
     int running = 1;
-    uint32_t current_cycles = 0;
+    uint32_t frame = 0;
+    FramePacer pacer;
+    pacer_start(&pacer, options.speed);
 
     while (running) {
         // Handle events (e.g., SDL_QUIT)
@@ -67,55 +59,42 @@ int main(int argc, char* argv[]) {
         }
 
         // Update input state from keyboard
-        input_update(SDL_GetKeyboardState(NULL));
-
-        // Emulate CPU
-        while (current_cycles < CYCLES_PER_FRAME) {
-            uint16_t instruction_cycles = cpu_execute_instruction(cpu);
-            current_cycles += instruction_cycles;
-
-            // Check for mid-frame interrupt
-            if (current_cycles >= CYCLES_PER_FRAME / 2 && current_cycles < (CYCLES_PER_FRAME / 2 + instruction_cycles)) {
-                if (cpu->interrupts_enabled)
-                    generate_interrupt(cpu, 1);  // Mid-frame interrupt
-            }
-        }
+        input_update(machine, SDL_GetKeyboardState(NULL));
 
-        // VBlank interrupt
-        if (cpu->interrupts_enabled)
-            generate_interrupt(cpu, 2);
-
-        // Reset cycle count for the next frame
-        current_cycles -= CYCLES_PER_FRAME;
+        // Emulate CPU up to the mid-frame interrupt, then on to the end of the frame and VBlank,
+        // then handle output effects
+        cli_run_frame(machine);
 
         // Update display
-        update_texture(texture, cpu);
-
-        // Clear and present the renderer
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
+        video_present(video, machine);
+        if (record)
+            video_present(record, machine);
 
-        // Handle output effects based on CPU state or ports
-        for (int port = 0; port < NUM_OUTPUT_PORTS; port++) {
-            uint8_t port_value = output_read(port);  // Read from each output port
-            machine_out(cpu, port, port_value);      // Process output based on port value
-        }
+        if (options.frames && ++frame == options.frames)
+            running = 0;
 
-        SDL_Delay(10000);
+        if (options.speed)
+            pacer_wait(&pacer);
+        else
+            SDL_Delay(10000);
 
         // Sync to maintain 60 FPS
         //sync_to_real_time();
     }
 
+    cli_dump(&options, machine);
+
+#if CPU_PROFILE
+    profile_report(20);  // Candidates for superinstruction fusion
+#endif
+
     // Cleanup resources
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    video_destroy(record);
+    video_destroy(video);
     SDL_Quit();
 
-    cpu_free(cpu);
-    memory_free();
+    machine_destroy(machine);
+    jit_free();
     audio_free();
 
     return 0;
@@ -1,60 +1,367 @@
 #include "memory.h"
 #include "utils.h"
+#include "decode_cache.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static uint8_t * memory;
+uint8_t shared_rom[ROM_SIZE];
 
-void memory_init(void) {
-    memory = (uint8_t *)malloc(MEMORY_SIZE);
-    memset(memory, 0, MEMORY_SIZE);  // Initialize memory to zero
+/*** Page blocks ***/
+
+// bytes first, so a page's host pointer is its block
+typedef struct {
+    uint8_t bytes[PAGE_SIZE];
+    atomic_uint refs;       // Pages pointing here, in any machine
+} RamPage;
+
+// Backs every page no one has written yet; never counted or freed
+static RamPage zero_page;
+
+static inline RamPage *block_of(uint8_t *host) {
+    return (RamPage*)host;
+}
+
+static RamPage *block_alloc(void) {
+    RamPage *block = (RamPage*)malloc(sizeof(RamPage));
+    if (!block) error("ram page allocation failed");
+    atomic_init(&block->refs, 1);
+    return block;
+}
+
+static void block_acquire(RamPage *block) {
+    if (block != &zero_page)
+        atomic_fetch_add_explicit(&block->refs, 1, memory_order_relaxed);
+}
+
+// 1 if that was the last holder and the block is gone
+static int block_release(RamPage *block) {
+    if (block == &zero_page || atomic_fetch_sub_explicit(&block->refs, 1, memory_order_acq_rel) != 1)
+        return 0;
+    free(block);
+    return 1;
+}
+
+/*** RAM hash ***/
+
+// Zobrist key of value at a RAM offset, worked out rather than looked up (a
+// table would be 16 MB); zero bytes are keyed 0, so cleared RAM hashes to 0
+static inline uint64_t hash_key(uint32_t offset, uint8_t value) {
+    return value ? hash_mix(((uint64_t)offset << 8 | value) + 0x9E3779B97F4A7C15ull) : 0;
+}
+
+static uint64_t range_hash(uint32_t offset, const uint8_t *bytes, uint32_t size) {
+    uint64_t hash = 0;
+    for (uint32_t i = 0; i < size; i++)
+        hash ^= hash_key(offset + i, bytes[i]);
+    return hash;
+}
+
+static uint64_t ram_hash(const Memory *memory) {
+    uint64_t hash = 0;
+    for (unsigned page = 0; page < RAM_PAGES; page++)
+        hash ^= range_hash(page << PAGE_SHIFT, memory->pages[page].host, PAGE_SIZE);
+    return hash;
+}
+
+void memory_set_hashing(Memory *memory, int enabled) {
+    if (enabled)
+        memory->hash = ram_hash(memory);
+    for (unsigned page = 0; page < RAM_PAGES; page++) {
+        if (enabled)
+            memory->pages[page].attrs |= PAGE_HASHED;
+        else
+            memory->pages[page].attrs &= ~PAGE_HASHED;
+    }
+}
+
+uint64_t memory_hash(const Memory *memory) {
+    return (memory->pages[0].attrs & PAGE_HASHED) ? memory->hash : ram_hash(memory);
+}
+
+/*** Journal ***/
+
+static inline void journal_record(MemoryJournal *journal, uint32_t offset, uint8_t value) {
+    JournalEntry *entry = &journal->entries[journal->written++ & journal->mask];
+    entry->offset = (uint16_t)offset;
+    entry->value = value;
+}
+
+void memory_set_journal(Memory *memory, MemoryJournal *journal) {
+    memory->journal = journal;
+    for (unsigned page = 0; page < RAM_PAGES; page++) {
+        if (journal)
+            memory->pages[page].attrs |= PAGE_JOURNALED;
+        else
+            memory->pages[page].attrs &= ~PAGE_JOURNALED;
+    }
+}
+
+int memory_journal_undo(Memory *memory, uint64_t position) {
+    MemoryJournal *journal = memory->journal;
+
+    if (!journal || position > journal->written || journal->written - position > (uint64_t)journal->mask + 1)
+        return -1;
+
+    while (journal->written > position) {
+        const JournalEntry *entry = &journal->entries[--journal->written & journal->mask];
+        unsigned page = entry->offset >> PAGE_SHIFT;
+
+        memory_unshare(memory, page);
+        uint8_t *host = &memory->pages[page].host[entry->offset & PAGE_MASK];
+        if (memory->pages[page].attrs & PAGE_HASHED)
+            memory->hash ^= hash_key(entry->offset, *host) ^ hash_key(entry->offset, entry->value);
+        *host = entry->value;
+    }
+    return 0;
+}
+
+/*** Memory ***/
+
+void memory_init(Memory *memory) {
+    memset(memory, 0, sizeof(Memory));
+    for (unsigned page = 0; page < RAM_PAGES; page++) {
+        memory->pages[page].host = zero_page.bytes;
+        memory->pages[page].attrs = PAGE_SHARED;
+    }
+}
+
+void memory_release(Memory *memory) {
+    for (unsigned page = 0; page < RAM_PAGES; page++) {
+        block_release(block_of(memory->pages[page].host));
+        memory->pages[page].host = zero_page.bytes;
+        memory->pages[page].attrs |= PAGE_SHARED;
+    }
+    memory->hash = 0;
+}
+
+void memory_clear(Memory *memory) {
+    for (unsigned page = 0; page < RAM_PAGES; page++) {
+        MemoryPage *entry = &memory->pages[page];
+
+        // Private blocks are reused, shared ones go back to zero_page
+        if (!(entry->attrs & PAGE_SHARED)) {
+            memset(entry->host, 0, PAGE_SIZE);
+        } else if (entry->host != zero_page.bytes) {
+            block_release(block_of(entry->host));
+            entry->host = zero_page.bytes;
+        }
+    }
+    memory->hash = 0;
+}
+
+void memory_copy(Memory *dst, Memory *src) {
+    for (unsigned page = 0; page < RAM_PAGES; page++) {
+        MemoryPage *from = &src->pages[page], *to = &dst->pages[page];
+        uint8_t journaled = to->attrs & PAGE_JOURNALED;
+
+        if (to->host != from->host) {
+            block_acquire(block_of(from->host));
+            block_release(block_of(to->host));
+            to->host = from->host;
+        }
+        from->attrs |= PAGE_SHARED;
+        to->attrs = (from->attrs & ~PAGE_JOURNALED) | journaled;
+    }
+    dst->watch = src->watch;
+    dst->hash = src->hash;
 }
 
-void memory_free() {
-    free(memory);
-    memory = NULL;
+void memory_unshare(Memory *memory, unsigned page) {
+    MemoryPage *entry = &memory->pages[page];
+    RamPage *block = block_of(entry->host);
+
+    if (!(entry->attrs & PAGE_SHARED))
+        return;
+
+    // The other holders may all have copied or let go by now
+    if (block == &zero_page || atomic_load_explicit(&block->refs, memory_order_acquire) != 1) {
+        RamPage *copy = block_alloc();
+        memcpy(copy->bytes, block->bytes, PAGE_SIZE);
+        block_release(block);
+        entry->host = copy->bytes;
+    }
+    entry->attrs &= ~PAGE_SHARED;
+}
+
+void memory_get_ram(const Memory *memory, uint32_t offset, uint8_t *out, uint32_t size) {
+    while (size) {
+        uint32_t run = PAGE_SIZE - (offset & PAGE_MASK);
+        if (run > size) run = size;
+
+        memcpy(out, memory->pages[offset >> PAGE_SHIFT].host + (offset & PAGE_MASK), run);
+        offset += run, out += run, size -= run;
+    }
 }
 
-uint8_t read_memory(uint16_t address) {
-    if (address >= MEMORY_START && address < MEMORY_END)
-        return memory[address];
-    else
-        error("read_memory out of bounds");
+void memory_set_ram(Memory *memory, uint32_t offset, const uint8_t *in, uint32_t size) {
+    while (size) {
+        uint32_t run = PAGE_SIZE - (offset & PAGE_MASK);
+        if (run > size) run = size;
+
+        unsigned page = offset >> PAGE_SHIFT;
+        uint8_t *host = memory->pages[page].host + (offset & PAGE_MASK);
+        if (memcmp(host, in, run) != 0) {
+            if (memory->pages[page].attrs & PAGE_HASHED)
+                memory->hash ^= range_hash(offset, host, run) ^ range_hash(offset, in, run);
+            if (memory->pages[page].attrs & PAGE_JOURNALED)
+                for (uint32_t i = 0; i < run; i++)
+                    if (host[i] != in[i])
+                        journal_record(memory->journal, offset + i, host[i]);
+            memory_unshare(memory, page);
+            memcpy(memory->pages[page].host + (offset & PAGE_MASK), in, run);
+        }
+        offset += run, in += run, size -= run;
+    }
 }
 
-void write_memory(uint16_t address, uint8_t value) {
-    if(address >= ROM_START && address < ROM_END) 
+void memory_write_slow(Memory *memory, uint16_t address, uint8_t value) {
+    if (address < RAM_START)
         error("cannot write to rom");
-    else memory[address] = value;
+
+    MemoryPage *page = &memory->pages[RAM_PAGE(address)];
+    if (page->attrs & PAGE_SHARED)
+        memory_unshare(memory, RAM_PAGE(address));
+    if (page->attrs & PAGE_HASHED)
+        memory->hash ^= hash_key(address & RAM_ADDRESS_MASK, page->host[address & PAGE_MASK]) ^
+                        hash_key(address & RAM_ADDRESS_MASK, value);
+    if (page->attrs & PAGE_JOURNALED)
+        journal_record(memory->journal, address & RAM_ADDRESS_MASK, page->host[address & PAGE_MASK]);
+    page->host[address & PAGE_MASK] = value;
+    if (page->attrs & PAGE_TRACKED)
+        page->attrs |= PAGE_DIRTY;
+    if ((page->attrs & PAGE_WATCHED) && memory->watch)
+        memory->watch(address, value);
 }
 
-void load_rom_into_mem(void) {
-    const char* rom_file_path = "C:\\Users\\hugoz\\OneDrive\\Desktop\\Projects\\SpaceInvaders8080_v2\\roms\\invaders\\invaders";
-    //const char* rom_file_path = "C:\\Users\\hugoz\\OneDrive\\Desktop\\Projects\\SpaceInvaders8080_v2\roms\\invaders\\invaders";
+/*** Deduplication ***/
+
+typedef struct {
+    RamPage *block;
+    MemoryPage *owner;      // A page holding block, marked shared once another joins it
+} DedupSlot;
+
+// FNV-1a over the page, a word at a time
+static uint64_t page_hash(const uint8_t *bytes) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (unsigned i = 0; i < PAGE_SIZE; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x100000001B3ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+// The slot holding block's bytes, else the empty slot they go in
+static DedupSlot *dedup_find(DedupSlot *table, size_t mask, RamPage *block) {
+    for (size_t slot = page_hash(block->bytes) & mask; ; slot = (slot + 1) & mask) {
+        DedupSlot *entry = &table[slot];
+        if (!entry->block || entry->block == block || memcmp(entry->block->bytes, block->bytes, PAGE_SIZE) == 0)
+            return entry;
+    }
+}
+
+size_t memory_dedup(Memory **memories, int count) {
+    size_t capacity = 1;
+    while (capacity < ((size_t)count * RAM_PAGES + 1) * 2)
+        capacity <<= 1;
+
+    DedupSlot *table = (DedupSlot*)calloc(capacity, sizeof(DedupSlot));
+    if (!table) error("dedup table allocation failed");
+    size_t freed = 0;
+
+    // Zeroed pages go back to zero_page, which needs no marking
+    dedup_find(table, capacity - 1, &zero_page)->block = &zero_page;
+
+    for (int m = 0; m < count; m++) {
+        for (unsigned page = 0; page < RAM_PAGES; page++) {
+            MemoryPage *entry = &memories[m]->pages[page];
+            RamPage *block = block_of(entry->host);
+            DedupSlot *slot = dedup_find(table, capacity - 1, block);
 
-    FILE *rom_file = fopen(rom_file_path, "rb");
-    if(!rom_file) error("cannot open rom_file");
+            if (!slot->block) {
+                slot->block = block;
+                slot->owner = entry;
+            } else if (slot->block != block) {
+                block_acquire(slot->block);
+                freed += block_release(block);
+                entry->host = slot->block->bytes;
+                entry->attrs |= PAGE_SHARED;
+                if (slot->owner)
+                    slot->owner->attrs |= PAGE_SHARED;
+            }
+        }
+    }
+
+    free(table);
+    return freed;
+}
+
+/*** Attributes ***/
+
+static void update_page_attrs(Memory *memory, uint16_t start, uint16_t end, uint8_t set, uint8_t clear) {
+    if (end < RAM_START)
+        return;
+    if (start < RAM_START)
+        start = RAM_START;
+    // A range longer than RAM covers every page
+    if (end - start >= RAM_SIZE)
+        start = RAM_START, end = RAM_END;
+
+    for (unsigned page = RAM_PAGE(start); ; page = (page + 1) % RAM_PAGES) {
+        MemoryPage *entry = &memory->pages[page];
+        entry->attrs = (entry->attrs & ~clear) | set;
+        if (page == RAM_PAGE(end))
+            break;
+    }
+}
+
+void memory_set_page_attrs(Memory *memory, uint16_t start, uint16_t end, uint8_t attrs) {
+    update_page_attrs(memory, start, end, attrs & (PAGE_WATCHED | PAGE_TRACKED | PAGE_DIRTY), 0);
+}
+
+void memory_clear_page_attrs(Memory *memory, uint16_t start, uint16_t end, uint8_t attrs) {
+    update_page_attrs(memory, start, end, 0, attrs & (PAGE_WATCHED | PAGE_TRACKED | PAGE_DIRTY));
+}
+
+void memory_set_watch(Memory *memory, MemoryWatch watch) {
+    memory->watch = watch;
+}
+
+const char *load_rom(const char *path) {
+    FILE *rom_file = fopen(path, "rb");
+    if(!rom_file) return "cannot open rom_file";
     fseek(rom_file, 0L, SEEK_END);
     long rom_file_size = ftell(rom_file);
     fseek(rom_file, 0L, SEEK_SET);
 
     if (rom_file_size < 0) {
         fclose(rom_file);
-        error("Cannot determine ROM file size");
+        return "Cannot determine ROM file size";
     }
     if (rom_file_size > ROM_SIZE) {
         fclose(rom_file);
-        error("ROM file is larger than available ROM space");
+        return "ROM file is larger than available ROM space";
     }
 
-    size_t bytes_read = fread(&memory[ROM_START], 1, rom_file_size, rom_file);
-    if (bytes_read != rom_file_size) {
-        fclose(rom_file);
-        error("Failed to read entire ROM file");
-    }
+    memset(shared_rom, 0, ROM_SIZE);
+    size_t bytes_read = fread(shared_rom, 1, rom_file_size, rom_file);
     fclose(rom_file);
-    printf("ROM loaded successfully. Size: %zu bytes\n", bytes_read);
+    if (bytes_read != (size_t)rom_file_size)
+        return "Failed to read entire ROM file";
+
+    decode_cache_build(shared_rom);
+    return NULL;
+}
+
+void load_rom_into_mem(void) {
+    const char* rom_file_path = "C:\\Users\\hugoz\\OneDrive\\Desktop\\Projects\\SpaceInvaders8080_v2\\roms\\invaders\\invaders";
+    //const char* rom_file_path = "C:\\Users\\hugoz\\OneDrive\\Desktop\\Projects\\SpaceInvaders8080_v2\roms\\invaders\\invaders";
+
+    const char *message = load_rom(rom_file_path);
+    if (message) error(message);
+    printf("ROM loaded successfully: %s\n", rom_file_path);
 }
@@ -1,6 +1,7 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 //further specifications about memory located in memory_map.md
@@ -27,11 +28,153 @@
 #define RAM_MIRROR_START    0x4000
 #define RAM_MIRROR_END      0xFFFF
 
-void memory_init(void);
-void load_rom_into_mem(void);
-uint8_t read_memory(uint16_t address);
-void write_memory(uint16_t address, uint8_t value);
-void memory_free();
+// Memory layout: one ROM image shared by every machine in the process, and
+// per machine only its RAM, split into 256-byte pages. Every address from
+// RAM_START up is a RAM address once masked with RAM_ADDRESS_MASK, so the
+// mirror above RAM_END needs no bytes or table entries of its own. Each page
+// points at a refcounted block that machines share until one writes to it.
+#define RAM_ADDRESS_MASK    (RAM_SIZE - 1)
+
+#define PAGE_SHIFT          8
+#define PAGE_SIZE           (1 << PAGE_SHIFT)
+#define PAGE_MASK           (PAGE_SIZE - 1)
+#define RAM_PAGES           (RAM_SIZE >> PAGE_SHIFT)
+
+// RAM page of an address at or above RAM_START, mirrors included
+#define RAM_PAGE(address)   (((address) & RAM_ADDRESS_MASK) >> PAGE_SHIFT)
+
+// Page attributes
+#define PAGE_WATCHED        0x01    // Writes call the memory_set_watch hook
+#define PAGE_TRACKED        0x02    // Writes set PAGE_DIRTY
+#define PAGE_DIRTY          0x04
+#define PAGE_SHARED         0x08    // Block may have other holders, copied before the first write
+#define PAGE_HASHED         0x10    // Writes update Memory.hash
+#define PAGE_JOURNALED      0x20    // Writes record the byte they replace in Memory.journal
+
+// Writes to pages with any of these go through memory_write_slow
+#define PAGE_SLOW_WRITE     (PAGE_WATCHED | PAGE_TRACKED | PAGE_SHARED | PAGE_HASHED | PAGE_JOURNALED)
+
+typedef struct {
+    uint8_t *host;      // PAGE_SIZE bytes backing the page, in a refcounted block
+    uint8_t attrs;
+} MemoryPage;
+
+// Called after each write to a PAGE_WATCHED page
+typedef void (*MemoryWatch)(uint16_t address, uint8_t value);
+
+typedef struct {
+    uint16_t offset;    // RAM offset written
+    uint8_t value;      // What it held before
+} JournalEntry;
+
+// Bytes RAM writes replaced, oldest first, in a ring of a power of two entries
+typedef struct {
+    JournalEntry *entries;
+    uint32_t mask;          // Entries - 1
+    uint64_t written;       // Entries ever recorded, the last mask + 1 of them still held
+} MemoryJournal;
+
+// A machine's memory: the page table, with the RAM itself in blocks of its own
+typedef struct {
+    MemoryPage pages[RAM_PAGES];
+    MemoryWatch watch;
+    uint64_t hash;              // Of RAM, kept up to date while the pages are PAGE_HASHED
+    MemoryJournal *journal;     // Where PAGE_JOURNALED writes go
+} Memory;
+
+// Read-only once load_rom_into_mem has filled it
+extern uint8_t shared_rom[ROM_SIZE];
+
+// memory_init points every page at one shared block of zeroes, so RAM starts
+// cleared and takes no memory until it is written; memory_release lets go of
+// the blocks before the Memory is freed
+void memory_init(Memory *memory);
+void memory_release(Memory *memory);
+
+// Zeroes RAM, attributes kept
+void memory_clear(Memory *memory);
+
+// RAM, page attributes and watch hook of src into dst. dst takes src's blocks
+// and both are marked PAGE_SHARED, so this copies no RAM; whichever writes a
+// page first copies that page. dst keeps its own journal, or none.
+void memory_copy(Memory *dst, Memory *src);
+
+// Gives the page (0..RAM_PAGES-1) a block of its own if it is PAGE_SHARED, for
+// code that stores to host bytes directly
+void memory_unshare(Memory *memory, unsigned page);
+
+/**
+ * Copies RAM out or in around the page blocks, from offset (0..RAM_SIZE-1) on.
+ * memory_set_ram is not a write_memory: no watch, no PAGE_DIRTY, and pages it
+ * leaves unchanged stay shared. It does journal the bytes it changes.
+ */
+void memory_get_ram(const Memory *memory, uint32_t offset, uint8_t *out, uint32_t size);
+void memory_set_ram(Memory *memory, uint32_t offset, const uint8_t *in, uint32_t size);
+
+/**
+ * Turns the running RAM hash on or off. While it is on, every page is
+ * PAGE_HASHED and each write XORs the old byte's key out of Memory.hash and
+ * the new one's in (Zobrist hashing, a 64-bit key per address and value, with
+ * zero bytes keyed 0), so memory_hash is a load.
+ */
+void memory_set_hashing(Memory *memory, int enabled);
+
+// The RAM hash: Memory.hash while hashing is on, else worked out from all 8 KB
+uint64_t memory_hash(const Memory *memory);
+
+// Records every RAM write from here on in journal (its entries allocated by
+// the caller), or stops with NULL. Every page is PAGE_JOURNALED while it is on.
+void memory_set_journal(Memory *memory, MemoryJournal *journal);
+
+/**
+ * Puts back the bytes journaled since journal->written was position, newest
+ * first, and forgets those entries. Like memory_set_ram, no watch or PAGE_DIRTY.
+ *
+ * @return  0, or -1 if the ring no longer holds them all (RAM unchanged)
+ */
+int memory_journal_undo(Memory *memory, uint64_t position);
+
+/**
+ * Points pages with the same bytes, across any of the memories, at one block.
+ * None of them may be running meanwhile.
+ *
+ * @return  Blocks freed
+ */
+size_t memory_dedup(Memory **memories, int count);
+
+// Fills shared_rom from a file and builds the decode tables; NULL on success, else
+// what went wrong. Only while no machine is running, every machine shares the result.
+const char *load_rom(const char *path);
+void load_rom_into_mem(void);   // The invaders ROM from its default path, exits on failure
+
+// ROM, watched, tracked and shared pages
+void memory_write_slow(Memory *memory, uint16_t address, uint8_t value);
+
+/**
+ * Sets or clears attribute bits on the RAM pages covering start..end
+ * (inclusive, mirror addresses allowed)
+ *
+ * @param attrs  PAGE_WATCHED, PAGE_TRACKED and/or PAGE_DIRTY
+ */
+void memory_set_page_attrs(Memory *memory, uint16_t start, uint16_t end, uint8_t attrs);
+void memory_clear_page_attrs(Memory *memory, uint16_t start, uint16_t end, uint8_t attrs);
+
+void memory_set_watch(Memory *memory, MemoryWatch watch);
+
+static inline uint8_t read_memory(const Memory *memory, uint16_t address) {
+    if (address < RAM_START)
+        return shared_rom[address];
+    return memory->pages[RAM_PAGE(address)].host[address & PAGE_MASK];
+}
+
+static inline void write_memory(Memory *memory, uint16_t address, uint8_t value) {
+    const MemoryPage *page = &memory->pages[RAM_PAGE(address)];
+
+    if (address < RAM_START || (page->attrs & PAGE_SLOW_WRITE))
+        memory_write_slow(memory, address, value);
+    else
+        page->host[address & PAGE_MASK] = value;
+}
 
 #endif
 
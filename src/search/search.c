@@ -0,0 +1,569 @@
+#include "search.h"
+#include "machine.h"
+#include "memory.h"
+#include "input.h"
+#include "threads.h"
+#include "utils.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_BATCH   64
+
+// Polls before a waiting thread sleeps; a node is tens of microseconds of work
+#define SPIN_LIMIT      4000
+
+typedef struct {
+    int32_t parent;         // Node index, -1 for the root
+    int32_t input;          // Index into Search.inputs of the step from the parent
+    int32_t depth;
+    int64_t score;
+    Machine *machine;       // Until the node is expanded
+} Node;
+
+// A child run this round, in slot task * num_inputs + input
+typedef struct {
+    Machine *machine;
+    uint64_t hash;
+    int64_t score;
+    int goal;
+    int worker;             // Whose pool it goes back to if it is dropped
+} Child;
+
+typedef struct Worker Worker;
+
+struct Search {
+    SearchConfig config;
+    uint8_t (*inputs)[2];   // config.inputs points here
+    int workers;            // Including the thread that calls search_run
+    Worker *worker;
+
+    Node *node;
+    long nodes, node_capacity;
+
+    // Hashes of every state kept, open addressing, 0 for an empty slot
+    uint64_t *seen;
+    size_t seen_count, seen_capacity;
+
+    // Nodes not expanded yet: a FIFO from open_head for breadth-first, a heap for best-first
+    int32_t *open;
+    long open_head, open_count, open_capacity;
+
+    // The round being run, written by the caller before generation moves
+    int32_t *round;
+    int round_count;
+    Child *child;
+
+    int32_t best;
+    SearchStats stats;
+
+    atomic_uint generation; // Bumped once per round, workers run when it moves
+    atomic_int pending;     // Workers not done with the current round
+    atomic_int stopping;
+    Mutex mutex;            // Only for sleeping on the two conditions
+    Cond wake;
+    Cond done;
+};
+
+struct Worker {
+    Search *search;
+    int index;
+    Thread thread;
+    MachinePool *pool;      // Only this worker's thread clones from it while a round runs
+    uint64_t steals;
+
+    // Tasks [head, tail) of the round: the owner takes from head, thieves from tail
+    Mutex queue;
+    int head, tail;
+};
+
+static void *grow(void *array, long *capacity, long needed, size_t size) {
+    if (needed <= *capacity)
+        return array;
+
+    long capacity_new = *capacity ? *capacity : 256;
+    while (capacity_new < needed)
+        capacity_new *= 2;
+    array = realloc(array, (size_t)capacity_new * size);
+    if (!array) error("search grow failed");
+    *capacity = capacity_new;
+    return array;
+}
+
+/*** Seen states ***/
+
+// Nonzero, since 0 marks an empty slot
+static uint64_t seen_key(uint64_t hash) {
+    return hash ? hash : 1;
+}
+
+// 0 if key was already there
+static int seen_insert(Search *search, uint64_t key) {
+    if ((search->seen_count + 1) * 2 > search->seen_capacity) {
+        size_t capacity = search->seen_capacity ? search->seen_capacity * 2 : 4096;
+        uint64_t *seen = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+        if (!seen) error("search seen table grow failed");
+
+        for (size_t i = 0; i < search->seen_capacity; i++) {
+            uint64_t old = search->seen[i];
+            if (!old) continue;
+            size_t slot = old & (capacity - 1);
+            while (seen[slot])
+                slot = (slot + 1) & (capacity - 1);
+            seen[slot] = old;
+        }
+        free(search->seen);
+        search->seen = seen;
+        search->seen_capacity = capacity;
+    }
+
+    size_t mask = search->seen_capacity - 1;
+    for (size_t slot = key & mask; ; slot = (slot + 1) & mask) {
+        if (search->seen[slot] == key)
+            return 0;
+        if (!search->seen[slot]) {
+            search->seen[slot] = key;
+            search->seen_count++;
+            return 1;
+        }
+    }
+}
+
+/*** Open nodes ***/
+
+// Heap order: higher score first, then the node found first
+static int open_before(const Search *search, int32_t a, int32_t b) {
+    const Node *x = &search->node[a], *y = &search->node[b];
+    return x->score != y->score ? x->score > y->score : a < b;
+}
+
+static void open_push(Search *search, int32_t index) {
+    if (search->config.order == SEARCH_BREADTH_FIRST) {
+        // Slide the FIFO back to the start once its head is half the array
+        if (search->open_head && search->open_head >= search->open_capacity / 2) {
+            memmove(search->open, search->open + search->open_head, search->open_count * sizeof(int32_t));
+            search->open_head = 0;
+        }
+        search->open = (int32_t*)grow(search->open, &search->open_capacity,
+                                      search->open_head + search->open_count + 1, sizeof(int32_t));
+        search->open[search->open_head + search->open_count++] = index;
+        return;
+    }
+
+    search->open = (int32_t*)grow(search->open, &search->open_capacity, search->open_count + 1, sizeof(int32_t));
+    int32_t *heap = search->open;
+    long at = search->open_count++;
+    while (at && open_before(search, index, heap[(at - 1) / 2])) {
+        heap[at] = heap[(at - 1) / 2];
+        at = (at - 1) / 2;
+    }
+    heap[at] = index;
+}
+
+static int32_t open_pop(Search *search) {
+    if (search->config.order == SEARCH_BREADTH_FIRST) {
+        search->open_count--;
+        return search->open[search->open_head++];
+    }
+
+    int32_t *heap = search->open;
+    int32_t top = heap[0], last = heap[--search->open_count];
+    long at = 0, count = search->open_count;
+    for (;;) {
+        long next = at * 2 + 1;
+        if (next >= count) break;
+        if (next + 1 < count && open_before(search, heap[next + 1], heap[next]))
+            next++;
+        if (!open_before(search, heap[next], last)) break;
+        heap[at] = heap[next];
+        at = next;
+    }
+    if (count)
+        heap[at] = last;
+    return top;
+}
+
+// Machines of nodes never expanded go back to worker 0's pool
+static void open_clear(Search *search) {
+    while (search->open_count) {
+        Node *node = &search->node[open_pop(search)];
+        machine_pool_release(search->worker[0].pool, node->machine);
+        node->machine = NULL;
+    }
+    search->open_head = 0;
+}
+
+/*** Expanding nodes ***/
+
+static void expand(Search *search, Worker *worker, int task) {
+    const SearchConfig *config = &search->config;
+    Node *node = &search->node[search->round[task]];
+    Machine *parent = node->machine;
+
+    for (int i = 0; i < config->num_inputs; i++) {
+        Child *child = &search->child[(size_t)task * config->num_inputs + i];
+        Machine *machine = machine_pool_clone(worker->pool, parent);
+
+        input_write(machine, 1, config->inputs[i][0]);
+        input_write(machine, 2, config->inputs[i][1]);
+        for (int frame = 0; frame < config->frames; frame++)
+            machine_run_frame(machine);
+
+        child->machine = machine;
+        child->hash = machine_state_hash(machine);
+        child->score = config->evaluate ? config->evaluate(machine, config->context) : 0;
+        child->goal = config->goal ? config->goal(machine, config->context) : 0;
+        child->worker = worker->index;
+    }
+
+    machine_pool_release(worker->pool, parent);
+    node->machine = NULL;
+}
+
+static int take_task(Worker *worker) {
+    int task = -1;
+
+    mutex_lock(&worker->queue);
+    if (worker->head < worker->tail)
+        task = worker->head++;
+    mutex_unlock(&worker->queue);
+    return task;
+}
+
+// From the end of the next queue that has any left
+static int steal_task(Search *search, Worker *thief) {
+    for (int i = 1; i < search->workers; i++) {
+        Worker *victim = &search->worker[(thief->index + i) % search->workers];
+        int task = -1;
+
+        mutex_lock(&victim->queue);
+        if (victim->head < victim->tail)
+            task = --victim->tail;
+        mutex_unlock(&victim->queue);
+
+        if (task >= 0) {
+            thief->steals++;
+            return task;
+        }
+    }
+    return -1;
+}
+
+// Tasks are only handed out at the start of a round, so once no queue has any left the round is done
+static void work_round(Search *search, Worker *worker) {
+    int task;
+
+    while ((task = take_task(worker)) >= 0 || (task = steal_task(search, worker)) >= 0)
+        expand(search, worker, task);
+}
+
+/*** Workers ***/
+
+static void worker_finished(Search *search) {
+    if (atomic_fetch_sub_explicit(&search->pending, 1, memory_order_acq_rel) == 1) {
+        mutex_lock(&search->mutex);
+        cond_broadcast(&search->done);
+        mutex_unlock(&search->mutex);
+    }
+}
+
+// Spins, then sleeps, until generation is no longer seen
+static unsigned wait_generation(Search *search, unsigned seen) {
+    unsigned generation;
+
+    for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+        generation = atomic_load_explicit(&search->generation, memory_order_acquire);
+        if (generation != seen)
+            return generation;
+        cpu_relax();
+    }
+
+    mutex_lock(&search->mutex);
+    while ((generation = atomic_load_explicit(&search->generation, memory_order_acquire)) == seen)
+        cond_wait(&search->wake, &search->mutex);
+    mutex_unlock(&search->mutex);
+    return generation;
+}
+
+static void wait_workers(Search *search) {
+    for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+        if (!atomic_load_explicit(&search->pending, memory_order_acquire))
+            return;
+        cpu_relax();
+    }
+
+    mutex_lock(&search->mutex);
+    while (atomic_load_explicit(&search->pending, memory_order_acquire))
+        cond_wait(&search->done, &search->mutex);
+    mutex_unlock(&search->mutex);
+}
+
+static void worker_run(void *arg) {
+    Worker *worker = (Worker*)arg;
+    Search *search = worker->search;
+    unsigned seen = 0;
+
+    thread_pin(worker->index % cpu_count());
+
+    for (;;) {
+        seen = wait_generation(search, seen);
+        if (atomic_load_explicit(&search->stopping, memory_order_relaxed))
+            break;
+
+        work_round(search, worker);
+        worker_finished(search);
+    }
+
+    jit_free();     // The JIT's buffers are per thread
+}
+
+// Wakes the workers on the next generation
+static void start_workers(Search *search) {
+    atomic_store_explicit(&search->pending, search->workers - 1, memory_order_relaxed);
+
+    mutex_lock(&search->mutex);
+    atomic_fetch_add_explicit(&search->generation, 1, memory_order_release);
+    cond_broadcast(&search->wake);
+    mutex_unlock(&search->mutex);
+}
+
+/*** Rounds ***/
+
+static int32_t add_node(Search *search, int32_t parent, int32_t input, int64_t score, Machine *machine) {
+    search->node = (Node*)grow(search->node, &search->node_capacity, search->nodes + 1, sizeof(Node));
+
+    Node *node = &search->node[search->nodes];
+    node->parent = parent;
+    node->input = input;
+    node->depth = parent < 0 ? 0 : search->node[parent].depth + 1;
+    node->score = score;
+    node->machine = machine;
+    if (node->depth > search->stats.depth)
+        search->stats.depth = node->depth;
+    return (int32_t)search->nodes++;
+}
+
+// A node's machine stays only while it may still be expanded
+static void keep_open(Search *search, int32_t index) {
+    Node *node = &search->node[index];
+
+    if (search->config.max_depth && node->depth >= search->config.max_depth) {
+        machine_pool_release(search->worker[0].pool, node->machine);
+        node->machine = NULL;
+    } else {
+        open_push(search, index);
+    }
+}
+
+// Children in slot order, so the result is the same whichever thread ran them; 1 once the search is over
+static int merge_round(Search *search) {
+    const SearchConfig *config = &search->config;
+    int over = 0;
+
+    for (int task = 0; task < search->round_count; task++) {
+        for (int i = 0; i < config->num_inputs; i++) {
+            Child *child = &search->child[(size_t)task * config->num_inputs + i];
+
+            search->stats.generated++;
+            if (over || !seen_insert(search, seen_key(child->hash))) {
+                if (!over)
+                    search->stats.duplicates++;
+                machine_pool_release(search->worker[child->worker].pool, child->machine);
+                continue;
+            }
+
+            int32_t index = add_node(search, search->round[task], i, child->score, child->machine);
+            if (child->goal) {
+                search->best = index;
+                search->stats.best_score = child->score;
+                search->stats.goal_found = 1;
+                over = 1;
+            } else if (child->score > search->stats.best_score) {
+                search->best = index;
+                search->stats.best_score = child->score;
+            }
+
+            if (config->max_nodes && search->nodes >= config->max_nodes)
+                over = 1;
+            if (over) {
+                machine_pool_release(search->worker[0].pool, child->machine);
+                search->node[index].machine = NULL;
+            } else {
+                keep_open(search, index);
+            }
+        }
+    }
+
+    search->stats.expanded += search->round_count;
+    search->stats.rounds++;
+    return over;
+}
+
+static void run_round(Search *search) {
+    int workers = search->workers, count = search->round_count;
+
+    for (int w = 0; w < workers; w++) {
+        Worker *worker = &search->worker[w];
+        worker->head = (int)((int64_t)count * w / workers);
+        worker->tail = (int)((int64_t)count * (w + 1) / workers);
+        worker->steals = 0;
+    }
+
+    start_workers(search);
+    work_round(search, &search->worker[0]);
+    wait_workers(search);
+
+    for (int w = 0; w < workers; w++)
+        search->stats.steals += search->worker[w].steals;
+}
+
+/*** API ***/
+
+Search *search_create(const SearchConfig *config, int threads) {
+    if (!config->inputs || config->num_inputs <= 0 || config->frames <= 0 || config->max_depth < 0 ||
+        config->max_nodes < 0 || config->batch < 0)
+        return NULL;
+    if (threads <= 0)
+        threads = cpu_count();
+
+    Search *search = (Search*)calloc(1, sizeof(Search));
+    if (!search) return NULL;
+    search->config = *config;
+    if (!search->config.batch)
+        search->config.batch = DEFAULT_BATCH;
+
+    search->inputs = (uint8_t (*)[2])malloc((size_t)config->num_inputs * sizeof(*search->inputs));
+    search->worker = (Worker*)calloc(threads, sizeof(Worker));
+    search->round = (int32_t*)malloc((size_t)search->config.batch * sizeof(int32_t));
+    search->child = (Child*)malloc((size_t)search->config.batch * config->num_inputs * sizeof(Child));
+    if (!search->inputs || !search->worker || !search->round || !search->child) {
+        free(search->inputs);
+        free(search->worker);
+        free(search->round);
+        free(search->child);
+        free(search);
+        return NULL;
+    }
+    memcpy(search->inputs, config->inputs, (size_t)config->num_inputs * sizeof(*search->inputs));
+    search->config.inputs = (const uint8_t (*)[2])search->inputs;
+
+    search->workers = threads;
+    atomic_init(&search->generation, 0);
+    atomic_init(&search->pending, 0);
+    atomic_init(&search->stopping, 0);
+    mutex_init(&search->mutex);
+    cond_init(&search->wake);
+    cond_init(&search->done);
+
+    for (int w = 0; w < threads; w++) {
+        Worker *worker = &search->worker[w];
+        worker->search = search;
+        worker->index = w;
+        worker->pool = machine_pool_create(0);
+        mutex_init(&worker->queue);
+    }
+
+    // Worker 0 is whichever thread calls search_run
+    int started = 1;
+    for (; started < threads; started++)
+        if (thread_create(&search->worker[started].thread, worker_run, &search->worker[started]) != 0)
+            break;
+
+    if (started < threads) {
+        for (int w = started; w < threads; w++) {
+            machine_pool_destroy(search->worker[w].pool);
+            mutex_destroy(&search->worker[w].queue);
+        }
+        search->workers = started;
+        search_destroy(search);
+        return NULL;
+    }
+    return search;
+}
+
+void search_destroy(Search *search) {
+    if (!search) return;
+
+    open_clear(search);
+    atomic_store(&search->stopping, 1);
+    start_workers(search);
+    for (int w = 1; w < search->workers; w++)
+        thread_join(search->worker[w].thread);
+
+    for (int w = 0; w < search->workers; w++) {
+        machine_pool_destroy(search->worker[w].pool);
+        mutex_destroy(&search->worker[w].queue);
+    }
+
+    mutex_destroy(&search->mutex);
+    cond_destroy(&search->wake);
+    cond_destroy(&search->done);
+    free(search->node);
+    free(search->seen);
+    free(search->open);
+    free(search->round);
+    free(search->child);
+    free(search->inputs);
+    free(search->worker);
+    free(search);
+}
+
+void search_run(Search *search, Machine *root) {
+    const SearchConfig *config = &search->config;
+
+    open_clear(search);
+    search->nodes = 0;
+    search->seen_count = 0;
+    if (search->seen)
+        memset(search->seen, 0, search->seen_capacity * sizeof(uint64_t));
+    memset(&search->stats, 0, sizeof(SearchStats));
+
+    Machine *start = machine_pool_clone(search->worker[0].pool, root);
+    memory_set_hashing(&start->memory, 1);
+    seen_insert(search, seen_key(machine_state_hash(start)));
+
+    int64_t score = config->evaluate ? config->evaluate(start, config->context) : 0;
+    search->best = add_node(search, -1, -1, score, start);
+    search->stats.best_score = score;
+
+    if (config->goal && config->goal(start, config->context)) {
+        search->stats.goal_found = 1;
+        machine_pool_release(search->worker[0].pool, start);
+        search->node[0].machine = NULL;
+        return;
+    }
+    if (config->max_nodes == 1) {
+        machine_pool_release(search->worker[0].pool, start);
+        search->node[0].machine = NULL;
+        return;
+    }
+    keep_open(search, 0);
+
+    while (search->open_count) {
+        search->round_count = 0;
+        while (search->open_count && search->round_count < config->batch)
+            search->round[search->round_count++] = open_pop(search);
+
+        run_round(search);
+        if (merge_round(search))
+            break;
+    }
+    open_clear(search);
+}
+
+const SearchStats *search_stats(const Search *search) {
+    return &search->stats;
+}
+
+int search_best_path(const Search *search, int *path, int max) {
+    int length = search->nodes ? search->node[search->best].depth : 0;
+
+    // Walked back from the end, so each input lands at its own depth - 1
+    for (int32_t index = search->nodes ? search->best : -1; index > 0; index = search->node[index].parent) {
+        const Node *node = &search->node[index];
+        if (node->depth - 1 < max)
+            path[node->depth - 1] = node->input;
+    }
+    return length;
+}
@@ -0,0 +1,82 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+#include "machine.h"
+
+// State-space search: from a root machine, tries every input in a list on
+// every node, each held on ports 1 and 2 for a number of frames, and keeps the
+// states it has not seen before (by machine_state_hash), breadth-first or best
+// score first. Children are clones (copy-on-write, see docs/memory_map.md), so
+// a node costs its frames and the RAM pages those frames write.
+//
+// The search runs in rounds: the nodes of a round are spread over per-thread
+// queues that idle threads steal from, and the calling thread then merges the
+// children in node and input order. So the nodes found, their scores and the
+// path returned do not depend on the thread count or on timing, only on the
+// config.
+
+typedef struct Search Search;
+
+typedef enum {
+    SEARCH_BREADTH_FIRST,   // Oldest nodes first, so a whole depth before the next
+    SEARCH_BEST_FIRST       // Best scored nodes first
+} SearchOrder;
+
+// Score of a node, higher is better, e.g. read from game variables in RAM.
+// Called on worker threads, each time with a machine no other thread uses.
+typedef int64_t (*SearchEvaluate)(const Machine *machine, void *context);
+
+// Nonzero ends the search at this node (the first in merge order if several
+// in a round do); called like SearchEvaluate
+typedef int (*SearchGoal)(const Machine *machine, void *context);
+
+typedef struct {
+    SearchOrder order;
+    const uint8_t (*inputs)[2];     // Port 1 and port 2 values of each input tried, DIP switches included
+    int num_inputs;
+    int frames;                     // Frames each input is held for, at least 1
+    int max_depth;                  // Inputs from the root, 0 for no limit
+    long max_nodes;                 // States kept, root included, 0 for no limit
+    int batch;                      // Nodes expanded per round, 0 for 64; a few per thread at least
+    SearchEvaluate evaluate;        // NULL scores every node 0
+    SearchGoal goal;                // NULL runs until a limit or no new states are left
+    void *context;                  // Passed to evaluate and goal
+} SearchConfig;
+
+typedef struct {
+    uint64_t expanded;      // Nodes whose inputs were all tried
+    uint64_t generated;     // Children run
+    uint64_t duplicates;    // Children whose state was already known, dropped
+    uint64_t steals;        // Nodes a thread took from another thread's queue
+    uint64_t rounds;
+    int depth;              // Deepest node kept
+    int64_t best_score;     // Of the best node, the root if no child scored higher
+    int goal_found;
+} SearchStats;
+
+/**
+ * @param threads  Including the caller's; 0 for one per CPU
+ * @return         NULL if the config is not valid or out of memory
+ */
+Search *search_create(const SearchConfig *config, int threads);
+void search_destroy(Search *search);
+
+/**
+ * Searches from root, which is cloned and otherwise left as it is; any
+ * earlier run's nodes are dropped first. Turns on memory_set_hashing for the
+ * root's clones.
+ */
+void search_run(Search *search, Machine *root);
+
+const SearchStats *search_stats(const Search *search);
+
+/**
+ * Indexes into SearchConfig.inputs from the root to the goal node, or to the
+ * best scored node if no goal was found (the first found of equal ones)
+ *
+ * @return  The path's length; only the first max indexes are written
+ */
+int search_best_path(const Search *search, int *path, int max);
+
+#endif
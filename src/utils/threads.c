@@ -0,0 +1,104 @@
+#ifndef _WIN32
+#define _GNU_SOURCE     // pthread_setaffinity_np
+#endif
+#include "threads.h"
+
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+    void (*run)(void *arg);
+    void *arg;
+} ThreadStart;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID param) {
+#else
+static void *thread_main(void *param) {
+#endif
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.run(start.arg);
+    return 0;
+}
+
+int thread_create(Thread *thread, void (*run)(void *arg), void *arg) {
+    ThreadStart *start = (ThreadStart*)malloc(sizeof(ThreadStart));
+    if (!start) return -1;
+    start->run = run;
+    start->arg = arg;
+
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+    if (*thread) return 0;
+#else
+    if (pthread_create(thread, NULL, thread_main, start) == 0) return 0;
+#endif
+    free(start);
+    return -1;
+}
+
+void thread_join(Thread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+int thread_pin(int cpu) {
+#ifdef _WIN32
+    if (cpu >= (int)(8 * sizeof(DWORD_PTR))) return -1;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) ? 0 : -1;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    return -1;
+#endif
+}
+
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+#ifdef _WIN32
+void mutex_init(Mutex *mutex) { InitializeSRWLock(mutex); }
+void mutex_destroy(Mutex *mutex) { (void)mutex; }
+void mutex_lock(Mutex *mutex) { AcquireSRWLockExclusive(mutex); }
+void mutex_unlock(Mutex *mutex) { ReleaseSRWLockExclusive(mutex); }
+
+void cond_init(Cond *cond) { InitializeConditionVariable(cond); }
+void cond_destroy(Cond *cond) { (void)cond; }
+void cond_wait(Cond *cond, Mutex *mutex) { SleepConditionVariableSRW(cond, mutex, INFINITE, 0); }
+void cond_broadcast(Cond *cond) { WakeAllConditionVariable(cond); }
+#else
+void mutex_init(Mutex *mutex) { pthread_mutex_init(mutex, NULL); }
+void mutex_destroy(Mutex *mutex) { pthread_mutex_destroy(mutex); }
+void mutex_lock(Mutex *mutex) { pthread_mutex_lock(mutex); }
+void mutex_unlock(Mutex *mutex) { pthread_mutex_unlock(mutex); }
+
+void cond_init(Cond *cond) { pthread_cond_init(cond, NULL); }
+void cond_destroy(Cond *cond) { pthread_cond_destroy(cond); }
+void cond_wait(Cond *cond, Mutex *mutex) { pthread_cond_wait(cond, mutex); }
+void cond_broadcast(Cond *cond) { pthread_cond_broadcast(cond); }
+#endif
+
+void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
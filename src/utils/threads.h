@@ -0,0 +1,39 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+// The few thread primitives the batch runner needs, on Win32 or pthreads
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE Thread;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Cond;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+#endif
+
+// 0 on success
+int thread_create(Thread *thread, void (*run)(void *arg), void *arg);
+void thread_join(Thread thread);
+
+// Keeps the calling thread on one CPU, where the OS allows it; 0 on success
+int thread_pin(int cpu);
+int cpu_count(void);
+
+void mutex_init(Mutex *mutex);
+void mutex_destroy(Mutex *mutex);
+void mutex_lock(Mutex *mutex);
+void mutex_unlock(Mutex *mutex);
+
+void cond_init(Cond *cond);
+void cond_destroy(Cond *cond);
+void cond_wait(Cond *cond, Mutex *mutex);
+void cond_broadcast(Cond *cond);
+
+// Spin-wait hint, a pause on x86
+void cpu_relax(void);
+
+#endif
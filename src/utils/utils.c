@@ -11,14 +11,3 @@ void error(const char *message) {
   fprintf(stderr, "%s\n", message);
   exit(1);
 }
-
-uint8_t parity(uint16_t value) {
-    int count = 0;
-    while (value) {
-        value &= (value - 1);  // Clear the lowest set bit
-        count++;
-    }
-    return (count % 2 == 0) ? 1 : 0;
-}
-
-
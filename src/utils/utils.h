@@ -5,7 +5,13 @@
 #include <stdint.h>
 
 void error_stub(void);
-void error(const char *message);
-uint8_t parity(uint16_t value);
+_Noreturn void error(const char *message);
+
+// splitmix64's finalizer: every input bit reaches every output bit
+static inline uint64_t hash_mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
 
 #endif
\ No newline at end of file
@@ -1,50 +1,157 @@
 #include "video.h"
 #include "memory.h"
-#include "cpu.h"
-#include <SDL.h>
+#include "machine.h"
+#include "utils.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-void update_texture(SDL_Texture* texture, CPU *cpu) {
-    uint32_t* pixels;
-    int pitch;
+#define COLOR_ON    0xFFFFFFFF
+#define COLOR_OFF   0xFF000000
 
-    if (SDL_LockTexture(texture, NULL, (void**)&pixels, &pitch) != 0) {
-        printf("Failed to lock texture: %s\n", SDL_GetError());
-        return;
-    }
-
-    // Iterate over the screen dimensions to update pixel data from VRAM
+void video_convert(const Machine *machine, uint32_t *pixels, int pitch) {
+    // Iterate over the screen dimensions to update pixel data from VRAM, a byte at a time
     for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
+        uint32_t *row = (uint32_t*)((uint8_t*)pixels + y * pitch);
+
+        for (int x = 0; x < SCREEN_WIDTH; x += 8) {
             int byte_index = VRAM_START + (y * 32) + (x / 8);  // 32 bytes per row
-            int bit_index = 7 - (x % 8);  // Which bit in the byte corresponds to the x position
-            
-            // Add a debug print to verify byte_index and bit_index are correct
-            uint8_t byte = read_memory(byte_index);
-            if (y == 0 && x < 10) {  // Limit prints for readability
-                printf("VRAM Byte: 0x%04X, Value: 0x%02X, BitIndex: %d\n", byte_index, byte, bit_index);
-            }
-
-            uint32_t color = (byte & (1 << bit_index)) ? 0xFFFFFFFF : 0xFF000000;  // White or black
-            pixels[y * (pitch / sizeof(uint32_t)) + x] = color;
+            uint8_t byte = read_memory(&machine->memory, byte_index);
+
+            for (int bit = 0; bit < 8; bit++)
+                row[x + bit] = (byte & (0x80 >> bit)) ? COLOR_ON : COLOR_OFF;  // White or black
         }
     }
+}
+
+void video_present(VideoSink *sink, Machine *machine) {
+    if (sink->begin_frame && !sink->begin_frame(sink))
+        return;
 
-    SDL_UnlockTexture(texture);
+    if (sink->pixels)
+        video_convert(machine, sink->pixels, sink->pitch);
+    if (sink->publish_vram) {
+        uint8_t vram[VIDEO_RAM_SIZE];
+        memory_get_ram(&machine->memory, VIDEO_RAM_START - RAM_START, vram, VIDEO_RAM_SIZE);
+        sink->publish_vram(sink, vram);
+    }
+    if (sink->end_frame)
+        sink->end_frame(sink);
+    sink->frames++;
 }
 
+void video_destroy(VideoSink *sink) {
+    if (!sink) return;
+    if (sink->destroy)
+        sink->destroy(sink);
+    else
+        free(sink);
+}
 
-void sync_to_real_time() {
-    static uint32_t last_time = 0;
-    uint32_t current_time = SDL_GetTicks();
-    uint32_t frame_time = 1000 / FRAMES_PER_SECOND;
+static VideoSink *sink_alloc(size_t size) {
+    VideoSink *sink = (VideoSink*)calloc(1, size);
+    if (!sink) error("video sink init failed");
+    return sink;
+}
+
+/*** Null ***/
+
+VideoSink *video_null_create(void) {
+    return sink_alloc(sizeof(VideoSink));
+}
+
+/*** Memory buffer ***/
 
-    uint32_t elapsed_time = current_time - last_time;
+typedef struct {
+    VideoSink sink;     // First, so the hooks can cast back
+    VideoFormat format;
+    union {
+        uint8_t vram[VIDEO_RAM_SIZE];
+        uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+    } frame;
+} BufferSink;
 
-    if (elapsed_time < frame_time) {
-        SDL_Delay(frame_time - elapsed_time);
+static int buffer_begin(VideoSink *sink) {
+    BufferSink *buffer = (BufferSink*)sink;
+    if (buffer->format == VIDEO_PIXELS) {
+        sink->pixels = buffer->frame.pixels;
+        sink->pitch = SCREEN_WIDTH * sizeof(uint32_t);
     }
+    return 1;
+}
+
+static void buffer_publish_vram(VideoSink *sink, const uint8_t *vram) {
+    memcpy(((BufferSink*)sink)->frame.vram, vram, VIDEO_RAM_SIZE);
+}
+
+VideoSink *video_buffer_create(VideoFormat format) {
+    BufferSink *buffer = (BufferSink*)sink_alloc(sizeof(BufferSink));
+    buffer->format = format;
+    buffer->sink.begin_frame = buffer_begin;
+    if (format == VIDEO_VRAM)
+        buffer->sink.publish_vram = buffer_publish_vram;
+    return &buffer->sink;
+}
+
+const void *video_buffer_data(const VideoSink *sink) {
+    return &((const BufferSink*)sink)->frame;
+}
+
+/*** File writer ***/
+
+typedef struct {
+    VideoSink sink;
+    VideoFormat format;
+    FILE *file;
+    uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint8_t rgb[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+} FileSink;
+
+static int file_begin(VideoSink *sink) {
+    FileSink *file = (FileSink*)sink;
+    if (file->format == VIDEO_PIXELS) {
+        sink->pixels = file->pixels;
+        sink->pitch = SCREEN_WIDTH * sizeof(uint32_t);
+    }
+    return 1;
+}
+
+static void file_publish_vram(VideoSink *sink, const uint8_t *vram) {
+    fwrite(vram, 1, VIDEO_RAM_SIZE, ((FileSink*)sink)->file);
+}
+
+// RGBA8888 keeps R in the top byte, as the SDL texture shows it
+static void file_end(VideoSink *sink) {
+    FileSink *file = (FileSink*)sink;
+    if (file->format != VIDEO_PIXELS)
+        return;
+
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        file->rgb[i * 3] = (uint8_t)(file->pixels[i] >> 24);
+        file->rgb[i * 3 + 1] = (uint8_t)(file->pixels[i] >> 16);
+        file->rgb[i * 3 + 2] = (uint8_t)(file->pixels[i] >> 8);
+    }
+    fprintf(file->file, "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+    fwrite(file->rgb, 1, sizeof(file->rgb), file->file);
+}
+
+static void file_destroy(VideoSink *sink) {
+    FileSink *file = (FileSink*)sink;
+    if (fclose(file->file) != 0)
+        printf("Failed to write video file\n");
+    free(file);
+}
+
+VideoSink *video_file_create(const char *path, VideoFormat format) {
+    FileSink *file = (FileSink*)sink_alloc(sizeof(FileSink));
+    file->file = fopen(path, "wb");
+    if (!file->file) error("cannot open video file");
 
-    // Update last_time to the current time after syncing
-    last_time = SDL_GetTicks();
+    file->format = format;
+    file->sink.begin_frame = file_begin;
+    file->sink.end_frame = file_end;
+    file->sink.destroy = file_destroy;
+    if (format == VIDEO_VRAM)
+        file->sink.publish_vram = file_publish_vram;
+    return &file->sink;
 }
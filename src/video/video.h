@@ -1,15 +1,58 @@
 #ifndef VIDEO_H
 #define VIDEO_H
 
-#include <SDL.h>
-#include "cpu.h"
+#include <stdint.h>
+#include "machine.h"
 
 #define SCREEN_WIDTH 224
 #define SCREEN_HEIGHT 256
 #define VRAM_START 0x2400
 #define FRAMES_PER_SECOND 60
 
-void update_texture(SDL_Texture* texture, CPU *cpu);
-void sync_to_real_time();
+// Video sinks: where a finished frame goes.
+//
+// video_present hands a frame to a sink in three steps. begin_frame returns 0
+// to skip the frame, or sets pixels/pitch when the sink wants the frame
+// converted to RGBA8888 (video_present writes them in place, so a texture can
+// be filled without a copy). publish_vram, if set, gets the 1bpp video RAM as
+// is. end_frame shows or stores what it was given. Any hook can be NULL; a
+// sink with none (video_null_create) costs nothing per frame.
+
+typedef enum {
+    VIDEO_VRAM,     // VIDEO_RAM_SIZE bytes of 1bpp video RAM per frame
+    VIDEO_PIXELS    // SCREEN_WIDTH x SCREEN_HEIGHT RGBA8888 pixels per frame
+} VideoFormat;
+
+typedef struct VideoSink VideoSink;
+
+struct VideoSink {
+    int (*begin_frame)(VideoSink *sink);
+    void (*publish_vram)(VideoSink *sink, const uint8_t *vram);
+    void (*end_frame)(VideoSink *sink);
+    void (*destroy)(VideoSink *sink);
+
+    uint32_t *pixels;   // Set by begin_frame for converted pixels, NULL otherwise
+    int pitch;          // Bytes per row of pixels
+    uint64_t frames;    // Frames presented, counted by video_present
+};
+
+// Passes the machine's current frame to sink
+void video_present(VideoSink *sink, Machine *machine);
+void video_destroy(VideoSink *sink);
+
+// Fills SCREEN_HEIGHT rows of SCREEN_WIDTH pixels, pitch bytes apart, white on black
+void video_convert(const Machine *machine, uint32_t *pixels, int pitch);
+
+// Discards every frame, for throughput runs
+VideoSink *video_null_create(void);
+
+// Keeps the last frame in memory, read back with video_buffer_data
+VideoSink *video_buffer_create(VideoFormat format);
+const void *video_buffer_data(const VideoSink *sink);
+
+// Appends every frame to path: raw VRAM frames back to back, or one binary
+// PPM (P6) image per frame, which netpbm tools read as a stream. Exits if
+// path cannot be opened.
+VideoSink *video_file_create(const char *path, VideoFormat format);
 
 #endif
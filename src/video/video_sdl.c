@@ -0,0 +1,92 @@
+#include "video_sdl.h"
+#include "utils.h"
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    VideoSink sink;     // First, so the hooks can cast back
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+} SdlSink;
+
+static int sdl_begin(VideoSink *sink) {
+    SdlSink *sdl = (SdlSink*)sink;
+    void *pixels;
+
+    if (SDL_LockTexture(sdl->texture, NULL, &pixels, &sink->pitch) != 0) {
+        printf("Failed to lock texture: %s\n", SDL_GetError());
+        return 0;
+    }
+    sink->pixels = (uint32_t*)pixels;
+    return 1;
+}
+
+static void sdl_end(VideoSink *sink) {
+    SdlSink *sdl = (SdlSink*)sink;
+
+    SDL_UnlockTexture(sdl->texture);
+    sink->pixels = NULL;
+
+    // Clear and present the renderer
+    SDL_RenderClear(sdl->renderer);
+    SDL_RenderCopy(sdl->renderer, sdl->texture, NULL, NULL);
+    SDL_RenderPresent(sdl->renderer);
+}
+
+static void sdl_destroy(VideoSink *sink) {
+    SdlSink *sdl = (SdlSink*)sink;
+
+    if (sdl->texture) SDL_DestroyTexture(sdl->texture);
+    if (sdl->renderer) SDL_DestroyRenderer(sdl->renderer);
+    if (sdl->window) SDL_DestroyWindow(sdl->window);
+    free(sdl);
+}
+
+VideoSink *video_sdl_create(void) {
+    SdlSink *sdl = (SdlSink*)calloc(1, sizeof(SdlSink));
+    if (!sdl) error("video sink init failed");
+
+    sdl->sink.begin_frame = sdl_begin;
+    sdl->sink.end_frame = sdl_end;
+    sdl->sink.destroy = sdl_destroy;
+
+    sdl->window = SDL_CreateWindow("Space Invaders", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+    if (!sdl->window) {
+        printf("Failed to create window: %s\n", SDL_GetError());
+        sdl_destroy(&sdl->sink);
+        return NULL;
+    }
+
+    sdl->renderer = SDL_CreateRenderer(sdl->window, -1, SDL_RENDERER_ACCELERATED);
+    if (!sdl->renderer) {
+        printf("Failed to create renderer: %s\n", SDL_GetError());
+        sdl_destroy(&sdl->sink);
+        return NULL;
+    }
+
+    sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (!sdl->texture) {
+        printf("Failed to create texture: %s\n", SDL_GetError());
+        sdl_destroy(&sdl->sink);
+        return NULL;
+    }
+
+    return &sdl->sink;
+}
+
+void sync_to_real_time() {
+    static uint32_t last_time = 0;
+    uint32_t current_time = SDL_GetTicks();
+    uint32_t frame_time = 1000 / FRAMES_PER_SECOND;
+
+    uint32_t elapsed_time = current_time - last_time;
+
+    if (elapsed_time < frame_time) {
+        SDL_Delay(frame_time - elapsed_time);
+    }
+
+    // Update last_time to the current time after syncing
+    last_time = SDL_GetTicks();
+}
@@ -0,0 +1,13 @@
+#ifndef VIDEO_SDL_H
+#define VIDEO_SDL_H
+
+#include "video.h"
+
+// Windowed sink: converted pixels streamed into a texture and presented each
+// frame. Needs SDL_Init(SDL_INIT_VIDEO) first; returns NULL (after printing
+// why) if the window, renderer or texture cannot be created.
+VideoSink *video_sdl_create(void);
+
+void sync_to_real_time();
+
+#endif
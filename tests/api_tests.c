@@ -0,0 +1,299 @@
+// Library tests: libinvaders through its public header only. Run from the repository
+// root (make test).
+#include "invaders.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+#define ENVS        8
+#define SKIP        4
+
+// Port 1 for env at step: a coin at step 25, 1P start at step 50, then moves and fire
+// that differ between envs
+static uint8_t action(int env, int step) {
+    if (step == 25)
+        return INVADERS_CREDIT;
+    if (step == 50)
+        return INVADERS_P1_START;
+    if (step < 100)
+        return 0;
+
+    static const uint8_t moves[] = { 0, INVADERS_P1_LEFT, INVADERS_P1_RIGHT };
+    uint8_t fire = ((step + env) % 3) ? INVADERS_P1_FIRE : 0;
+    return fire | moves[(step / (4 + env)) % 3];
+}
+
+/*** Handles ***/
+
+static void run_steps(Invaders *invaders, int first, int steps) {
+    for (int step = first; step < first + steps; step++) {
+        invaders_set_input(invaders, 1, action(0, step));
+        for (int frame = 0; frame < SKIP; frame++)
+            invaders_step_frame(invaders);
+    }
+}
+
+// A state saved in play, loaded into a new handle, runs on exactly like the original
+static void test_state_round_trip(void) {
+    size_t size = invaders_state_size();
+    uint8_t *saved = (uint8_t*)malloc(size);
+    uint8_t *expected = (uint8_t*)malloc(size);
+    uint8_t *state = (uint8_t*)malloc(size);
+    uint8_t *framebuffer = (uint8_t*)malloc(INVADERS_FRAMEBUFFER_SIZE);
+    if (!saved || !expected || !state || !framebuffer) {
+        printf("api_tests: out of memory\n");
+        exit(1);
+    }
+
+    Invaders *original = invaders_create();
+    Invaders *loaded = invaders_create();
+    CHECK(invaders_set_core(original, INVADERS_CORE_STATIC + 1) == -1);
+    CHECK(invaders_set_core(original, INVADERS_CORE_THREADED) == 0);
+    CHECK(invaders_set_input(original, 3, 0) == -1);
+
+    run_steps(original, 0, 150);
+    CHECK(invaders_save_state(original, saved, size - 1) == 0);
+    CHECK(invaders_save_state(original, saved, size) == size);
+
+    // A bad image leaves the handle as it was
+    memcpy(state, saved, size);
+    state[0] ^= 0xFF;
+    CHECK(invaders_load_state(loaded, state, size) == -1);
+    CHECK(invaders_load_state(loaded, saved, size) == 0);
+    invaders_save_state(loaded, state, size);
+    CHECK(!memcmp(state, saved, size));
+
+    run_steps(original, 150, 100);
+    run_steps(loaded, 150, 100);
+    invaders_save_state(original, expected, size);
+    invaders_save_state(loaded, state, size);
+    CHECK(!memcmp(state, expected, size));
+    memcpy(framebuffer, invaders_framebuffer(original), INVADERS_FRAMEBUFFER_SIZE);
+    CHECK(!memcmp(invaders_framebuffer(loaded), framebuffer, INVADERS_FRAMEBUFFER_SIZE));
+
+    // Loading the image again goes back in time
+    CHECK(invaders_load_state(original, saved, size) == 0);
+    invaders_save_state(original, state, size);
+    CHECK(!memcmp(state, saved, size));
+    CHECK(memcmp(invaders_framebuffer(original), framebuffer, INVADERS_FRAMEBUFFER_SIZE));
+
+    invaders_destroy(original);
+    invaders_destroy(loaded);
+    free(saved);
+    free(expected);
+    free(state);
+    free(framebuffer);
+}
+
+// A clone runs on like its source, and neither disturbs the other
+static void test_clone(void) {
+    size_t size = invaders_state_size();
+    uint8_t *expected = (uint8_t*)malloc(size);
+    uint8_t *state = (uint8_t*)malloc(size);
+    if (!expected || !state) {
+        printf("api_tests: out of memory\n");
+        exit(1);
+    }
+
+    Invaders *source = invaders_create();
+    Invaders *reference = invaders_create();
+    Invaders *clone = invaders_create();
+    run_steps(source, 0, 150);
+    run_steps(reference, 0, 150);
+    run_steps(clone, 0, 20);
+    invaders_framebuffer(clone);    // Allocated before the clone, so it has to be refreshed
+
+    invaders_clone(clone, source);
+    invaders_save_state(source, expected, size);
+    invaders_save_state(clone, state, size);
+    CHECK(!memcmp(state, expected, size));
+    CHECK(!memcmp(invaders_framebuffer(clone), invaders_framebuffer(source), INVADERS_FRAMEBUFFER_SIZE));
+
+    // The clone plays another way; the source still matches a handle never cloned
+    for (int step = 150; step < 250; step++) {
+        invaders_set_input(clone, 1, action(5, step));
+        for (int frame = 0; frame < SKIP; frame++)
+            invaders_step_frame(clone);
+    }
+    run_steps(source, 150, 100);
+    run_steps(reference, 150, 100);
+    invaders_save_state(reference, expected, size);
+    invaders_save_state(source, state, size);
+    CHECK(!memcmp(state, expected, size));
+    invaders_save_state(clone, state, size);
+    CHECK(memcmp(state, expected, size));
+
+    invaders_destroy(source);
+    invaders_destroy(reference);
+    invaders_destroy(clone);
+    free(expected);
+    free(state);
+}
+
+/*** Batches ***/
+
+// A coin and a start lead to a game, which scores
+static void test_batch_rewards(void) {
+    InvadersBatch *batch = invaders_batch_create(1, 1, INVADERS_CORE_SWITCH);
+    CHECK(batch != NULL);
+    if (!batch)
+        return;
+
+    int32_t total = 0, reward;
+    int ended = 0;
+    uint8_t done;
+    for (int step = 0; step < 500 && !total && !ended; step++) {
+        uint8_t port1 = action(0, step);
+        invaders_batch_step(batch, &port1, SKIP, NULL, &reward, &done);
+        CHECK(reward >= 0);
+        total += reward;
+        ended |= done;
+    }
+    CHECK(total > 0 || ended);
+
+    invaders_batch_destroy(batch);
+}
+
+typedef struct {
+    uint8_t observations[ENVS * INVADERS_FRAMEBUFFER_SIZE];
+    int32_t rewards[ENVS];
+    uint8_t dones[ENVS];
+} StepResult;
+
+static void run_batch(int threads, int steps, StepResult *results) {
+    InvadersBatch *batch = invaders_batch_create(ENVS, threads, INVADERS_CORE_THREADED);
+    CHECK(batch != NULL);
+    if (!batch)
+        return;
+
+    uint8_t actions[ENVS];
+    for (int step = 0; step < steps; step++) {
+        for (int env = 0; env < ENVS; env++)
+            actions[env] = action(env, step);
+        // Envs restarted by hand at different times
+        if (step == 300)
+            invaders_batch_reset(batch, 3);
+        invaders_batch_step(batch, actions, SKIP, results[step].observations,
+                            results[step].rewards, results[step].dones);
+    }
+
+    invaders_batch_destroy(batch);
+}
+
+static void test_batch_threads_agree(void) {
+    const int steps = 400;
+    StepResult *one = (StepResult*)calloc(steps, sizeof(StepResult));
+    StepResult *four = (StepResult*)calloc(steps, sizeof(StepResult));
+    if (!one || !four) {
+        printf("api_tests: out of memory\n");
+        exit(1);
+    }
+
+    run_batch(1, steps, one);
+    run_batch(4, steps, four);
+
+    int32_t total = 0;
+    for (int step = 0; step < steps; step++) {
+        CHECK(!memcmp(one[step].rewards, four[step].rewards, sizeof(one[step].rewards)));
+        CHECK(!memcmp(one[step].dones, four[step].dones, sizeof(one[step].dones)));
+        CHECK(!memcmp(one[step].observations, four[step].observations, sizeof(one[step].observations)));
+        for (int env = 0; env < ENVS; env++)
+            total += one[step].rewards[env];
+    }
+    // Not a comparison of idle machines
+    CHECK(total > 0);
+
+    free(one);
+    free(four);
+}
+
+static void test_batch_reset_state(void) {
+    size_t size = invaders_state_size();
+    uint8_t *saved = (uint8_t*)malloc(size);
+    uint8_t *expected = (uint8_t*)malloc(size);
+    uint8_t *state = (uint8_t*)malloc(size);
+    if (!saved || !expected || !state) {
+        printf("api_tests: out of memory\n");
+        exit(1);
+    }
+
+    // A state in play, away from power-on
+    Invaders *source = invaders_create();
+    for (int step = 0; step < 120; step++) {
+        invaders_set_input(source, 1, action(0, step));
+        for (int frame = 0; frame < SKIP; frame++)
+            invaders_step_frame(source);
+    }
+    CHECK(invaders_save_state(source, saved, size) == size);
+    CHECK(invaders_load_state(source, saved, size - 1) == -1);
+
+    InvadersBatch *batch = invaders_batch_create(2, 2, INVADERS_CORE_SWITCH);
+    CHECK(batch != NULL);
+    if (!batch)
+        return;
+    CHECK(invaders_batch_set_reset_state(batch, saved, size - 1) == -1);
+    CHECK(invaders_batch_set_reset_state(batch, saved, size) == 0);
+    CHECK(invaders_batch_reset(batch, 2) == -1);
+
+    uint8_t actions[2] = { 0, 0 };
+    for (int step = 0; step < 40; step++)
+        invaders_batch_step(batch, actions, SKIP, NULL, NULL, NULL);
+
+    // No frames after the reset leaves env 0 at the saved state, env 1 where it was.
+    // The step still sets port 1, so it is given the saved value.
+    invaders_save_state(invaders_batch_env(batch, 1), expected, size);
+    CHECK(invaders_batch_reset(batch, 0) == 0);
+    actions[0] = action(0, 119);
+    invaders_batch_step(batch, actions, 0, NULL, NULL, NULL);
+    invaders_save_state(invaders_batch_env(batch, 0), state, size);
+    CHECK(!memcmp(state, saved, size));
+    invaders_save_state(invaders_batch_env(batch, 1), state, size);
+    CHECK(!memcmp(state, expected, size));
+
+    // And it runs on from there like the handle it came from
+    CHECK(invaders_batch_reset(batch, 0) == 0);
+    actions[0] = INVADERS_P1_FIRE | INVADERS_P1_LEFT;
+    invaders_batch_step(batch, actions, SKIP, NULL, NULL, NULL);
+    invaders_set_input(source, 1, actions[0]);
+    for (int frame = 0; frame < SKIP; frame++)
+        invaders_step_frame(source);
+    invaders_save_state(source, expected, size);
+    invaders_save_state(invaders_batch_env(batch, 0), state, size);
+    CHECK(!memcmp(state, expected, size));
+
+    invaders_batch_destroy(batch);
+    invaders_destroy(source);
+    free(saved);
+    free(expected);
+    free(state);
+}
+
+int main(void) {
+    const char *problem = invaders_load_rom("roms/invaders/invaders");
+    if (problem) {
+        printf("api_tests: %s\n", problem);
+        return 1;
+    }
+
+    CHECK(invaders_api_version() == INVADERS_API_VERSION);
+    test_state_round_trip();
+    test_clone();
+
+    test_batch_rewards();
+    test_batch_threads_agree();
+    test_batch_reset_state();
+
+    printf("api_tests: %d failed\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,179 @@
+// CPU tests: every core against the switch core and lockstep lanes against single
+// machines, on a game being played. Run from the repository root (make test).
+#include "cpu.h"
+#include "hle.h"
+#include "loop_idiom.h"
+#include "lockstep.h"
+#include "machine.h"
+#include "input.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static int failures;
+
+static const char *core_names[] = { "switch", "threaded", "jit", "static" };
+
+/*** Core agreement ***/
+
+#define FRAMES      1500
+#define INTERVAL    60
+
+// Port 1 like a player: a coin, 1P start, then moves and fire once the game is on
+static uint8_t player_input(int frame) {
+    if (frame >= 100 && frame < 105)
+        return 0x01;
+    if (frame >= 200 && frame < 205)
+        return 0x04;
+    if (frame < 420)
+        return 0;
+
+    static const uint8_t moves[] = { 0, 0x20, 0x40, 0x20 };
+    return moves[frame / 45 % 4] | (frame % 16 < 4 ? 0x10 : 0);
+}
+
+static int bcd(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0xF);
+}
+
+static int score(const Machine *machine) {
+    return bcd(read_memory(&machine->memory, 0x20F9)) * 100 + bcd(read_memory(&machine->memory, 0x20F8));
+}
+
+// State images every INTERVAL frames of a player's game on one core
+static void run_game(CpuCore core, uint8_t (*states)[MACHINE_STATE_SIZE]) {
+    Machine *machine = machine_create();
+    machine->cpu.core = core;
+
+    for (int frame = 0; frame < FRAMES; frame++) {
+        input_write(machine, 1, player_input(frame));
+        machine_run_frame(machine);
+        if ((frame + 1) % INTERVAL == 0)
+            machine_save_state(machine, states[frame / INTERVAL], MACHINE_STATE_SIZE);
+    }
+
+    machine_destroy(machine);
+}
+
+static void compare_game(CpuCore core, uint8_t (*reference)[MACHINE_STATE_SIZE], const char *against) {
+    static uint8_t states[FRAMES / INTERVAL][MACHINE_STATE_SIZE];
+
+    run_game(core, states);
+    for (int i = 0; i < FRAMES / INTERVAL; i++) {
+        if (memcmp(reference[i], states[i], MACHINE_STATE_SIZE)) {
+            printf("cpu_tests: %s core differs from %s after frame %d\n", core_names[core], against, (i + 1) * INTERVAL);
+            failures++;
+            return;
+        }
+    }
+}
+
+// Every core against the switch core, with the hooks as they are set
+static void test_cores_agree(void) {
+    static uint8_t reference[FRAMES / INTERVAL][MACHINE_STATE_SIZE];
+
+    run_game(CPU_CORE_SWITCH, reference);
+    for (int core = 1; core < 4; core++)
+        compare_game((CpuCore)core, reference, "switch");
+}
+
+// HLE routines and loop idioms on, on every core, against the ROM's own code interpreted
+static void test_hooks_agree(void) {
+    static uint8_t reference[FRAMES / INTERVAL][MACHINE_STATE_SIZE];
+
+    hle_set_mode(HLE_OFF);
+    loop_idiom_set_enabled(0);
+    run_game(CPU_CORE_SWITCH, reference);
+    hle_set_mode(HLE_ON);
+    loop_idiom_set_enabled(1);
+
+    // The game has to be played, not sitting in attract mode
+    Machine *machine = machine_create();
+    machine_load_state(machine, reference[FRAMES / INTERVAL - 1], MACHINE_STATE_SIZE);
+    if (read_memory(&machine->memory, 0x20EF) != 1 || score(machine) == 0) {
+        printf("cpu_tests: no game in play after frame %d\n", FRAMES);
+        failures++;
+    }
+    machine_destroy(machine);
+
+    for (int core = 0; core < 4; core++)
+        compare_game((CpuCore)core, reference, "switch without hooks");
+}
+
+/*** Lockstep ***/
+
+#define LANES       8
+
+// The same boot, coin and start on every lane, then each lane plays its own way
+static uint8_t lane_input(int lane, int frame) {
+    return player_input(frame < 420 ? frame : frame + lane * 7);
+}
+
+// Lanes on mixed cores against the same machines run one at a time
+static void test_lockstep_matches_scalar(void) {
+    Machine *lanes[LANES], *scalar[LANES];
+    uint8_t expected[MACHINE_STATE_SIZE], state[MACHINE_STATE_SIZE];
+
+    for (int lane = 0; lane < LANES; lane++) {
+        lanes[lane] = machine_create();
+        scalar[lane] = machine_create();
+        lanes[lane]->cpu.core = scalar[lane]->cpu.core = (CpuCore)(lane % 4);
+    }
+    Lockstep *lockstep = lockstep_create(lanes, LANES);
+
+    for (int frame = 0; frame < FRAMES; frame++) {
+        for (int lane = 0; lane < LANES; lane++) {
+            input_write(lanes[lane], 1, lane_input(lane, frame));
+            input_write(scalar[lane], 1, lane_input(lane, frame));
+            machine_run_frame(scalar[lane]);
+        }
+        lockstep_run_frame(lockstep);
+        if ((frame + 1) % INTERVAL)
+            continue;
+
+        for (int lane = 0; lane < LANES; lane++) {
+            machine_save_state(scalar[lane], expected, sizeof(expected));
+            machine_save_state(lanes[lane], state, sizeof(state));
+            if (memcmp(expected, state, sizeof(state))) {
+                printf("cpu_tests: lockstep lane %d differs after frame %d\n", lane, frame + 1);
+                failures++;
+            }
+        }
+    }
+
+    // Both paths were taken: lanes together through the boot, apart once they play
+    const LockstepStats *stats = lockstep_stats(lockstep);
+    if (!stats->vector_instructions || !stats->converged_halves || !stats->split_halves) {
+        printf("cpu_tests: lockstep never ran %s\n", stats->split_halves ? "converged" : "split");
+        failures++;
+    }
+
+    lockstep_destroy(lockstep);
+    for (int lane = 0; lane < LANES; lane++) {
+        machine_destroy(lanes[lane]);
+        machine_destroy(scalar[lane]);
+    }
+}
+
+int main(void) {
+    const char *problem = load_rom("roms/invaders/invaders");
+    if (problem) {
+        printf("cpu_tests: %s\n", problem);
+        return 1;
+    }
+
+    test_cores_agree();
+    test_hooks_agree();
+    test_lockstep_matches_scalar();
+
+    // Everything interpreted, so the JIT and static core run the ROM's own loops
+    hle_set_mode(HLE_OFF);
+    loop_idiom_set_enabled(0);
+    test_cores_agree();
+    hle_set_mode(HLE_ON);
+    loop_idiom_set_enabled(1);
+
+    printf("cpu_tests: %d failed\n", failures);
+    return failures != 0;
+}
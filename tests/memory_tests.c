@@ -0,0 +1,413 @@
+// Memory tests: copy-on-write pages, machine pools, the RAM hash and the write journal.
+// Run from the repository root (make test).
+#include "memory.h"
+#include "machine.h"
+#include "input.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// xorshift32, so every run makes the same writes
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// A RAM address, mirrors included
+static uint16_t random_address(void) {
+    return (uint16_t)(RAM_START + rng() % (0x10000 - RAM_START));
+}
+
+static void fill_random(Memory *memory, int writes) {
+    for (int i = 0; i < writes; i++)
+        write_memory(memory, random_address(), (uint8_t)rng());
+}
+
+static int same_ram(const Memory *a, const Memory *b) {
+    static uint8_t ram_a[RAM_SIZE], ram_b[RAM_SIZE];
+    memory_get_ram(a, 0, ram_a, RAM_SIZE);
+    memory_get_ram(b, 0, ram_b, RAM_SIZE);
+    return !memcmp(ram_a, ram_b, RAM_SIZE);
+}
+
+static const uint8_t *page_host(const Memory *memory, uint16_t address) {
+    return memory->pages[(address & RAM_ADDRESS_MASK) >> PAGE_SHIFT].host;
+}
+
+static int state_is(const Machine *machine, const uint8_t *expected) {
+    uint8_t state[MACHINE_STATE_SIZE];
+    machine_save_state(machine, state, sizeof(state));
+    return !memcmp(state, expected, sizeof(state));
+}
+
+/*** Copy-on-write ***/
+
+static void test_clone_shares_pages(void) {
+    Memory parent, child;
+    memory_init(&parent);
+    memory_init(&child);
+    fill_random(&parent, 4000);
+
+    memory_copy(&child, &parent);
+    CHECK(same_ram(&child, &parent));
+    for (unsigned page = 0; page < RAM_PAGES; page++) {
+        CHECK(child.pages[page].host == parent.pages[page].host);
+        CHECK(parent.pages[page].attrs & PAGE_SHARED);
+    }
+
+    memory_release(&child);
+    memory_release(&parent);
+}
+
+static void test_child_write_leaves_parent(void) {
+    Memory parent, child;
+    uint8_t before[RAM_SIZE];
+    memory_init(&parent);
+    memory_init(&child);
+    fill_random(&parent, 4000);
+    memory_get_ram(&parent, 0, before, RAM_SIZE);
+
+    memory_copy(&child, &parent);
+    const uint8_t *block = page_host(&parent, 0x2400);
+    write_memory(&child, 0x2400, (uint8_t)~read_memory(&parent, 0x2400));
+    fill_random(&child, 4000);
+
+    uint8_t after[RAM_SIZE];
+    memory_get_ram(&parent, 0, after, RAM_SIZE);
+    CHECK(!memcmp(before, after, RAM_SIZE));
+    CHECK(page_host(&parent, 0x2400) == block);
+    CHECK(page_host(&child, 0x2400) != block);
+    CHECK(read_memory(&child, 0x2400) != read_memory(&parent, 0x2400));
+
+    memory_release(&child);
+    memory_release(&parent);
+}
+
+// The parent copies a shared page it writes only while another holder is left
+static void test_released_blocks_are_not_copied(void) {
+    Memory parent, child;
+    memory_init(&parent);
+    memory_init(&child);
+    fill_random(&parent, 4000);
+
+    memory_copy(&child, &parent);
+    const uint8_t *block = page_host(&parent, 0x2000);
+    uint8_t old = read_memory(&child, 0x2000);
+    write_memory(&parent, 0x2000, (uint8_t)~old);
+    CHECK(page_host(&parent, 0x2000) != block);
+    CHECK(page_host(&child, 0x2000) == block);
+    CHECK(read_memory(&child, 0x2000) == old);
+
+    memory_copy(&child, &parent);
+    memory_release(&child);
+    block = page_host(&parent, 0x2100);
+    write_memory(&parent, 0x2100, 0xA5);
+    CHECK(page_host(&parent, 0x2100) == block);
+    CHECK(!(parent.pages[1].attrs & PAGE_SHARED));
+
+    memory_release(&parent);
+}
+
+static void test_dedup(void) {
+    Memory a, b;
+    Memory *memories[2] = { &a, &b };
+    memory_init(&a);
+    memory_init(&b);
+    for (uint16_t address = RAM_START; address < RAM_START + 4 * PAGE_SIZE; address++) {
+        write_memory(&a, address, (uint8_t)(address ^ address >> 8));
+        write_memory(&b, address, (uint8_t)(address ^ address >> 8));
+    }
+
+    CHECK(memory_dedup(memories, 2) == 4);
+    CHECK(same_ram(&a, &b));
+    CHECK(page_host(&a, RAM_START) == page_host(&b, RAM_START));
+
+    write_memory(&b, RAM_START, 0xFF);
+    CHECK(read_memory(&a, RAM_START) == 0x20);
+
+    memory_release(&a);
+    memory_release(&b);
+}
+
+static void test_machine_clone(void) {
+    Machine *parent = machine_create();
+    Machine *child = machine_create();
+    uint8_t before[MACHINE_STATE_SIZE], after[MACHINE_STATE_SIZE];
+
+    for (int frame = 0; frame < 120; frame++)
+        machine_run_frame(parent);
+    machine_save_state(parent, before, sizeof(before));
+
+    machine_clone(child, parent);
+    for (int frame = 0; frame < 120; frame++)
+        machine_run_frame(child);
+    machine_save_state(parent, after, sizeof(after));
+    CHECK(!memcmp(before, after, sizeof(before)));
+
+    machine_destroy(child);
+    machine_destroy(parent);
+}
+
+/*** Pools ***/
+
+// Spares come back as exact clones, whatever they ran before, and released
+// machines stop sharing the parent's pages
+static void test_pool(void) {
+    uint8_t parent_state[MACHINE_STATE_SIZE];
+    Machine *parent = machine_create();
+    Machine *forks[4], *first[4];
+    MachinePool *pool = machine_pool_create(2);
+
+    for (int frame = 0; frame < 120; frame++)
+        machine_run_frame(parent);
+    machine_save_state(parent, parent_state, sizeof(parent_state));
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            forks[i] = machine_pool_clone(pool, parent);
+            CHECK(state_is(forks[i], parent_state));
+            CHECK(forks[i]->cpu.core == parent->cpu.core);
+            if (!round)
+                first[i] = forks[i];
+        }
+
+        // Later rounds take the first round's machines back instead of allocating
+        for (int i = 0; round && i < 4; i++) {
+            int reused = 0;
+            for (int j = 0; j < 4; j++)
+                reused |= forks[i] == first[j];
+            CHECK(reused);
+        }
+
+        // Each fork goes its own way: another core, inputs, frames
+        for (int i = 0; i < 4; i++) {
+            forks[i]->cpu.core = (CpuCore)i;
+            input_write(forks[i], 1, (uint8_t)(1 << i));
+            for (int frame = 0; frame < 30 * (i + 1); frame++)
+                machine_run_frame(forks[i]);
+        }
+        CHECK(state_is(parent, parent_state));
+
+        for (int i = 0; i < 4; i++)
+            machine_pool_release(pool, forks[i]);
+    }
+
+    // Nobody shares the parent's pages now, so writing one copies nothing
+    const uint8_t *block = page_host(&parent->memory, 0x2000);
+    write_memory(&parent->memory, 0x2000, (uint8_t)~read_memory(&parent->memory, 0x2000));
+    CHECK(page_host(&parent->memory, 0x2000) == block);
+
+    machine_pool_destroy(pool);
+    machine_destroy(parent);
+}
+
+/*** RAM hash ***/
+
+// memory_hash worked out from all 8 KB, on a copy with hashing off
+static uint64_t full_hash(const Memory *memory) {
+    static uint8_t ram[RAM_SIZE];
+    Memory copy;
+    memory_init(&copy);
+    memory_get_ram(memory, 0, ram, RAM_SIZE);
+    memory_set_ram(&copy, 0, ram, RAM_SIZE);
+    uint64_t hash = memory_hash(&copy);
+    memory_release(&copy);
+    return hash;
+}
+
+static void test_hash_writes(void) {
+    Memory memory;
+    memory_init(&memory);
+    fill_random(&memory, 1000);
+    memory_set_hashing(&memory, 1);
+    CHECK(memory.hash == full_hash(&memory));
+
+    for (int round = 0; round < 20; round++) {
+        fill_random(&memory, 500);
+        // Zero bytes are keyed 0, so clearing a byte has to take its key out
+        for (int i = 0; i < 50; i++)
+            write_memory(&memory, random_address(), 0);
+        CHECK(memory.hash == full_hash(&memory));
+    }
+
+    memory_release(&memory);
+}
+
+static void test_hash_set_ram(void) {
+    Memory memory;
+    uint8_t bytes[3 * PAGE_SIZE];
+    memory_init(&memory);
+    memory_set_hashing(&memory, 1);
+    fill_random(&memory, 2000);
+
+    for (int round = 0; round < 20; round++) {
+        uint32_t size = 1 + rng() % sizeof(bytes);
+        uint32_t offset = rng() % (RAM_SIZE - size);
+        for (uint32_t i = 0; i < size; i++)
+            bytes[i] = (rng() & 3) ? (uint8_t)rng() : 0;
+        memory_set_ram(&memory, offset, bytes, size);
+        CHECK(memory.hash == full_hash(&memory));
+    }
+
+    memory_release(&memory);
+}
+
+static void test_hash_journal_undo(void) {
+    static JournalEntry entries[1 << 14];
+    MemoryJournal journal = { entries, (1 << 14) - 1, 0 };
+    Memory memory;
+    uint8_t before[RAM_SIZE], after[RAM_SIZE];
+    memory_init(&memory);
+    memory_set_hashing(&memory, 1);
+    fill_random(&memory, 2000);
+    memory_set_journal(&memory, &journal);
+
+    uint64_t position = journal.written;
+    uint64_t hash = memory.hash;
+    memory_get_ram(&memory, 0, before, RAM_SIZE);
+
+    fill_random(&memory, 4000);
+    memory_set_ram(&memory, 0x100, before + 0x1000, 0x300);
+    CHECK(memory.hash == full_hash(&memory));
+
+    CHECK(memory_journal_undo(&memory, position) == 0);
+    memory_get_ram(&memory, 0, after, RAM_SIZE);
+    CHECK(!memcmp(before, after, RAM_SIZE));
+    CHECK(memory.hash == hash);
+    CHECK(memory.hash == full_hash(&memory));
+
+    memory_set_journal(&memory, NULL);
+    memory_release(&memory);
+}
+
+static void test_hash_clone(void) {
+    Memory parent, child;
+    memory_init(&parent);
+    memory_init(&child);
+    memory_set_hashing(&parent, 1);
+    fill_random(&parent, 2000);
+
+    memory_copy(&child, &parent);
+    CHECK(child.hash == parent.hash);
+    fill_random(&child, 2000);
+    fill_random(&parent, 100);
+    CHECK(child.hash == full_hash(&child));
+    CHECK(parent.hash == full_hash(&parent));
+
+    memory_release(&child);
+    memory_release(&parent);
+}
+
+// HLE routines and loop idioms store to RAM too
+static void test_hash_every_core(void) {
+    for (int core = 0; core < 4; core++) {
+        Machine *machine = machine_create();
+        machine->cpu.core = (CpuCore)core;
+        memory_set_hashing(&machine->memory, 1);
+        for (int frame = 0; frame < 300; frame++)
+            machine_run_frame(machine);
+        CHECK(machine->memory.hash == full_hash(&machine->memory));
+        machine_destroy(machine);
+    }
+}
+
+/*** Write journal ***/
+
+// machine_rollback(n) gives back the state image saved n frames earlier, byte for byte
+static void test_rollback(void) {
+    static uint8_t states[11][MACHINE_STATE_SIZE];
+
+    for (int core = 0; core < 4; core++) {
+        Machine *machine = machine_create();
+        machine->cpu.core = (CpuCore)core;
+        memory_set_hashing(&machine->memory, 1);
+        CHECK(machine_set_journal(machine, 16, 1 << 17) == 0);
+
+        for (int frame = 0; frame < 200; frame++)
+            machine_run_frame(machine);
+        for (int frame = 0; frame <= 10; frame++) {
+            if (frame)
+                machine_run_frame(machine);
+            machine_save_state(machine, states[frame], MACHINE_STATE_SIZE);
+        }
+
+        CHECK(machine_rollback(machine, 3) == 0);
+        CHECK(state_is(machine, states[7]));
+        CHECK(machine_rollback(machine, 0) == 0);
+        CHECK(state_is(machine, states[7]));
+        CHECK(machine->memory.hash == full_hash(&machine->memory));
+
+        // Running on from a rollback retraces the same frames
+        machine_run_frame(machine);
+        CHECK(state_is(machine, states[8]));
+
+        CHECK(machine_rollback(machine, 8) == 0);
+        CHECK(state_is(machine, states[0]));
+        CHECK(machine->memory.hash == full_hash(&machine->memory));
+
+        // Only 16 frames are kept
+        CHECK(machine_rollback(machine, 17) == -1);
+        CHECK(state_is(machine, states[0]));
+
+        machine_destroy(machine);
+    }
+}
+
+// Once the write ring has wrapped past a frame, rolling back to it fails and changes nothing
+static void test_rollback_past_ring(void) {
+    uint8_t state[MACHINE_STATE_SIZE];
+    Machine *machine = machine_create();
+    CHECK(machine_set_journal(machine, 16, 64) == 0);
+
+    for (int frame = 0; frame < 200; frame++)
+        machine_run_frame(machine);
+    machine_save_state(machine, state, sizeof(state));
+
+    CHECK(machine_rollback(machine, 10) == -1);
+    CHECK(state_is(machine, state));
+    CHECK(machine_rollback(machine, 0) == 0);
+    CHECK(state_is(machine, state));
+
+    machine_destroy(machine);
+}
+
+int main(void) {
+    const char *problem = load_rom("roms/invaders/invaders");
+    if (problem) {
+        printf("memory_tests: %s\n", problem);
+        return 1;
+    }
+
+    test_clone_shares_pages();
+    test_child_write_leaves_parent();
+    test_released_blocks_are_not_copied();
+    test_dedup();
+    test_machine_clone();
+    test_pool();
+
+    test_hash_writes();
+    test_hash_set_ram();
+    test_hash_journal_undo();
+    test_hash_clone();
+    test_hash_every_core();
+
+    test_rollback();
+    test_rollback_past_ring();
+
+    printf("memory_tests: %d failed\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,122 @@
+// Search tests: results independent of the thread count. Run from the repository root (make test).
+#include "search.h"
+#include "machine.h"
+#include "input.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// None, fire, left, right, fire with left, fire with right
+static const uint8_t inputs[][2] = { {0, 0}, {0x10, 0}, {0x20, 0}, {0x40, 0}, {0x30, 0}, {0x50, 0} };
+
+#define FRAMES      8
+#define MAX_PATH    256
+
+static int bcd(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0xF);
+}
+
+// Player 1's score
+static int64_t score(const Machine *machine, void *context) {
+    (void)context;
+    return bcd(read_memory(&machine->memory, 0x20F9)) * 100 + bcd(read_memory(&machine->memory, 0x20F8));
+}
+
+// A coin and 1P start, then on until the player is in play
+static void start_game(Machine *machine) {
+    for (int frame = 0; frame < 420; frame++) {
+        uint8_t port1 = 0;
+        if (frame >= 100 && frame < 105)
+            port1 = 0x01;
+        else if (frame >= 200 && frame < 205)
+            port1 = 0x04;
+        input_write(machine, 1, port1);
+        machine_run_frame(machine);
+    }
+}
+
+typedef struct {
+    SearchStats stats;
+    int path[MAX_PATH];
+    int length;
+} SearchResult;
+
+static void run_search(Machine *root, SearchOrder order, long max_nodes, int threads, SearchResult *result) {
+    SearchConfig config = { 0 };
+    config.order = order;
+    config.inputs = inputs;
+    config.num_inputs = 6;
+    config.frames = FRAMES;
+    config.max_nodes = max_nodes;
+    config.evaluate = score;
+
+    Search *search = search_create(&config, threads);
+    CHECK(search != NULL);
+    if (!search)
+        return;
+    search_run(search, root);
+    result->stats = *search_stats(search);
+    result->length = search_best_path(search, result->path, MAX_PATH);
+    search_destroy(search);
+}
+
+/*** Thread count ***/
+
+static void test_threads_agree(Machine *root, SearchOrder order, long max_nodes) {
+    static SearchResult one, four;
+    run_search(root, order, max_nodes, 1, &one);
+    run_search(root, order, max_nodes, 4, &four);
+
+    CHECK(one.stats.expanded == four.stats.expanded);
+    CHECK(one.stats.generated == four.stats.generated);
+    CHECK(one.stats.duplicates == four.stats.duplicates);
+    CHECK(one.stats.rounds == four.stats.rounds);
+    CHECK(one.stats.depth == four.stats.depth);
+    CHECK(one.stats.best_score == four.stats.best_score);
+    CHECK(one.length == four.length);
+    CHECK(one.length <= MAX_PATH && !memcmp(one.path, four.path, one.length * sizeof(int)));
+
+    // The path leads to a state with the best score
+    Machine *replay = machine_create();
+    machine_clone(replay, root);
+    for (int i = 0; i < one.length && i < MAX_PATH; i++) {
+        input_write(replay, 1, inputs[one.path[i]][0]);
+        input_write(replay, 2, inputs[one.path[i]][1]);
+        for (int frame = 0; frame < FRAMES; frame++)
+            machine_run_frame(replay);
+    }
+    CHECK(score(replay, NULL) == one.stats.best_score);
+    CHECK(order != SEARCH_BEST_FIRST || one.stats.best_score > 0);
+    machine_destroy(replay);
+}
+
+int main(void) {
+    const char *problem = load_rom("roms/invaders/invaders");
+    if (problem) {
+        printf("search_tests: %s\n", problem);
+        return 1;
+    }
+
+    Machine *root = machine_create();
+    root->cpu.core = CPU_CORE_THREADED;
+    start_game(root);
+    CHECK(read_memory(&root->memory, 0x20EF) == 1);
+
+    // Best-first finds points within 6000 nodes (docs/search.md)
+    test_threads_agree(root, SEARCH_BEST_FIRST, 6000);
+    test_threads_agree(root, SEARCH_BREADTH_FIRST, 1500);
+
+    machine_destroy(root);
+    printf("search_tests: %d failed\n", failures);
+    return failures != 0;
+}
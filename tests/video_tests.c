@@ -0,0 +1,122 @@
+// Video sink tests: every sink shows the frame invaders_framebuffer has. Run from the
+// repository root (make test).
+#include "video.h"
+#include "invaders.h"
+#include "machine.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+#define RECORD_PATH     "bin/video_tests.vram"
+#define RECORD_FRAMES   3
+
+// A coin, 1P start, then fire while moving right, so the screen changes every frame
+static void run_frames(Invaders *invaders, int first, int frames) {
+    for (int frame = first; frame < first + frames; frame++) {
+        uint8_t port1 = 0;
+        if (frame >= 100 && frame < 105)
+            port1 = INVADERS_CREDIT;
+        else if (frame >= 200 && frame < 205)
+            port1 = INVADERS_P1_START;
+        else if (frame >= 420)
+            port1 = INVADERS_P1_RIGHT | (frame % 16 < 4 ? INVADERS_P1_FIRE : 0);
+        invaders_set_input(invaders, 1, port1);
+        invaders_step_frame(invaders);
+    }
+}
+
+static void test_buffer_vram(Invaders *invaders, Machine *machine) {
+    VideoSink *sink = video_buffer_create(VIDEO_VRAM);
+    video_present(sink, machine);
+    CHECK(sink->frames == 1);
+    CHECK(!memcmp(video_buffer_data(sink), invaders_framebuffer(invaders), INVADERS_FRAMEBUFFER_SIZE));
+    video_destroy(sink);
+}
+
+// Pixel (x, y) is bit 7 - x % 8 of byte y * 32 + x / 8, as the window has always drawn
+// it. Rows from 224 on lie past video RAM, so only the first 224 are compared.
+static void test_buffer_pixels(Invaders *invaders, Machine *machine) {
+    VideoSink *sink = video_buffer_create(VIDEO_PIXELS);
+    video_present(sink, machine);
+
+    const uint32_t *pixels = (const uint32_t*)video_buffer_data(sink);
+    const uint8_t *framebuffer = invaders_framebuffer(invaders);
+    int mismatches = 0, lit = 0;
+    for (int y = 0; y < INVADERS_FRAMEBUFFER_SIZE / 32; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            int on = (framebuffer[y * 32 + x / 8] >> (7 - x % 8)) & 1;
+            mismatches += pixels[y * SCREEN_WIDTH + x] != (on ? 0xFFFFFFFF : 0xFF000000);
+            lit += on;
+        }
+    }
+    CHECK(mismatches == 0);
+    CHECK(lit > 0);
+
+    video_destroy(sink);
+}
+
+// A --record file is the framebuffer of every frame, back to back
+static void test_file_vram(Invaders *invaders, Machine *machine) {
+    static uint8_t expected[RECORD_FRAMES][INVADERS_FRAMEBUFFER_SIZE];
+    static uint8_t recorded[RECORD_FRAMES + 1][INVADERS_FRAMEBUFFER_SIZE];
+
+    VideoSink *sink = video_file_create(RECORD_PATH, VIDEO_VRAM);
+    for (int frame = 0; frame < RECORD_FRAMES; frame++) {
+        run_frames(invaders, 600 + frame, 1);
+        video_present(sink, machine);
+        memcpy(expected[frame], invaders_framebuffer(invaders), INVADERS_FRAMEBUFFER_SIZE);
+    }
+    video_destroy(sink);
+
+    FILE *file = fopen(RECORD_PATH, "rb");
+    CHECK(file != NULL);
+    if (!file)
+        return;
+    size_t frames = fread(recorded, INVADERS_FRAMEBUFFER_SIZE, RECORD_FRAMES + 1, file);
+    fclose(file);
+    remove(RECORD_PATH);
+
+    CHECK(frames == RECORD_FRAMES);
+    CHECK(!memcmp(recorded, expected, sizeof(expected)));
+    CHECK(memcmp(expected[0], expected[RECORD_FRAMES - 1], INVADERS_FRAMEBUFFER_SIZE));
+}
+
+static void test_null(Machine *machine) {
+    VideoSink *sink = video_null_create();
+    video_present(sink, machine);
+    video_present(sink, machine);
+    CHECK(sink->frames == 2);
+    video_destroy(sink);
+}
+
+int main(void) {
+    const char *problem = invaders_load_rom("roms/invaders/invaders");
+    if (problem) {
+        printf("video_tests: %s\n", problem);
+        return 1;
+    }
+
+    // Sinks take the Machine a handle is (src/api/invaders.c)
+    Invaders *invaders = invaders_create();
+    Machine *machine = (Machine*)invaders;
+    run_frames(invaders, 0, 600);
+
+    test_buffer_vram(invaders, machine);
+    test_buffer_pixels(invaders, machine);
+    test_file_vram(invaders, machine);
+    test_null(machine);
+
+    invaders_destroy(invaders);
+    printf("video_tests: %d failed\n", failures);
+    return failures != 0;
+}
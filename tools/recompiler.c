@@ -0,0 +1,348 @@
+#include "instructions.h"
+#include "memory.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Ahead-of-time ROM to C translator for the static core (src/cpu/cpu_static.c).
+ *
+ * Walks the ROM from the reset and interrupt vectors following jumps, calls
+ * and return addresses, splits the reached code into basic blocks and writes
+ * one C function per block built from the SR_ statements in static_core.h,
+ * plus the table cpu_run_static dispatches through.
+ *
+ *     recompiler <rom> <static_blocks.c>
+ *
+ * Indirect branches (RET, PCHL) end a block and the driver looks up the next
+ * one at run time. OUT, the RSTs and the undocumented opcode duplicates are
+ * left to the interpreter, as is anything the walk never reached.
+ */
+
+#define IS_BLOCK_START  0x01    // Branch target, call return point or vector
+#define IS_CODE         0x02    // First byte of an instruction the walk reached
+
+static uint8_t rom[ROM_SIZE];
+static uint8_t marks[ROM_SIZE];
+
+static uint16_t worklist[ROM_SIZE];
+static unsigned worklist_size;
+
+/**
+ * Byte length as the emulator executes the opcode
+ *
+ * instructions.h lists the undocumented 0xCB/0xD9/0xDD/0xED/0xFD as the
+ * JMP/RET/CALL they alias on real hardware, the emulator runs them as one
+ * byte no-ops.
+ *
+ * @param opcode  The opcode
+ * @return        Bytes taken by the instruction
+ */
+static unsigned instruction_length(uint8_t opcode) {
+    switch (opcode) {
+        case 0xCB: case 0xD9: case 0xDD: case 0xED: case 0xFD:
+            return 1;
+        default:
+            return disassembler_instruction_table[opcode].bytes;
+    }
+}
+
+/**
+ * Instructions the recompiler leaves to the interpreter
+ *
+ * OUT calls out to the machine's ports and sound hook, the RSTs charge their cycles
+ * through rst_helper, the duplicates disagree with instructions.h.
+ */
+static int is_interpreted(uint8_t opcode) {
+    return opcode == 0xD3 || (opcode & 0xC7) == 0xC7 ||
+           opcode == 0xCB || opcode == 0xD9 || opcode == 0xDD ||
+           opcode == 0xED || opcode == 0xFD;
+}
+
+static int is_conditional_jump(uint8_t opcode) { return (opcode & 0xC7) == 0xC2; }
+static int is_conditional_call(uint8_t opcode) { return (opcode & 0xC7) == 0xC4; }
+static int is_conditional_ret(uint8_t opcode)  { return (opcode & 0xC7) == 0xC0; }
+
+// Instructions after which execution never falls through
+static int is_unconditional_exit(uint8_t opcode) {
+    return opcode == 0xC3 || opcode == 0xC9 || opcode == 0xE9;
+}
+
+// Operands spilling into RAM can change, so such code is never translated
+static int fits_in_rom(uint32_t pc) {
+    return pc < ROM_SIZE && pc + instruction_length(rom[pc]) <= ROM_SIZE;
+}
+
+static uint16_t operand16(uint16_t pc) {
+    return (uint16_t)(rom[pc + 1] | (rom[pc + 2] << 8));
+}
+
+static void add_block_start(uint32_t pc) {
+    if (pc >= ROM_SIZE)
+        return;
+    if (!(marks[pc] & IS_BLOCK_START)) {
+        marks[pc] |= IS_BLOCK_START;
+        worklist[worklist_size++] = (uint16_t)pc;
+    }
+}
+
+/**
+ * Follows straight-line code from pc, queueing every branch target
+ *
+ * @param pc  Address to start tracing from
+ */
+static void trace(uint16_t pc) {
+    while (fits_in_rom(pc) && !(marks[pc] & IS_CODE)) {
+        uint8_t opcode = rom[pc];
+        unsigned length = instruction_length(opcode);
+
+        marks[pc] |= IS_CODE;
+
+        if (opcode == 0xC3 || is_conditional_jump(opcode) ||
+            opcode == 0xCD || is_conditional_call(opcode))
+            add_block_start(operand16(pc));
+        if (opcode == 0xCD || is_conditional_call(opcode) || is_interpreted(opcode))
+            add_block_start(pc + length);
+        if ((opcode & 0xC7) == 0xC7)
+            add_block_start(opcode & 0x38);
+
+        if (is_unconditional_exit(opcode))
+            return;
+        if (is_conditional_jump(opcode) || is_conditional_ret(opcode) || is_interpreted(opcode)) {
+            add_block_start(pc + length);
+            return;
+        }
+        pc += length;
+    }
+}
+
+static void walk_rom(void) {
+    // Reset and the RST vectors, interrupts come in through RST 1 and RST 2
+    for (uint16_t vector = 0x00; vector <= 0x38; vector += 8)
+        add_block_start(vector);
+
+    while (worklist_size)
+        trace(worklist[--worklist_size]);
+}
+
+static const char *reg_names[8] = {"B", "C", "D", "E", "H", "L", "M", "A"};
+static const char *pair_names[4][2] = {{"B", "C"}, {"D", "E"}, {"H", "L"}, {"SP", "SP"}};
+static const char *pair_words[4] = {"BC", "DE", "HL", "SP"};
+static const char *conditions[8] = {
+    "!(get_flags(cpu) & FLAG_Z)", "get_flags(cpu) & FLAG_Z", "!(get_flags(cpu) & FLAG_CY)", "get_flags(cpu) & FLAG_CY",
+    "!(get_flags(cpu) & FLAG_P)", "get_flags(cpu) & FLAG_P", "!(get_flags(cpu) & FLAG_S)", "get_flags(cpu) & FLAG_S"
+};
+static const char *alu_ops[8] = {"ADD", "ADC", "SUB", "SBB", "ANA", "XRA", "ORA", "CMP"};
+static const char *alu_imm_ops[8] = {"ADI", "ACI", "SUB", "SBB", "ANI", "XRI", "ORI", "CPI"};
+
+/**
+ * Writes the SR_ statement for one instruction
+ *
+ * @param out  Generated source file
+ * @param pc   Address of the instruction
+ * @return     1 if the instruction ends the block
+ */
+static int emit_instruction(FILE *out, uint16_t pc) {
+    uint8_t opcode = rom[pc];
+    uint16_t next = pc + instruction_length(opcode);
+    uint8_t d8 = rom[(pc + 1) % ROM_SIZE];
+    uint16_t d16 = fits_in_rom(pc) && instruction_length(opcode) == 3 ? operand16(pc) : 0;
+    char line[96];
+    int ends_block = 0;
+
+    const char *dst = reg_names[(opcode >> 3) & 7];
+    const char *src = reg_names[opcode & 7];
+    const char **pair = pair_names[(opcode >> 4) & 3];
+    const char *word = pair_words[(opcode >> 4) & 3];
+    const char *cond = conditions[(opcode >> 3) & 7];
+
+    if (opcode >= 0x40 && opcode <= 0x7F && opcode != 0x76) {
+        if (*src == 'M')
+            snprintf(line, sizeof(line), "SR_MOV_RM(%s);", dst);
+        else if (*dst == 'M')
+            snprintf(line, sizeof(line), "SR_MOV_MR(%s);", src);
+        else
+            snprintf(line, sizeof(line), "SR_MOV(%s, %s);", dst, src);
+    } else if (opcode >= 0x80 && opcode <= 0xBF) {
+        if (*src == 'M')
+            snprintf(line, sizeof(line), "SR_%s(read_memory(SR_MEM, SR_HL));", alu_ops[(opcode >> 3) & 7]);
+        else
+            snprintf(line, sizeof(line), "SR_%s(cpu->%s);", alu_ops[(opcode >> 3) & 7], src);
+    } else if ((opcode & 0xC7) == 0xC6) {
+        snprintf(line, sizeof(line), "SR_%s(0x%02X);", alu_imm_ops[(opcode >> 3) & 7], d8);
+    } else if (opcode < 0x40 && (opcode & 0x07) == 0x04) {
+        snprintf(line, sizeof(line), *dst == 'M' ? "SR_INR_M();" : "SR_INR(%s);", dst);
+    } else if (opcode < 0x40 && (opcode & 0x07) == 0x05) {
+        snprintf(line, sizeof(line), *dst == 'M' ? "SR_DCR_M();" : "SR_DCR(%s);", dst);
+    } else if (opcode < 0x40 && (opcode & 0x07) == 0x06) {
+        if (*dst == 'M')
+            snprintf(line, sizeof(line), "SR_MVI_M(0x%02X);", d8);
+        else
+            snprintf(line, sizeof(line), "SR_MVI(%s, 0x%02X);", dst, d8);
+    } else if (opcode < 0x40 && (opcode & 0x0F) == 0x01) {
+        if (opcode == 0x31)
+            snprintf(line, sizeof(line), "SR_LXI_SP(0x%04X);", d16);
+        else
+            snprintf(line, sizeof(line), "SR_LXI(%s, 0x%04X);", word, d16);
+    } else if (opcode < 0x40 && (opcode & 0x07) == 0x03) {
+        const char *op = (opcode & 0x08) ? "DCX" : "INX";
+        if (opcode >= 0x30)
+            snprintf(line, sizeof(line), "SR_%s_SP();", op);
+        else
+            snprintf(line, sizeof(line), "SR_%s(%s);", op, word);
+    } else if (opcode < 0x40 && (opcode & 0x0F) == 0x09) {
+        if (opcode == 0x39)
+            snprintf(line, sizeof(line), "SR_DAD(cpu->SP);");
+        else
+            snprintf(line, sizeof(line), "SR_DAD(cpu->%s);", word);
+    } else if ((opcode & 0xCF) == 0xC1 || (opcode & 0xCF) == 0xC5) {
+        const char *op = (opcode & 0x04) ? "PUSH" : "POP";
+        if (opcode >= 0xF0)
+            snprintf(line, sizeof(line), "SR_%s_PSW();", op);
+        else
+            snprintf(line, sizeof(line), "SR_%s(%s, %s);", op, pair[0], pair[1]);
+    } else if (is_conditional_jump(opcode)) {
+        snprintf(line, sizeof(line), "SR_JCOND(%s, 0x%04X, 0x%04X);", cond, d16, next);
+        ends_block = 1;
+    } else if (is_conditional_call(opcode)) {
+        snprintf(line, sizeof(line), "SR_CCOND(%s, 0x%04X, 0x%04X);", cond, d16, next);
+        ends_block = 1;
+    } else if (is_conditional_ret(opcode)) {
+        snprintf(line, sizeof(line), "SR_RCOND(%s, 0x%04X);", cond, next);
+        ends_block = 1;
+    } else {
+        ends_block = is_unconditional_exit(opcode) || opcode == 0xCD;
+
+        switch (opcode) {
+            case 0x00: case 0x08: case 0x10: case 0x18:
+            case 0x20: case 0x28: case 0x30: case 0x38:
+                snprintf(line, sizeof(line), "SR_NOP();"); break;
+            case 0x02: snprintf(line, sizeof(line), "SR_STAX(BC);"); break;
+            case 0x12: snprintf(line, sizeof(line), "SR_STAX(DE);"); break;
+            case 0x0A: snprintf(line, sizeof(line), "SR_LDAX(BC);"); break;
+            case 0x1A: snprintf(line, sizeof(line), "SR_LDAX(DE);"); break;
+            case 0x22: snprintf(line, sizeof(line), "SR_SHLD(0x%04X);", d16); break;
+            case 0x2A: snprintf(line, sizeof(line), "SR_LHLD(0x%04X);", d16); break;
+            case 0x32: snprintf(line, sizeof(line), "SR_STA(0x%04X);", d16); break;
+            case 0x3A: snprintf(line, sizeof(line), "SR_LDA(0x%04X);", d16); break;
+            case 0x07: snprintf(line, sizeof(line), "SR_RLC();"); break;
+            case 0x0F: snprintf(line, sizeof(line), "SR_RRC();"); break;
+            case 0x17: snprintf(line, sizeof(line), "SR_RAL();"); break;
+            case 0x1F: snprintf(line, sizeof(line), "SR_RAR();"); break;
+            case 0x2F: snprintf(line, sizeof(line), "SR_CMA();"); break;
+            case 0x37: snprintf(line, sizeof(line), "SR_STC();"); break;
+            case 0x3F: snprintf(line, sizeof(line), "SR_CMC();"); break;
+            case 0xC3: snprintf(line, sizeof(line), "SR_JMP(0x%04X);", d16); break;
+            case 0xC9: snprintf(line, sizeof(line), "SR_RET();"); break;
+            case 0xCD: snprintf(line, sizeof(line), "SR_CALL(0x%04X, 0x%04X);", d16, next); break;
+            case 0xDB: snprintf(line, sizeof(line), "SR_IN(0x%02X);", d8); break;
+            case 0xE3: snprintf(line, sizeof(line), "SR_XTHL();"); break;
+            case 0xE9: snprintf(line, sizeof(line), "SR_PCHL();"); break;
+            case 0xEB: snprintf(line, sizeof(line), "SR_XCHG();"); break;
+            case 0xF3: snprintf(line, sizeof(line), "SR_DI();"); break;
+            case 0xF9: snprintf(line, sizeof(line), "SR_SPHL();"); break;
+            case 0xFB: snprintf(line, sizeof(line), "SR_EI();"); break;
+            default:
+                // DAA, HLT: not worth a template
+                snprintf(line, sizeof(line), "SR_INTERPRET(0x%04X);", pc);
+                break;
+        }
+    }
+
+    const Instruction *instruction = &disassembler_instruction_table[opcode];
+    if (instruction_length(opcode) == 2)
+        fprintf(out, "    %-48s// %04X  %-12s0x%02x\n", line, pc, instruction->mnemonic, d8);
+    else if (instruction_length(opcode) == 3)
+        fprintf(out, "    %-48s// %04X  %-12s0x%04x\n", line, pc, instruction->mnemonic, d16);
+    else
+        fprintf(out, "    %-48s// %04X  %s\n", line, pc, instruction->mnemonic);
+
+    return ends_block;
+}
+
+/**
+ * Writes the function for the block starting at start
+ *
+ * @param out    Generated source file
+ * @param start  Address of the first instruction
+ * @return       Address of the last instruction the block runs
+ */
+static uint16_t emit_block(FILE *out, uint16_t start) {
+    uint16_t pc = start;
+    uint16_t last = start;
+
+    fprintf(out, "static void block_%04X(CPU *cpu) {\n", start);
+    for (;;) {
+        last = pc;
+        if (emit_instruction(out, pc))
+            break;
+
+        pc += instruction_length(rom[pc]);
+        if (!fits_in_rom(pc) || (marks[pc] & IS_BLOCK_START) || is_interpreted(rom[pc])) {
+            fprintf(out, "    SR_EXIT(0x%04X);\n", pc);
+            break;
+        }
+    }
+    fprintf(out, "}\n\n");
+    return last;
+}
+
+// FNV-1a, same as static_rom_hash in cpu_static.c
+static uint32_t rom_hash(void) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < ROM_SIZE; i++) {
+        hash ^= rom[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int has_block(uint16_t pc) {
+    return (marks[pc] & IS_BLOCK_START) && (marks[pc] & IS_CODE) && !is_interpreted(rom[pc]);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <rom> <output.c>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *rom_file = fopen(argv[1], "rb");
+    if (!rom_file) error("could not open the ROM");
+    size_t rom_size = fread(rom, 1, ROM_SIZE, rom_file);
+    fclose(rom_file);
+    if (rom_size != ROM_SIZE) error("ROM is not 8 KB");
+
+    walk_rom();
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) error("could not open the output file");
+
+    fprintf(out, "// Generated by tools/recompiler from %s, do not edit.\n\n", argv[1]);
+    fprintf(out, "#include \"static_core.h\"\n\n");
+    fprintf(out, "const uint32_t static_rom_checksum = 0x%08X;\n\n", rom_hash());
+
+    static uint16_t last[ROM_SIZE];
+    unsigned count = 0;
+    for (uint32_t pc = 0; pc < ROM_SIZE; pc++) {
+        if (has_block(pc)) {
+            last[pc] = emit_block(out, pc);
+            count++;
+        }
+    }
+
+    fprintf(out, "const StaticBlock static_blocks[] = {\n");
+    for (uint32_t pc = 0; pc < ROM_SIZE; pc++) {
+        if (has_block(pc))
+            fprintf(out, "    {0x%04X, 0x%04X, block_%04X},\n", pc, last[pc], pc);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const unsigned static_block_count = %u;\n", count);
+
+    fclose(out);
+    printf("recompiler: %u blocks\n", count);
+    return 0;
+}